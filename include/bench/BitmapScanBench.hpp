@@ -0,0 +1,203 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+
+#include <boost/format.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// compares the word-at-a-time volume bitmap scanning kernels against
+/// the byte-then-bit loops that they replaced
+class BitmapScanBench
+{
+  public:
+    BitmapScanBench()
+    {
+        // 2^28 blocks, i.e. a 1 TiB container of 4 KiB blocks
+        uint64_t const blocks = uint64_t(1) << 28;
+        uint64_t const bytes = blocks / 8;
+
+        // half of all blocks in use, at random
+        std::vector<uint8_t> randomFill(bytes);
+        std::mt19937_64 rng(42);
+        for (auto & byte : randomFill) {
+            byte = static_cast<uint8_t>(rng());
+        }
+
+        // everything in use apart from a handful of blocks right at the end
+        std::vector<uint8_t> nearlyFull(bytes, 0xFF);
+        for (uint64_t i = 0; i < 64; ++i) {
+            knoxcrypt::detail::setBitInByte(nearlyFull[bytes - 1 - (i * 97)], i % 8, false);
+        }
+
+        // one free block every 64 or so
+        std::vector<uint8_t> sparseFree(bytes, 0xFF);
+        for (uint64_t i = 0; i < bytes; i += 8) {
+            knoxcrypt::detail::setBitInByte(sparseFree[i], int(rng() % 8), false);
+        }
+
+        countAllocated(randomFill);
+        nextAvailable(nearlyFull, blocks);
+        nAvailable(sparseFree, 1 << 20);
+    }
+
+  private:
+
+    using Clock = std::chrono::steady_clock;
+
+    template <typename F>
+    double secondsFor(F const &f, int const repeats = 10)
+    {
+        // best of repeats to minimize noise
+        double best = 1e30;
+        for (int r = 0; r < repeats; ++r) {
+            auto const start = Clock::now();
+            f();
+            std::chrono::duration<double> const took = Clock::now() - start;
+            if (took.count() < best) {
+                best = took.count();
+            }
+        }
+        return best;
+    }
+
+    void report(std::string const &name, uint64_t const bytes,
+                double const legacy, double const words, bool const agree)
+    {
+        double const mb = double(bytes) / (1024.0 * 1024.0);
+        std::cout<<boost::format("%1% %|40t|bytewise %2$8.1f MB/s %|66t|wordwise %3$8.1f MB/s %|92t|x%4$.1f %5%\n")
+            % name % (mb / legacy) % (mb / words) % (legacy / words)
+            % (agree ? "" : "(RESULTS DIFFER)");
+    }
+
+    // the original byte-then-bit loops, kept here only for comparison
+
+    static uint64_t legacyCount(std::vector<uint8_t> const &buf)
+    {
+        uint64_t allocatedBlocks(0);
+        for (uint64_t byte = 0; byte < buf.size(); ++byte) {
+            uint8_t dat = buf[byte];
+            if(dat == 0xFF) {
+                allocatedBlocks += 8;
+                continue;
+            }
+            for(int i = 0; i < 8; ++i) {
+                if(knoxcrypt::detail::isBitSetInByte(dat, i)) {
+                    ++allocatedBlocks;
+                }
+            }
+        }
+        return allocatedBlocks;
+    }
+
+    static uint64_t legacyNext(std::vector<uint8_t> &buf)
+    {
+        uint64_t bitCounter(0);
+        for (uint64_t i = 0; i < buf.size(); ++i) {
+            int availableBit = knoxcrypt::detail::getNextAvailableBitInAByte(buf[i]);
+            if(availableBit > -1) {
+                bitCounter += availableBit;
+                break;
+            }
+            bitCounter += 8;
+        }
+        return bitCounter;
+    }
+
+    static uint64_t legacyN(std::vector<uint8_t> &buf, uint64_t const blocksRequired,
+                            std::vector<uint64_t> &bitBuffer)
+    {
+        uint64_t eightCounter(0);
+        uint64_t filled(0);
+        for (uint64_t i = 0; i < buf.size(); ++i) {
+            if(buf[i] != 0xFF) {
+                for (int b = 0; b < 8; ++b) {
+                    if(!knoxcrypt::detail::isBitSetInByte(buf[i], b)) {
+                        bitBuffer[filled] = b + eightCounter;
+                        ++filled;
+                        if (filled == blocksRequired) {
+                            return filled;
+                        }
+                    }
+                }
+            }
+            eightCounter += 8;
+        }
+        return filled;
+    }
+
+    void countAllocated(std::vector<uint8_t> &buf)
+    {
+        uint64_t legacyResult(0);
+        uint64_t wordResult(0);
+        auto legacy = secondsFor([&]() { legacyResult = legacyCount(buf); });
+        auto words = secondsFor([&]() {
+            wordResult = knoxcrypt::detail::countAllocatedBlocksInBitmap(&buf.front(), buf.size());
+        });
+        report("count allocated (50% random fill)", buf.size(), legacy, words, legacyResult == wordResult);
+    }
+
+    void nextAvailable(std::vector<uint8_t> &buf, uint64_t const blocks)
+    {
+        uint64_t legacyResult(0);
+        knoxcrypt::detail::OptionalBlock wordResult;
+        auto legacy = secondsFor([&]() { legacyResult = legacyNext(buf); });
+        auto words = secondsFor([&]() {
+            wordResult = knoxcrypt::detail::findNextAvailableBlockInBitmap(&buf.front(), buf.size(), blocks);
+        });
+        report("next available (free only at end)", buf.size(), legacy, words,
+               wordResult && *wordResult == legacyResult);
+    }
+
+    void nAvailable(std::vector<uint8_t> &buf, uint64_t const n)
+    {
+        // the results go in to buffers that have already been written to
+        // so that page faults on a fresh result vector, which both loops
+        // would pay alike, aren't what is being timed
+        std::vector<uint64_t> legacyResult(n, 1);
+        std::vector<uint64_t> wordResult(n, 1);
+        uint64_t legacyFound(0);
+        uint64_t wordFound(0);
+        auto legacy = secondsFor([&]() { legacyFound = legacyN(buf, n, legacyResult); });
+        auto words = secondsFor([&]() {
+            wordFound = knoxcrypt::detail::findNAvailableBlocksInBitmap(&buf.front(), buf.size(), n,
+                                                                        &wordResult.front());
+        });
+        // both scan up to the nth free block
+        report("n available (1 free per 64)", (n * 64) / 8, legacy, words,
+               legacyFound == wordFound && legacyResult == wordResult);
+    }
+};
@@ -0,0 +1,241 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// measures how quickly each supported cipher moves data through the
+/// ContainerImageStream path, on one thread and on several, and writes
+/// the results out as JSON. Encrypted images are measured both through
+/// the positional cipher pipeline (ImageCipher) and through CryptoStreamPP
+/// so that the two can be compared
+class CipherThroughputBench
+{
+  public:
+    explicit CipherThroughputBench(std::string const &jsonPath)
+        : m_directory(scratchDirectory())
+        , m_threads(std::max(2u, std::min(8u, std::thread::hardware_concurrency())))
+        , m_results()
+    {
+        boost::filesystem::create_directories(m_directory);
+        for (auto const &cipher : ciphers()) {
+            auto const io(buildImage(cipher));
+            for (auto const &path : paths(io)) {
+                for (unsigned const threads : {1u, m_threads}) {
+                    // the smallest requests are dominated by what each call
+                    // costs besides moving bytes
+                    for (uint64_t const request : {uint64_t(512), uint64_t(4096), uint64_t(65536),
+                                                   uint64_t(1024 * 1024)}) {
+                        measure(cipher.first, path, "sequential", "write", request, threads);
+                        measure(cipher.first, path, "sequential", "read", request, threads);
+                    }
+                    measure(cipher.first, path, "random", "read", 4096, threads);
+                }
+            }
+        }
+        boost::filesystem::remove_all(m_directory);
+        writeJson(jsonPath);
+    }
+
+  private:
+
+    using Clock = std::chrono::steady_clock;
+    using Cipher = std::pair<std::string, cryptostreampp::Algorithm>;
+    using Stream = std::unique_ptr<knoxcrypt::ContainerImageStream>;
+    using Path = std::pair<std::string, knoxcrypt::SharedCoreIO>;
+
+    struct Result
+    {
+        std::string cipher;
+        std::string path;
+        std::string pattern;
+        std::string operation;
+        uint64_t requestBytes;
+        unsigned threads;
+        double mbPerSecond;
+    };
+
+    /// how big each benchmark image is; every thread works on its own share
+    static uint64_t const IMAGE_BYTES = 16 * 1024 * 1024;
+
+    boost::filesystem::path m_directory;
+    unsigned m_threads;
+    std::vector<Result> m_results;
+
+    /// memory backed when tmpfs is available so that the disk isn't measured
+    static boost::filesystem::path scratchDirectory()
+    {
+        boost::filesystem::path const shm("/dev/shm");
+        boost::filesystem::path const base(boost::filesystem::is_directory(shm) ? shm
+                                           : boost::filesystem::temp_directory_path());
+        return base / boost::filesystem::unique_path();
+    }
+
+    /// every algorithm that an image header can name
+    static std::vector<Cipher> ciphers()
+    {
+        using cryptostreampp::Algorithm;
+        return {{"aes", Algorithm::AES}, {"twofish", Algorithm::Twofish},
+                {"serpent", Algorithm::Serpent}, {"rc6", Algorithm::RC6},
+                {"mars", Algorithm::MARS}, {"cast256", Algorithm::CAST256},
+                {"camellia", Algorithm::Camellia}, {"rc5", Algorithm::RC5},
+                {"shacal2", Algorithm::SHACAL2}, {"blowfish", Algorithm::Blowfish},
+                {"skipjack", Algorithm::SKIPJACK}, {"idea", Algorithm::IDEA},
+                {"seed", Algorithm::SEED}, {"tea", Algorithm::TEA},
+                {"xtea", Algorithm::XTEA}, {"des_ede2", Algorithm::DES_EDE2},
+                {"des_ede3", Algorithm::DES_EDE3}, {"null", Algorithm::NONE}};
+    }
+
+    knoxcrypt::SharedCoreIO buildImage(Cipher const &cipher)
+    {
+        auto io(std::make_shared<knoxcrypt::CoreIO>());
+        io->path = (m_directory / cipher.first).string();
+        io->blockSize = 4096;
+        io->encProps.password = "bench";
+        io->encProps.iv = uint64_t(3081342484970028645);
+        io->encProps.iv2 = uint64_t(3081342484970028645);
+        io->encProps.iv3 = uint64_t(3081342484970028645);
+        io->encProps.iv4 = uint64_t(3081342484970028645);
+        io->encProps.cipher = cipher.second;
+        io->rounds = 64;
+        io->useBlockCache = false;
+        io->firstTimeInit = true;
+
+        knoxcrypt::ContainerImageStream out(io, std::ios::out | std::ios::binary);
+        std::vector<char> const zeros(1024 * 1024, 0);
+        for (uint64_t written = 0; written < IMAGE_BYTES; written += zeros.size()) {
+            (void)out.write(&zeros.front(), zeros.size());
+        }
+        out.flush();
+        out.close();
+        return io;
+    }
+
+    /// the ways of reaching an image: an encrypted one both through the
+    /// cipher pipeline and through CryptoStreamPP, an unencrypted one plainly
+    static std::vector<Path> paths(knoxcrypt::SharedCoreIO const &io)
+    {
+        if (io->encProps.cipher == cryptostreampp::Algorithm::NONE) {
+            return {{"plain", io}};
+        }
+        auto streamed(std::make_shared<knoxcrypt::CoreIO>(*io));
+        streamed->cipherPipeline = false;
+        streamed->imageCipher.reset();
+        return {{"pipeline", io}, {"stream", streamed}};
+    }
+
+    /// one thread's share of a measurement
+    static void work(knoxcrypt::ContainerImageStream &stream, bool const write, bool const random,
+                     uint64_t const begin, uint64_t const end, uint64_t const request)
+    {
+        std::vector<char> buffer(request, 'k');
+        if (random) {
+            std::mt19937_64 rng(begin);
+            uint64_t const slots = (end - begin) / request;
+            for (uint64_t i = 0; i < slots; ++i) {
+                (void)stream.readAt(begin + (rng() % slots) * request, &buffer.front(), request);
+            }
+            return;
+        }
+        for (uint64_t offset = begin; offset + request <= end; offset += request) {
+            if (write) {
+                (void)stream.writeAt(offset, &buffer.front(), request);
+            } else {
+                (void)stream.readAt(offset, &buffer.front(), request);
+            }
+        }
+        stream.flush();
+    }
+
+    void measure(std::string const &cipher, Path const &path, std::string const &pattern,
+                 std::string const &operation, uint64_t const request, unsigned const threads)
+    {
+        auto const &io = path.second;
+        // streams are opened, and keys set up, before the clock starts
+        std::vector<Stream> streams;
+        for (unsigned t = 0; t < threads; ++t) {
+            streams.emplace_back(new knoxcrypt::ContainerImageStream(io, std::ios::in | std::ios::out |
+                                                                         std::ios::binary));
+        }
+
+        uint64_t const share = IMAGE_BYTES / threads;
+        bool const write = operation == "write";
+        bool const random = pattern == "random";
+        auto const start = Clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back(&CipherThroughputBench::work, std::ref(*streams[t]), write, random,
+                                 t * share, (t + 1) * share, request);
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        std::chrono::duration<double> const took = Clock::now() - start;
+
+        uint64_t const moved = threads * ((share / request) * request);
+        double const mbPerSecond = (double(moved) / (1024.0 * 1024.0)) / took.count();
+        m_results.push_back(Result{cipher, path.first, pattern, operation, request, threads, mbPerSecond});
+        std::cout<<boost::format("%1% %|12t|%2% %|22t|%3% %4% %|42t|%5$8d bytes %|58t|%6% thread(s) %|74t|%7$10.1f MB/s\n")
+            % cipher % path.first % pattern % operation % request % threads % mbPerSecond;
+    }
+
+    void writeJson(std::string const &jsonPath) const
+    {
+        std::ofstream json(jsonPath.c_str());
+        json<<"{\n  \"imageBytes\": "<<IMAGE_BYTES<<",\n  \"results\": [\n";
+        for (std::size_t i = 0; i < m_results.size(); ++i) {
+            auto const &result = m_results[i];
+            json<<boost::format("    {\"cipher\": \"%1%\", \"path\": \"%2%\", \"pattern\": \"%3%\", "
+                                "\"operation\": \"%4%\", \"requestBytes\": %5%, \"threads\": %6%, "
+                                "\"mbPerSecond\": %7$.2f}%8%\n")
+                % result.cipher % result.path % result.pattern % result.operation % result.requestBytes
+                % result.threads % result.mbPerSecond % (i + 1 < m_results.size() ? "," : "");
+        }
+        json<<"  ]\n}\n";
+        std::cout<<"Cipher results written to "<<jsonPath<<std::endl;
+    }
+};
@@ -0,0 +1,111 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace knoxcrypt
+{
+
+    class AlignedBufferPool;
+    using SharedAlignedBufferPool = std::shared_ptr<AlignedBufferPool>;
+
+    /**
+     * @brief a pool of equally sized buffers aligned to the page size, so
+     * that block-sized image requests can be issued from memory suitable
+     * for direct I/O and so that buffers are recycled rather than
+     * allocated and freed per block. A buffer goes back to its pool when
+     * released; the pool keeps a bounded number of idle buffers.
+     */
+    class AlignedBufferPool : public std::enable_shared_from_this<AlignedBufferPool>
+    {
+      public:
+
+        /// returns a buffer to the pool it came from
+        struct Returner
+        {
+            SharedAlignedBufferPool pool;
+            void operator()(char * const buffer) const;
+        };
+        using Buffer = std::unique_ptr<char[], Returner>;
+
+        AlignedBufferPool() = delete;
+
+        /**
+         * @brief creates an empty pool; use get
+         * @param bufferSize the size in bytes of each buffer
+         * @param maxIdle the number of released buffers to hold on to
+         */
+        AlignedBufferPool(std::size_t const bufferSize, std::size_t const maxIdle);
+
+        /// frees the idle buffers
+        ~AlignedBufferPool();
+
+        /**
+         * @brief  retrieves the process-wide pool of buffers of the given size
+         * @param  bufferSize the size in bytes of each buffer
+         * @return the pool
+         */
+        static SharedAlignedBufferPool get(std::size_t const bufferSize);
+
+        /**
+         * @brief  takes an idle buffer, or allocates one if there are none;
+         *         throws std::bad_alloc if allocation fails
+         * @return the buffer, whose contents are unspecified
+         */
+        Buffer acquire();
+
+        /// the size in bytes of each buffer
+        std::size_t bufferSize() const;
+
+        /// the number of buffers waiting to be reused
+        std::size_t idle() const;
+
+      private:
+
+        // the size in bytes of each buffer
+        std::size_t m_bufferSize;
+
+        // the number of released buffers to hold on to
+        std::size_t m_maxIdle;
+
+        // released buffers waiting to be reused
+        std::vector<char*> m_idle;
+
+        // guards m_idle
+        mutable std::mutex m_mutex;
+
+        /// takes back a buffer, freeing it if enough are already idle
+        void release(char * const buffer);
+    };
+
+}
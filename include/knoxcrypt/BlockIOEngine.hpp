@@ -0,0 +1,160 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/CoreIO.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace knoxcrypt
+{
+
+    class BlockIOEngine;
+    using SharedBlockIOEngine = std::shared_ptr<BlockIOEngine>;
+
+    /**
+     * @brief keeps a number of image reads and writes in flight at once so
+     * that throughput on devices with deep queues (e.g. NVMe) isn't bound
+     * by the latency of a single request. Requests are submitted in
+     * batches; large requests are split so that a single sequential read
+     * also keeps the queue full. Each request slot is serviced by its own
+     * ContainerImageStream, and so its own file descriptor, meaning that
+     * requests go through the cipher, the decrypted block cache and any
+     * image mapping exactly as reads and writes made by File do.
+     *
+     * This is a pool of worker threads standing in for a submission queue,
+     * not a submission queue: each worker makes ordinary blocking reads and
+     * writes, one at a time, and nothing is handed to the kernel
+     * asynchronously (there is no io_uring or AIO). The queue depth is the
+     * number of workers. A worker flushes its writes once per batch, when
+     * the next queued request belongs to another batch or none is left,
+     * rather than after every request
+     */
+    class BlockIOEngine
+    {
+      public:
+
+        /// a single read in to, or write from, a caller-owned buffer
+        struct Request
+        {
+            bool write;
+            uint64_t offset;
+            char *buffer;
+            uint64_t length;
+        };
+        using Batch = std::vector<Request>;
+
+        /// what is left of a submitted batch
+        struct Pending
+        {
+            uint64_t outstanding;
+            bool failed;
+        };
+        using Ticket = std::shared_ptr<Pending>;
+
+        BlockIOEngine() = delete;
+
+        /**
+         * @brief starts an engine for the image referred to by io
+         * @param io the core knoxcrypt io (path, cipher, caches)
+         * @param queueDepth the number of worker threads, and so of
+         *        requests kept in flight
+         */
+        BlockIOEngine(SharedCoreIO const &io, unsigned const queueDepth);
+
+        /// completes anything still queued then stops
+        ~BlockIOEngine();
+
+        /**
+         * @brief  retrieves the engine associated with io, starting it if
+         *         it hasn't yet been started
+         * @param  io the core knoxcrypt io
+         * @return the engine, or null if io's queue depth is zero
+         */
+        static SharedBlockIOEngine get(SharedCoreIO const &io);
+
+        /**
+         * @brief  queues a batch of requests; the buffers they refer to must
+         *         stay valid until the batch has been completed
+         * @param  batch the requests
+         * @return a ticket with which to complete the batch
+         */
+        Ticket submit(Batch const &batch);
+
+        /**
+         * @brief  waits for every request of a submitted batch to finish
+         * @param  ticket as returned by submit
+         * @return false if any request could not be read or written in full
+         */
+        bool complete(Ticket const &ticket);
+
+        /// the number of requests kept in flight
+        unsigned queueDepth() const;
+
+      private:
+
+        /// a piece of a request as handed to a worker
+        struct Slice
+        {
+            Request request;
+            Ticket ticket;
+        };
+
+        // the core knoxcrypt io that worker streams are opened with
+        SharedCoreIO m_io;
+
+        // requests waiting for a worker
+        std::deque<Slice> m_queue;
+
+        // one per request in flight
+        std::vector<std::thread> m_workers;
+
+        // set once the workers are to finish
+        bool m_stopping;
+
+        // guards the queue, tickets and m_stopping
+        std::mutex m_mutex;
+
+        // signalled when a slice is queued
+        std::condition_variable m_queued;
+
+        // signalled when a slice has finished
+        std::condition_variable m_finished;
+
+        /// takes slices off the queue until stopped
+        void work();
+    };
+
+}
@@ -144,7 +144,9 @@ namespace knoxcrypt
 
         void writeNewMetaDataForEntry(std::string const &name,
                                       EntryType const &entryType,
-                                      uint64_t startBlock);
+                                      uint64_t startBlock,
+                                      uint64_t fileSize,
+                                      uint64_t blockCount);
 
       private:
         void doAddContentFolder();
@@ -29,11 +29,18 @@
 #pragma once
 
 #include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/DecryptedBlockCache.hpp"
+#include "knoxcrypt/HostPageCache.hpp"
+#include "knoxcrypt/MappedImage.hpp"
+#include "knoxcrypt/PlainImage.hpp"
 #include "utility/EventType.hpp"
 #include "cryptostreampp/CryptoStreamPP.hpp"
 
+#include <boost/optional.hpp>
+
 #include <functional>
 #include <memory>
+#include <mutex>
 
 #include <fstream>
 #include <string>
@@ -43,6 +50,24 @@ namespace knoxcrypt
     class ContainerImageStream;
     using SharedImageStream = std::shared_ptr<ContainerImageStream>;
 
+    /**
+     * @brief reads and writes the image through a CryptoStreamPP, serving
+     * reads from the decrypted block cache when there is one. When CoreIO's
+     * mapImage is set and the image's cipher is NONE or one an ImageCipher
+     * can apply, a stream opened for input instead copies directly between
+     * the image's memory mapping and the caller's buffers, transforming
+     * bytes on the way; see MappedImage. Any other stream of an image
+     * whose cipher is NONE, or of an encrypted image without a decrypted
+     * block cache whose cipher an ImageCipher can apply, reads and writes
+     * the image with positional I/O, transforming bytes with the
+     * ImageCipher on the way; see PlainImage. Such mapped or plain streams
+     * bypass both the cipher stream and the decrypted block cache, leaving
+     * the host's page cache as the only cache. When CoreIO's dropHostCache is
+     * set, the host is advised to drop image ranges that the stream reads
+     * or writes from its page cache, written ones at the next sync point,
+     * so that decrypted data is mostly cached once, by the decrypted block
+     * cache. This is a cache hint, not O_DIRECT; see HostPageCache.
+     */
     class ContainerImageStream
     {
       public:
@@ -54,6 +79,30 @@ namespace knoxcrypt
 
         ContainerImageStream& write(char const * buf, std::streamsize const n);
 
+        /**
+         * @brief  reads bytes from the given image offset without going
+         *         through the stream position, so that several threads may
+         *         read through the one stream; reads served from the
+         *         decrypted block cache don't touch the stream at all and,
+         *         when the image has an ImageCipher, nor do those that
+         *         aren't
+         * @param  offset the image offset to read from
+         * @param  buf the buffer to read in to
+         * @param  n the number of bytes to read
+         * @return the stream; its position afterwards is unspecified
+         */
+        ContainerImageStream& readAt(std::streamoff const offset, char * const buf, std::streamsize const n);
+
+        /**
+         * @brief  writes bytes to the given image offset without going
+         *         through the stream position; see readAt
+         * @param  offset the image offset to write to
+         * @param  buf the bytes to write
+         * @param  n the number of bytes to write
+         * @return the stream; its position afterwards is unspecified
+         */
+        ContainerImageStream& writeAt(std::streamoff const offset, char const * buf, std::streamsize const n);
+
         ContainerImageStream& seekg(std::streampos pos);
         ContainerImageStream& seekg(std::streamoff off, std::ios_base::seekdir way);
         ContainerImageStream& seekp(std::streampos pos);
@@ -72,7 +121,100 @@ namespace knoxcrypt
         void open(SharedCoreIO const &io,
                   std::ios::openmode mode = std::ios::out | std::ios::binary);
       private:
+        /// the mapped image when reading and writing through a mapping;
+        /// null otherwise
+        SharedMappedImage m_mapped;
+
+        /// the image when reading and writing it with plain positional
+        /// I/O; null otherwise. Without either, m_cryptoStream is used
+        SharedPlainImage m_plain;
+
+        /// whether a mapped or plain stream is open
+        bool m_rawOpen;
+
+        /// the fail and bad bits of a mapped or plain stream
+        std::ios::iostate m_rawState;
+
         cryptostreampp::SharedCryptoStream m_cryptoStream;
+
+        /// decrypted data shared with other streams of the same image;
+        /// null when caching is disabled
+        SharedDecryptedBlockCache m_cache;
+
+        /// alongside the cache, the image opened for positional access
+        /// through its ImageCipher. Page loads, and reads and writes made
+        /// with readAt and writeAt that the cache doesn't take, go through
+        /// it rather than the cipher stream, and so without m_ioMutex.
+        /// Null if there is no cache, the image has no ImageCipher or the
+        /// stream appends
+        SharedPlainImage m_positional;
+
+        /// the mode the stream was opened with
+        std::ios::openmode m_mode;
+
+        /// the stream position when known without asking the underlying
+        /// stream; used so that cached reads don't have to seek
+        boost::optional<std::streamoff> m_pos;
+
+        /// true if the underlying stream isn't positioned at m_pos
+        bool m_seekPending;
+
+        /// for advising the host to drop image data from its page cache
+        /// when CoreIO's dropHostCache is set; null otherwise
+        SharedHostPageCache m_hostCache;
+
+        /// held while the underlying stream is seeked and then read from
+        /// or written to on behalf of readAt, writeAt or a page load, when
+        /// there is no m_positional
+        std::mutex m_ioMutex;
+
+        /**
+         * @brief moves the underlying stream to the tracked position if
+         * it has been deferred by a seek or moved by a cached read
+         */
+        void syncPosition();
+
+        /**
+         * @brief when CoreIO's dropHostCache is set, drops an image range that was read from
+         * the host's page cache, or notes one that was written so that it
+         * is dropped once written back
+         * @param offset the image offset of the range
+         * @param n the length of the range
+         * @param written true if the range was written to
+         */
+        void bypassHostCache(std::streamoff const offset, std::streamsize const n, bool const written);
+
+        /// for loading pages missing from the cache through this stream
+        DecryptedBlockCache::PageLoader pageLoader();
+
+        /// true if the image is read and written through m_mapped or
+        /// m_plain, with no cipher stream and no decrypted block cache involved
+        bool isRaw() const;
+
+        /// reads from m_mapped or m_plain, whichever is in use; see MappedImage::read
+        uint64_t rawRead(uint64_t const offset, char * const buf, uint64_t const n);
+
+        /// writes to m_mapped or m_plain, whichever is in use; see MappedImage::write
+        uint64_t rawWrite(uint64_t const offset, char const * const buf, uint64_t const n);
+
+        /// the size of the image as seen through m_mapped or m_plain
+        uint64_t rawSize() const;
+
+        /**
+         * @brief  whether a stream opened with the given mode may go through
+         *         the mapping; writing only or truncating needs the stream
+         * @param  mode the open mode
+         * @return true if the mapping can be used
+         */
+        static bool canMap(std::ios::openmode const mode);
+
+        /**
+         * @brief  resolves a seek of a mapped or plain stream
+         * @param  off the offset to seek to
+         * @param  way the position to offset from
+         * @return the new position
+         */
+        std::streamoff rawSeek(std::streamoff const off, std::ios_base::seekdir const way);
     };
 
 }
@@ -199,10 +199,14 @@ namespace knoxcrypt
          * @param name name of entry
          * @param entryType the type of the entry
          * @param startBlock start block of entry
+         * @param fileSize the size of a file entry
+         * @param blockCount the number of blocks of a file entry
          */
         void writeNewMetaDataForEntry(std::string const &name,
                                       EntryType const& entryType,
-                                      uint64_t startBlock);
+                                      uint64_t startBlock,
+                                      uint64_t fileSize,
+                                      uint64_t blockCount);
 
         long getAliveEntryCount() const;
         long getTotalEntryCount() const;
@@ -217,10 +221,14 @@ namespace knoxcrypt
          * @param name name of entry
          * @param entryType the type of the entry
          * @param startBlock start block of entry
+         * @param fileSize the size of a file entry
+         * @param blockCount the number of blocks of a file entry
          */
         void doWriteNewMetaDataForEntry(std::string const &name,
                                         EntryType const& entryType,
-                                        uint64_t startBlock);
+                                        uint64_t startBlock,
+                                        uint64_t fileSize,
+                                        uint64_t blockCount);
 
         /**
          * @brief a private accessor for getting file entry from metadata
@@ -274,6 +282,18 @@ namespace knoxcrypt
          */
         std::streamsize doWriteFirstBlockIndexToEntryMetaData(uint64_t firstBlock);
 
+        /**
+         * @brief writes a file's size and block count to the file metadata
+         * (version 24 onwards)
+         * @param fileSize the size of the file
+         * @param blockCount the number of blocks making up the file
+         * @return number of bytes written
+         */
+        std::streamsize doWriteStatsToEntryMetaData(uint64_t fileSize, uint64_t blockCount);
+
+        /// the size of each entry's metadata; see detail::folderEntryBytes
+        uint64_t entryBytes() const;
+
         /**
          * @brief seeks to where the metadata should be written. If
          * metadata for a previous entry has been deleted, we should
@@ -51,6 +51,7 @@ namespace knoxcrypt
 
         ContentFolderEntryIterator(File * folderData,
                                    long const entryCount,
+                                   uint64_t const entryBytes,
                                    std::function<std::shared_ptr<EntryInfo>
                                    (std::vector<uint8_t> const &metaData,
                                     uint64_t const entryIndex)>);
@@ -66,6 +67,7 @@ namespace knoxcrypt
       private:
         File * m_folderData;
         long m_entryCount;
+        uint64_t m_entryBytes;
         std::function<std::shared_ptr<EntryInfo>
         (std::vector<uint8_t> const &metaData,
         uint64_t const entryIndex)> m_builder;
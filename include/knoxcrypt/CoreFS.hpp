@@ -62,6 +62,18 @@ namespace knoxcrypt
          */
         long getBlockSize() const;
 
+        /**
+         * Retrieve the number of file bytes that each block holds
+         */
+        long getBlockWriteSpace() const;
+
+        /**
+         * Retrieve the number of bytes to move per read or write when copying
+         * whole files; enough for reads to be batched by the I/O engine and
+         * for writes to be laid out contiguously
+         */
+        long getCopyBufferSize() const;
+
         /**
          * @brief  retrieves folder entry for given path
          * @param  path the path to retrieve entry for
@@ -156,6 +168,14 @@ namespace knoxcrypt
          */
         void statvfs(struct statvfs *buf);
 
+        /**
+         * @brief writes back everything held in memory: the data of the
+         * last opened file, volume bitmap changes and any blocks held back
+         * by a write-back cache, and modified pages of a mapped image; used
+         * on fsync and release
+         */
+        void sync();
+
       private:
 
         // the core knoxcrypt io (path, blocks, password)
@@ -29,6 +29,7 @@
 #pragma once
 
 #include "cryptostreampp/EncryptionProperties.hpp"
+#include "knoxcrypt/detail/DetailVersion.hpp"
 
 #include "utility/EventType.hpp"
 
@@ -42,6 +43,18 @@ namespace knoxcrypt
 
     class FileBlockBuilder;
     using SharedBlockBuilder = std::shared_ptr<FileBlockBuilder>;
+    class VolumeBitmap;
+    using SharedVolumeBitmap = std::shared_ptr<VolumeBitmap>;
+    class DecryptedBlockCache;
+    using SharedDecryptedBlockCache = std::shared_ptr<DecryptedBlockCache>;
+    class MappedImage;
+    using SharedMappedImage = std::shared_ptr<MappedImage>;
+    class BlockIOEngine;
+    using SharedBlockIOEngine = std::shared_ptr<BlockIOEngine>;
+    class HostPageCache;
+    using SharedHostPageCache = std::shared_ptr<HostPageCache>;
+    class ImageCipher;
+    using SharedImageCipher = std::shared_ptr<ImageCipher>;
 
     struct CoreIO
     {
@@ -49,14 +62,27 @@ namespace knoxcrypt
         uint64_t blocks;                 // total number of blocks
         uint64_t freeBlocks;             // number of free blocks
         long blockSize = 4096;           // size in bytes of each block
+        unsigned int version = detail::LATEST_VERSION; // container format version
         cryptostreampp::EncryptionProperties encProps; // stuff like password and iv
         unsigned int rounds;             // number of rounds used by enc. process
         uint64_t rootBlock;              // the start block of the root folder
         SharedBlockBuilder blockBuilder; // a block factory / resource manage
+        SharedVolumeBitmap volumeBitmap; // in-memory volume bitmap; see VolumeBitmap::get
         using Callback = std::function<void(knoxcrypt::EventType)>;
         using OptionalCallback = boost::optional<Callback>;
         OptionalCallback ccb;            // call back for cipher
         bool useBlockCache;              // cache available file blocks for faster retrieval
+        uint64_t decryptedCacheBytes = 0; // budget of the decrypted block cache; 0 disables it
+        uint64_t writeBackBytes = 0;      // dirty bytes the cache may hold; 0 writes straight through
+        SharedDecryptedBlockCache decryptedCache; // see DecryptedBlockCache::get
+        bool mapImage = false;           // access the image through a memory mapping
+        SharedMappedImage mappedImage;   // see MappedImage::get
+        bool dropHostCache = false;      // advise the host to drop image pages once used; not O_DIRECT
+        SharedHostPageCache hostPageCache; // see HostPageCache::get
+        unsigned int ioQueueDepth = 0;   // image requests kept in flight by File reads; 0 disables batching
+        SharedBlockIOEngine ioEngine;    // see BlockIOEngine::get
+        bool cipherPipeline = true;      // encrypt with ImageCipher rather than CryptoStreamPP where possible
+        SharedImageCipher imageCipher;   // see ImageCipher::get
         bool firstTimeInit;              // initialized very first time
         
         // Should key be initialized very first time?
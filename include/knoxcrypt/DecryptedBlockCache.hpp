@@ -0,0 +1,235 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/AlignedBufferPool.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace knoxcrypt
+{
+
+    class ContainerImageStream;
+    class DecryptedBlockCache;
+    using SharedDecryptedBlockCache = std::shared_ptr<DecryptedBlockCache>;
+
+    /**
+     * @brief a least-recently-used cache of decrypted image data, held in
+     * pages of one block size and keyed by the page's index in the image.
+     * For containers with a block metadata table (version 23 onwards) data
+     * pages line up exactly with volume blocks. Reads of cached pages
+     * don't touch the image or the cipher at all.
+     *
+     * By default the cache is write-through: every write made through a
+     * ContainerImageStream is applied to the image and to any cached page
+     * it overlaps, so that cached pages never go stale. When CoreIO's
+     * writeBackBytes is set the cache is write-back instead: writes are
+     * absorbed in to cached pages which are only written to the image,
+     * with neighbouring pages merged in to single writes, by flush or
+     * once more than writeBackBytes of pages are dirty. Dirty pages are
+     * never evicted. As with the volume bitmap, all CoreIO objects
+     * referring to the same image share the one cache.
+     */
+    class DecryptedBlockCache
+    {
+      public:
+
+        /// reads the given number of bytes at the given image offset in to
+        /// the buffer, decrypting them; returns false if they couldn't be read
+        using PageLoader = std::function<bool(uint64_t const, char * const, uint64_t const)>;
+
+        DecryptedBlockCache() = delete;
+
+        /**
+         * @brief creates an empty cache for the image referred to by io
+         * @param io the core knoxcrypt io (path, block size, cache budget)
+         */
+        explicit DecryptedBlockCache(SharedCoreIO const &io);
+
+        /// writes back any dirty pages
+        ~DecryptedBlockCache();
+
+        /**
+         * @brief  retrieves the cache associated with io, creating it if it
+         *         hasn't yet been created
+         * @param  io the core knoxcrypt io
+         * @return the cache, or null if caching is disabled
+         */
+        static SharedDecryptedBlockCache get(SharedCoreIO const &io);
+
+        /**
+         * @brief forgets any cache of the image referred to by io; to be
+         * used when an image has been (re)built from scratch
+         * @param io the core knoxcrypt io
+         */
+        static void invalidate(SharedCoreIO const &io);
+
+        /**
+         * @brief  reads bytes from the cache, loading any missing pages
+         * @param  offset the image offset to read from
+         * @param  buf the buffer to read in to
+         * @param  n the number of bytes to read
+         * @param  load for loading pages not in the cache
+         * @return false if the read extends beyond the end of the image or a
+         *         page couldn't be loaded, in which case the image must be
+         *         read directly
+         */
+        bool read(uint64_t const offset, char * const buf, uint64_t const n,
+                  PageLoader const &load);
+
+        /**
+         * @brief  takes bytes to be written to the image in to the cache,
+         *         loading any missing pages; they reach the image once flushed
+         * @param  offset the image offset to write to
+         * @param  buf the bytes to write
+         * @param  n the number of bytes to write
+         * @param  load for loading pages not in the cache
+         * @return false if the cache isn't write-back or if the bytes extend
+         *         beyond the end of the image, in which case nothing is
+         *         taken and the bytes must be written to the image directly
+         */
+        bool absorb(uint64_t const offset, char const * const buf, uint64_t const n,
+                    PageLoader const &load);
+
+        /**
+         * @brief writes every dirty page back to the image
+         */
+        void flush();
+
+        /// true if there are pages yet to be written back to the image
+        bool hasDirtyPages() const;
+
+        /**
+         * @brief applies bytes that have been written to the image to any
+         * cached pages that they overlap
+         * @param offset the image offset written to
+         * @param buf the bytes written
+         * @param n the number of bytes written
+         */
+        void write(uint64_t const offset, char const * const buf, uint64_t const n);
+
+        /**
+         * @brief records that the image extends at least as far as size
+         * @param size the size of the image
+         */
+        void grow(uint64_t const size);
+
+        /// drops every cached page
+        void clear();
+
+        /// the number of page lookups served from memory
+        uint64_t hits() const;
+
+        /// the number of page lookups that had to read the image
+        uint64_t misses() const;
+
+        /// the number of bytes of decrypted data currently held
+        uint64_t bytes() const;
+
+        /// the number of bytes held in dirty pages
+        uint64_t dirtyBytes() const;
+
+      private:
+
+        /// a cached page of decrypted data
+        struct Page
+        {
+            uint64_t index;
+            AlignedBufferPool::Buffer data;
+
+            // the range of data yet to be written back; empty if clean
+            uint64_t dirtyBegin;
+            uint64_t dirtyEnd;
+        };
+        using PageList = std::list<Page>;
+
+        /// the image the cache belongs to
+        std::string m_path;
+
+        /// the size of each page
+        uint64_t m_pageSize;
+
+        /// where page buffers come from and go back to on eviction
+        SharedAlignedBufferPool m_pool;
+
+        /// the most bytes of decrypted data held at any one time
+        uint64_t m_budget;
+
+        /// the most bytes of dirty pages held before they're written back;
+        /// zero if the cache is write-through
+        uint64_t m_dirtyLimit;
+
+        /// the known size of the image; pages past the end aren't cached
+        uint64_t m_imageSize;
+
+        /// cached pages, most recently used first
+        PageList m_pages;
+
+        /// cached pages by page index
+        std::unordered_map<uint64_t, PageList::iterator> m_lookup;
+
+        uint64_t m_hits;
+        uint64_t m_misses;
+
+        /// set once the image has been rebuilt; the cache then holds nothing
+        bool m_detached;
+
+        /// the number of dirty pages
+        uint64_t m_dirtyPages;
+
+        /// for writing dirty pages back; m_io is a copy of the image's
+        /// CoreIO with caching disabled so that the stream bypasses the cache
+        SharedCoreIO m_io;
+        std::shared_ptr<ContainerImageStream> m_stream;
+
+        /// for merging neighbouring dirty pages in to a single write
+        std::vector<char> m_flushBuffer;
+
+        /// streams of different files may share the one cache
+        mutable std::mutex m_mutex;
+
+        /// brings the page in to the cache if it isn't there already
+        /// and makes it the most recently used; null if it can't be loaded
+        Page *fetchPage(uint64_t const index, PageLoader const &load);
+
+        /// evicts the least recently used clean pages while over budget
+        void evict();
+
+        /// writes dirty pages back; to be called with m_mutex held
+        void doFlush();
+    };
+
+}
@@ -44,7 +44,8 @@ namespace knoxcrypt
                   EntryType const &entryType,
                   bool const writable,
                   uint64_t const firstFileBlock,
-                  uint64_t const folderIndex);
+                  uint64_t const folderIndex,
+                  uint64_t const blockCount);
 
         /**
          * @brief  access the name of the entry
@@ -65,6 +66,19 @@ namespace knoxcrypt
          */
         void updateSize(uint64_t newSize);
 
+        /**
+         * @brief  access the number of blocks making up a file entry; zero
+         *         for a folder entry
+         * @return the block count of the entry
+         */
+        uint64_t blockCount() const;
+
+        /**
+         * @brief updates block count
+         * @param newBlockCount
+         */
+        void updateBlockCount(uint64_t newBlockCount);
+
         /**
          * @brief  accesses the type of the entry (file or folder)
          * @return EntryType::File if file, EntryType::Folder if folder
@@ -106,6 +120,7 @@ namespace knoxcrypt
         bool m_writable;
         uint64_t m_firstFileBlock;
         uint64_t m_folderIndex;
+        uint64_t m_blockCount;
         bool m_hasBucketIndex;
         uint64_t m_bucketIndex;
     };
@@ -28,8 +28,10 @@
 
 #pragma once
 
+#include "knoxcrypt/BlockIOEngine.hpp"
 #include "knoxcrypt/CoreIO.hpp"
 #include "knoxcrypt/FileBlock.hpp"
+#include "knoxcrypt/FileBlockBuilder.hpp"
 #include "knoxcrypt/OpenDisposition.hpp"
 #include "knoxcrypt/ContainerImageStream.hpp"
 
@@ -51,7 +53,7 @@ namespace knoxcrypt
     class File
     {
 
-        using SetEntryInfoSizeCallback = std::function<void(uint64_t)>;
+        using SetEntryInfoSizeCallback = std::function<void(uint64_t, uint64_t)>;
         using OptionalSizeCallback = boost::optional<SetEntryInfoSizeCallback>;
         using SharedFileBlock = std::shared_ptr<FileBlock>;
 
@@ -92,6 +94,12 @@ namespace knoxcrypt
          */
         uint64_t fileSize() const;
 
+        /**
+         * @brief  accesses the number of blocks making up the file's data
+         * @return the block count
+         */
+        uint64_t blockCount() const;
+
         /**
          * @brief  retrieves the first file block making up this knoxcrypt file
          * @return the start block index of this file
@@ -149,8 +157,9 @@ namespace knoxcrypt
 
         /**
          * @brief sets the callback that will be used to updated the reported
-         * file size as stored in the entry info metadata of the parent
-         * @param callback the setSize function (probably) of EntryInfo
+         * file size as stored in the entry info metadata of the parent; it is
+         * passed the file's size and block count on flush and truncate
+         * @param callback updates the parent's entry info and metadata
          */
         void setOptionalSizeUpdateCallback(SetEntryInfoSizeCallback callback);
 
@@ -182,9 +191,6 @@ namespace knoxcrypt
         // the current block being read from / written to
         mutable SharedFileBlock m_workingBlock;
 
-        // a buffer used for storing chunks of data
-        std::vector<uint8_t> m_buffer;
-
         // the start file block index
         mutable uint64_t m_startVolumeBlock;
 
@@ -202,6 +208,10 @@ namespace knoxcrypt
         // how many blocks make up the file?
         mutable uint64_t m_blockCount;
 
+        // the volume block of each block making up the file, in file order,
+        // so that a block can be found without walking the block chain
+        mutable std::vector<uint64_t> m_volumeBlocks;
+
         // an optional size update callback to be used in setting the reported
         // size in the entry info held in the parent folder entry info cache
         OptionalSizeCallback m_optionalSizeCallback;
@@ -210,6 +220,49 @@ namespace knoxcrypt
         // instantiating a new FileBlock
         mutable SharedImageStream m_stream;
 
+        // free blocks set aside for the write in progress so that the file
+        // grows contiguously; only valid for the duration of a single write
+        mutable ExtentDeque m_reservedBlocks;
+
+        // the extents as last written to the extent map (version 22 onwards)
+        mutable BlockExtents m_extents;
+
+        // scratch space reused by writeExtentMap so growing a file one block
+        // at a time doesn't allocate for every block
+        mutable BlockExtents m_pendingExtents;
+        mutable std::vector<uint8_t> m_extentBytes;
+
+        // the blocks holding the extent map; empty when the file is made up
+        // of a single block, in which case no map is needed
+        mutable std::vector<uint64_t> m_mapBlocks;
+
+        /// a run of blocks fetched through the I/O engine ahead of the reader
+        struct Readahead
+        {
+            Readahead() = default;
+            Readahead(Readahead const &) = delete;
+            Readahead &operator=(Readahead const &) = delete;
+
+            /// waits for the fetch to finish so the buffer outlives it
+            ~Readahead();
+
+            uint64_t firstBlock;
+            uint64_t blocks;
+            std::vector<char> data;
+            SharedBlockIOEngine engine;
+            BlockIOEngine::Ticket ticket;
+        };
+        using SharedReadahead = std::shared_ptr<Readahead>;
+
+        // where the last read finished; a read starting here is sequential
+        std::streamoff m_readEnd;
+
+        // how many blocks each readahead fetches; 0 when not reading sequentially
+        uint64_t m_readaheadBlocks;
+
+        // the runs fetched, or still being fetched, ahead of the reader
+        std::deque<SharedReadahead> m_readahead;
+
         /**
          * @brief  for keeping track of what the current file block as indicated
          *         by the current working file block
@@ -222,32 +275,120 @@ namespace knoxcrypt
          */
         void newWritableFileBlock() const;
 
+        /**
+         * @brief makes block the working block, reusing the existing allocation
+         * @param block the block to work with
+         */
+        void setWorkingBlock(FileBlock block) const;
+
+        /**
+         * @brief reserves a run of free blocks for a write that will need
+         * more than one new file block
+         * @param n the number of bytes about to be written
+         */
+        void reserveBlocksForWrite(std::streamsize const n);
+
         /**
          * @brief counts the number of blocks and sets file size
          */
         void enumerateBlockStats();
 
         /**
-         * @brief  buffers as many bytes as permitted by the working block
-         * @param  s the data to buffer
-         * @param  n the number of bytes to try and buffer
-         * @param  offset where abouts in 's' we are
-         * @return the actual number of bytes buffered
+         * @brief  whether the container lays files out with extent maps
+         *         rather than by chaining file blocks together
+         * @return true if the file has an extent map
+         */
+        bool hasExtentMap() const;
+
+        /**
+         * @brief reads the extent map referenced by the first file block
+         * in to the volume block table and sets the file size
+         */
+        void readExtentMap();
+
+        /**
+         * @brief brings the on-disk extent map in line with the volume block
+         * table, rewriting only the extents that changed
          */
-        uint32_t bufferBytesForWorkingBlock(const char* s, std::streamsize n, uint32_t offset);
+        void writeExtentMap() const;
 
         /**
-         * @brief writes data to working block
+         * @brief  allocates a block to hold part of the extent map
+         * @return the index of the new map block
+         */
+        uint64_t newExtentMapBlock() const;
+
+        /**
+         * @brief marks the given volume blocks as no longer in use
+         * @param blocks the volume blocks to release
+         */
+        void releaseBlocks(std::vector<uint64_t> const &blocks) const;
+
+        /**
+         * @brief  works out how many bytes the working block can take
+         * @param  n the number of bytes still to write
+         * @return n, or the space left in the working block if less
+         */
+        uint32_t bytesForWorkingBlock(std::streamsize const n);
+
+        /**
+         * @brief writes data straight from the caller's buffer to the
+         * working block
+         * @param s the data to write
          * @param bytes the number of bytes to write
          */
-        void writeBufferedDataToWorkingBlock(uint32_t const bytes);
+        void writeToWorkingBlock(char const * const s, uint32_t const bytes);
 
         /**
-         * @brief  reads bytes from the working block in to buffer
+         * @brief  reads bytes from the working block straight in to the
+         *         caller's buffer
+         * @param  s buffer to store the read bytes
+         * @param  bytes the most bytes to read
          * @return the number of bytes read
          */
-        std::streamsize readWorkingBlockBytes(uint32_t const bytes);
+        std::streamsize readWorkingBlockBytes(char * const s, uint32_t const bytes);
+
+        /**
+         * @brief  reads the full blocks that follow the working block, when
+         *         positioned at its start, as a batch through the I/O engine,
+         *         or one read per run of neighbouring blocks without one,
+         *         and moves the working block past them
+         * @param  s buffer to store the read bytes
+         * @param  n the number of bytes still to read
+         * @return the number of bytes read; 0 if nothing was batched
+         */
+        std::streamsize readWholeBlocks(char * const s, std::streamsize const n);
 
+        /**
+         * @brief  copies bytes from the readahead run holding the working
+         *         block and moves the working block past them
+         * @param  s buffer to store the read bytes
+         * @param  n the number of bytes still to read
+         * @return the number of bytes read; 0 if the working block wasn't read ahead
+         */
+        std::streamsize readAheadBytes(char * const s, std::streamsize const n);
+
+        /**
+         * @brief starts fetching the blocks after the reader so that one run
+         * is being read from while the next is on its way
+         */
+        void startReadahead();
+
+        /**
+         * @brief forgets anything read ahead, e.g. because the file changed
+         * or the reader jumped elsewhere
+         */
+        void dropReadahead();
+
+        /**
+         * @brief  appends full blocks after a full working block, allocating
+         *         them here and writing their data as a batch through the
+         *         I/O engine, leaving the last of them as the working block
+         * @param  s the data to write
+         * @param  n the number of bytes still to write
+         * @return the number of bytes written; 0 if nothing was batched
+         */
+        std::streamsize writeWholeBlocks(const char * const s, std::streamsize const n);
 
         /**
          * @brief will build a new file block for writing to if there are
@@ -68,13 +68,17 @@ namespace knoxcrypt
          * @param index the index of the file block
          * @param openDisposition open mode
          * @param stream the image stream that holds the TS data
+         * @param wholeBlock when true, a read-only block whose header lies
+         * just in front of its data is read whole with a single read and
+         * later reads are served from memory
          * @note  other params like size and next will be initialized when
          * the block is actually read
          */
         FileBlock(SharedCoreIO const &io,
                   uint64_t const index,
                   OpenDisposition const &openDisposition,
-                  SharedImageStream const &stream = SharedImageStream());
+                  SharedImageStream const &stream = SharedImageStream(),
+                  bool const wholeBlock = false);
 
         /**
          * @brief  reads from the current file block
@@ -196,6 +200,7 @@ namespace knoxcrypt
         mutable uint32_t m_initialBytesWritten;
         mutable uint64_t m_next;
         mutable uint64_t m_offset;
+        uint64_t m_dataOffset;
         mutable boost::iostreams::stream_offset m_seekPos;
         mutable boost::iostreams::stream_offset m_positionBeforeWrite;
         OpenDisposition m_openDisposition;
@@ -203,6 +208,9 @@ namespace knoxcrypt
         // used for writing to the underlying image stream
         mutable SharedImageStream m_stream;
 
+        // the header and data of the block when read whole up front
+        std::shared_ptr<AlignedBufferPool::Buffer> m_contents;
+
     };
 
 }
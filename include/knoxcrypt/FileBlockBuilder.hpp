@@ -31,6 +31,9 @@
 #include "knoxcrypt/CoreIO.hpp"
 #include "knoxcrypt/FileBlock.hpp"
 #include "knoxcrypt/OpenDisposition.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
+
+#include <boost/optional.hpp>
 
 #include <memory>
 
@@ -41,7 +44,7 @@ namespace knoxcrypt
 
     class FileBlockBuilder;
     using SharedBlockBuilder = std::shared_ptr<FileBlockBuilder>;
-    using BlockDeque = std::deque<uint64_t>;
+    using ExtentDeque = std::deque<BlockExtent>;
 
     class FileBlockBuilder
     {
@@ -54,6 +57,35 @@ namespace knoxcrypt
                                          SharedImageStream &stream,
                                          bool const enforceRootBlock = false);
 
+        /**
+         * @brief  builds a new writable file block at a block index that was
+         *         previously obtained through reserveBlocks
+         * @param  io the core knoxcrypt io
+         * @param  id the index of the reserved block
+         * @param  openDisposition the open disposition of the new block
+         * @param  stream the image stream
+         * @return the new file block
+         */
+        FileBlock buildWritableFileBlockWithIndex(SharedCoreIO const &io,
+                                                  uint64_t const id,
+                                                  OpenDisposition const &openDisposition,
+                                                  SharedImageStream &stream);
+
+        /**
+         * @brief  finds free blocks for a write that spans several blocks so
+         *         that they can be laid out contiguously in the image. The
+         *         blocks are not marked in use; each must be built with
+         *         buildWritableFileBlockWithIndex and registered before any
+         *         other allocation takes place
+         * @param  io the core knoxcrypt io
+         * @param  blocksRequired the number of blocks required
+         * @param  near the block the run should preferably start from
+         * @return the runs of free blocks found
+         */
+        BlockExtents reserveBlocks(SharedCoreIO const &io,
+                                   uint64_t const blocksRequired,
+                                   uint64_t const near);
+
         FileBlock buildFileBlock(SharedCoreIO const &io,
                                  uint64_t const index,
                                  OpenDisposition const &openDisposition,
@@ -61,7 +93,27 @@ namespace knoxcrypt
 
       private:
 
-        BlockDeque m_blockDeque;
+        /**
+         * @brief  takes the next free block from the cache of free extents,
+         *         refilling the cache from the volume bitmap when it runs dry
+         * @param  io the core knoxcrypt io
+         * @return the free block if there is one
+         */
+        boost::optional<uint64_t> takeCachedBlock(SharedCoreIO const &io);
+
+        /**
+         * @brief refills the cache with the next batch of free extents,
+         * carrying on from where the previous scan stopped
+         * @param io the core knoxcrypt io
+         */
+        void refillExtentCache(SharedCoreIO const &io);
+
+        /// cache of free blocks stored as runs so that memory use is bound
+        /// by fragmentation rather than by the size of the container
+        ExtentDeque m_freeExtents;
+
+        /// the block from which the next refill of m_freeExtents will scan
+        uint64_t m_scanCursor;
 
         /// store how many blocks have actually been written
         /// when we get a block to use if it is greater than the number
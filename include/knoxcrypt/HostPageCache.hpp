@@ -0,0 +1,119 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/CoreIO.hpp"
+
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+
+namespace knoxcrypt
+{
+
+    /**
+     * @brief keeps image data from building up in the host's page cache
+     * when CoreIO's dropHostCache is set. This only hints to the host, with
+     * posix_fadvise and sync_file_range; it is not direct I/O. The image is
+     * not opened with O_DIRECT, so every read and write still passes
+     * through the page cache and is dropped from it afterwards. Ranges that
+     * are read are dropped from the page cache straight away. Dirty pages can't be dropped until they have
+     * been written out, which blocks, so ranges that are written are only
+     * noted. They are written out and dropped together on writeBack, which
+     * is called at sync points and once WRITEBACK_BYTES of writes have
+     * built up. All streams made with the same CoreIO share the one object.
+     */
+    class HostPageCache
+    {
+      public:
+
+        /// the bytes of writes noted before they are written back anyway
+        static uint64_t const WRITEBACK_BYTES = 8 * 1024 * 1024;
+
+        HostPageCache() = delete;
+
+        /**
+         * @brief takes ownership of a read-only descriptor of the image
+         * @param fd the descriptor
+         */
+        explicit HostPageCache(int const fd);
+
+        /// writes back anything still noted and closes the descriptor
+        ~HostPageCache();
+
+        /**
+         * @brief  retrieves the object associated with io, creating it if it
+         *         hasn't yet been created
+         * @param  io the core knoxcrypt io
+         * @return the object, or null if dropHostCache isn't set or the
+         *         image can't be opened
+         */
+        static SharedHostPageCache get(SharedCoreIO const &io);
+
+        /**
+         * @brief drops a range that has been read from the host's page cache
+         * @param offset the image offset of the range
+         * @param n the length of the range
+         */
+        void dropRead(uint64_t const offset, uint64_t const n);
+
+        /**
+         * @brief  notes a range that has been written
+         * @param  offset the image offset of the range
+         * @param  n the length of the range
+         * @return true once WRITEBACK_BYTES have been noted, in which case
+         *         the caller should flush its stream and call writeBack
+         */
+        bool noteWritten(uint64_t const offset, uint64_t const n);
+
+        /**
+         * @brief writes out every range noted since the last write back and
+         * drops them from the host's page cache
+         */
+        void writeBack();
+
+        /// the bytes written since the last write back
+        uint64_t pendingBytes() const;
+
+      private:
+
+        // the image, opened read-only for managing its page cache residency
+        int m_fd;
+
+        // the span of the ranges noted since the last write back
+        uint64_t m_begin;
+        uint64_t m_end;
+
+        // the number of bytes noted since the last write back
+        uint64_t m_pending;
+
+        mutable std::mutex m_mutex;
+    };
+
+}
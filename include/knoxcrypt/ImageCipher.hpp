@@ -0,0 +1,85 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/CoreIO.hpp"
+
+#include <memory>
+#include <stdint.h>
+
+namespace knoxcrypt
+{
+
+    class ImageCipher;
+    using SharedImageCipher = std::shared_ptr<ImageCipher>;
+
+    /**
+     * @brief the image's cipher as a counter mode keystream that can be
+     * applied at any image offset. Bytes are transformed straight between
+     * the image (a read buffer or a mapping) and caller buffers, with no
+     * stream position, no copy through a stream buffer and no lock, so
+     * several threads may read and write through the one object.
+     *
+     * Each supported algorithm has its own Crypto++ CTR_Mode
+     * instantiation; which one an image uses is decided once, when the
+     * image is first opened; see get. The key and IV are those that
+     * cryptostreampp derived for the image. What the cipher makes of the
+     * image is checked against what CryptoStreamPP reads back before it is
+     * used, and an image for which the two disagree goes on being read and
+     * written through CryptoStreamPP.
+     */
+    class ImageCipher
+    {
+      public:
+        virtual ~ImageCipher();
+
+        /**
+         * @brief encrypts or decrypts bytes that lie at the given image
+         * offset; in counter mode the two are the same operation
+         * @param offset the image offset of the first byte
+         * @param in the bytes to transform
+         * @param out receives the transformed bytes; may be the same as in
+         * @param n the number of bytes
+         */
+        virtual void transform(uint64_t const offset, char const * const in,
+                               char * const out, uint64_t const n) const = 0;
+
+        /**
+         * @brief  retrieves the cipher associated with io, setting it up
+         *         the first time
+         * @param  io the core knoxcrypt io
+         * @return the cipher, or null if the image's cipher is NONE,
+         *         CoreIO's cipherPipeline isn't set, the image doesn't yet
+         *         exist or its bytes don't match those read through
+         *         CryptoStreamPP (in which case cipherPipeline is cleared)
+         */
+        static SharedImageCipher get(SharedCoreIO const &io);
+    };
+
+}
@@ -0,0 +1,162 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/ImageCipher.hpp"
+
+#include <memory>
+#include <shared_mutex>
+#include <stdint.h>
+#include <string>
+
+namespace knoxcrypt
+{
+
+    class MappedImage;
+    using SharedMappedImage = std::shared_ptr<MappedImage>;
+
+    /**
+     * @brief the image file mapped in to memory so that image reads and
+     * writes go straight between the mapping and caller buffers, with no
+     * stream buffering and no system call per access. Changes reach the
+     * file when the kernel writes the pages back or, at the latest, on
+     * sync.
+     *
+     * The bytes of an encrypted image are passed through its positional
+     * ImageCipher on the way in and out, so the mapping only ever holds
+     * ciphertext; an image whose cipher can't be transformed that way
+     * isn't mapped; see get. As with the volume bitmap, all CoreIO
+     * objects referring to the same image share the one mapping.
+     */
+    class MappedImage
+    {
+      public:
+        MappedImage() = delete;
+
+        /**
+         * @brief maps the image at the given path; throws if the image
+         * can't be opened or mapped
+         * @param path the path of the image
+         * @param cipher transforms bytes between the mapping and caller
+         * buffers; null for an image that isn't encrypted
+         */
+        MappedImage(std::string const &path,
+                    SharedImageCipher const &cipher = SharedImageCipher());
+
+        /// writes back and unmaps
+        ~MappedImage();
+
+        /**
+         * @brief  retrieves the mapping associated with io, mapping the
+         *         image if it hasn't yet been mapped
+         * @param  io the core knoxcrypt io
+         * @return the mapping, or null if mapping wasn't requested or the
+         *         image is encrypted and has no ImageCipher
+         */
+        static SharedMappedImage get(SharedCoreIO const &io);
+
+        /**
+         * @brief unmaps any mapping of the image referred to by io; to be
+         * used when an image is about to be (re)built from scratch
+         * @param io the core knoxcrypt io
+         */
+        static void invalidate(SharedCoreIO const &io);
+
+        /**
+         * @brief  copies bytes out of the mapping, decrypting them
+         * @param  offset the image offset to read from
+         * @param  buf the buffer to read in to
+         * @param  n the number of bytes to read
+         * @return the number of bytes read; fewer than n if the read runs
+         *         past the end of the image
+         */
+        uint64_t read(uint64_t const offset, char * const buf, uint64_t const n);
+
+        /**
+         * @brief  copies bytes in to the mapping, encrypting them and
+         *         extending the image (and
+         *         the mapping) first if they run past its end
+         * @param  offset the image offset to write to
+         * @param  buf the bytes to write
+         * @param  n the number of bytes to write
+         * @return the number of bytes written
+         */
+        uint64_t write(uint64_t const offset, char const * const buf, uint64_t const n);
+
+        /**
+         * @brief writes every modified page of the mapping back to the image
+         */
+        void sync();
+
+        /// the current size of the image in bytes
+        uint64_t size() const;
+
+      private:
+
+        // the path of the mapped image
+        std::string m_path;
+
+        // the image's cipher; null when the image isn't encrypted
+        SharedImageCipher m_cipher;
+
+        // the open image file
+        int m_fd;
+
+        // the start of the mapping; null while the image is empty
+        char *m_data;
+
+        // the number of bytes mapped, equal to the size of the image
+        uint64_t m_size;
+
+        // set once the image has been rebuilt; nothing is read or
+        // written from then on
+        bool m_detached;
+
+        // shared by copies in and out; exclusive while the image is
+        // extended and remapped or unmapped
+        mutable std::shared_timed_mutex m_mutex;
+
+        /**
+         * @brief maps the whole of the image, replacing any previous mapping
+         * @param size the size of the image
+         */
+        void map(uint64_t const size);
+
+        /// releases the current mapping
+        void unmap();
+
+        /// copies n bytes at offset out of the mapping in to buf
+        void copyOut(uint64_t const offset, char * const buf, uint64_t const n) const;
+
+        /// copies n bytes from buf in to the mapping at offset
+        void copyIn(uint64_t const offset, char const * const buf, uint64_t const n);
+    };
+
+}
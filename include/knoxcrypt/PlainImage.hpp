@@ -0,0 +1,122 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/ImageCipher.hpp"
+
+#include <fstream>
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+namespace knoxcrypt
+{
+
+    class PlainImage;
+    using SharedPlainImage = std::shared_ptr<PlainImage>;
+
+    /**
+     * @brief an image read and written with positional system calls
+     * straight between the image file and caller buffers. When the image's
+     * cipher is NONE nothing is transformed, copied or buffered on the
+     * way, so such an image runs at the speed of the host file system.
+     * Otherwise bytes are decrypted in place once read, and encrypted a
+     * piece at a time on their way out, by the image's ImageCipher. Since
+     * there is no stream position several threads may read and write
+     * through the one object.
+     *
+     * Each ContainerImageStream of such an image opens its own; see get.
+     */
+    class PlainImage
+    {
+      public:
+        PlainImage() = delete;
+
+        /**
+         * @brief opens the image as a file stream opened with the given
+         * mode would, creating or truncating it as the mode says; whether
+         * that succeeded is given by isOpen
+         * @param path the path of the image
+         * @param mode the stream open mode
+         * @param cipher the image's cipher; null if the cipher is NONE
+         */
+        PlainImage(std::string const &path, std::ios::openmode const mode,
+                   SharedImageCipher const &cipher = SharedImageCipher());
+
+        ~PlainImage();
+
+        PlainImage(PlainImage const &) = delete;
+        PlainImage &operator=(PlainImage const &) = delete;
+
+        /**
+         * @brief  opens the image referred to by io for plain access
+         * @param  io the core knoxcrypt io
+         * @param  mode the stream open mode
+         * @return the opened image, or null if the image is encrypted and
+         *         either has a decrypted block cache to go through or
+         *         can't be transformed by an ImageCipher
+         */
+        static SharedPlainImage get(SharedCoreIO const &io, std::ios::openmode const mode);
+
+        /// whether the image was successfully opened
+        bool isOpen() const;
+
+        /**
+         * @brief  reads bytes from the image
+         * @param  offset the image offset to read from
+         * @param  buf the buffer to read in to
+         * @param  n the number of bytes to read
+         * @return the number of bytes read; fewer than n if the read runs
+         *         past the end of the image or fails
+         */
+        uint64_t read(uint64_t const offset, char * const buf, uint64_t const n);
+
+        /**
+         * @brief  writes bytes to the image, extending it if they run past
+         *         its end
+         * @param  offset the image offset to write to
+         * @param  buf the bytes to write
+         * @param  n the number of bytes to write
+         * @return the number of bytes written; fewer than n on failure
+         */
+        uint64_t write(uint64_t const offset, char const * const buf, uint64_t const n);
+
+        /// the current size of the image in bytes
+        uint64_t size() const;
+
+      private:
+
+        // the open image file; -1 if it couldn't be opened
+        int m_fd;
+
+        // the image's cipher; null if its cipher is NONE
+        SharedImageCipher m_cipher;
+    };
+}
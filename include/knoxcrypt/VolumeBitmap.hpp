@@ -0,0 +1,224 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/CoreIO.hpp"
+
+#include <boost/optional.hpp>
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace knoxcrypt
+{
+
+    class ContainerImageStream;
+    using SharedImageStream = std::shared_ptr<ContainerImageStream>;
+
+    /// a run of contiguous blocks
+    struct BlockExtent
+    {
+        uint64_t start;
+        uint64_t length;
+    };
+    using BlockExtents = std::vector<BlockExtent>;
+
+    /**
+     * @brief an in-memory copy of the volume bitmap. The bitmap is read in
+     * once when first required; allocations and deallocations then only
+     * mutate memory, with modified pages written back on sync. All CoreIO
+     * objects that refer to the same image share the one bitmap so that
+     * their views of which blocks are in use never diverge.
+     *
+     * For containers with an allocation superblock (version 21 onwards),
+     * the number of free blocks in each page of the bitmap is tracked and
+     * persisted. When the container was cleanly unmounted, pages are only
+     * read in once they are needed and pages without free blocks never
+     * need reading at all; otherwise the whole bitmap is read and the
+     * summary rebuilt.
+     */
+    class VolumeBitmap
+    {
+      public:
+        VolumeBitmap() = delete;
+
+        /**
+         * @brief loads the volume bitmap of the image referred to by io
+         * @param io the core knoxcrypt io (path, blocks, password)
+         */
+        explicit VolumeBitmap(SharedCoreIO const &io);
+
+        /// writes back any remaining dirty pages and marks the
+        /// container as cleanly unmounted
+        ~VolumeBitmap();
+
+        /**
+         * @brief  retrieves the bitmap associated with io, loading it if
+         *         it hasn't yet been loaded
+         * @param  io the core knoxcrypt io
+         * @return the volume bitmap
+         */
+        static SharedVolumeBitmap get(SharedCoreIO const &io);
+
+        /**
+         * @brief forgets any bitmap loaded for the image referred to by io;
+         * to be used when an image has been (re)built from scratch
+         * @param io the core knoxcrypt io
+         */
+        static void invalidate(SharedCoreIO const &io);
+
+        /**
+         * @brief  determines whether a file block is in use
+         * @param  block the block to query
+         * @return true if allocated, false otherwise
+         */
+        bool isBlockInUse(uint64_t const block) const;
+
+        /**
+         * @brief sets a block to in use or not in use
+         * @param block the block to update
+         * @param set true to allocate, false to deallocate
+         */
+        void setBlockInUse(uint64_t const block, bool const set = true);
+
+        /**
+         * @brief  gets the number of blocks currently allocated
+         * @return the number of allocated blocks
+         */
+        uint64_t getNumberOfAllocatedBlocks() const;
+
+        /**
+         * @brief  gets the next available block
+         * @return the next available block if there is one
+         */
+        boost::optional<uint64_t> getNextAvailableBlock() const;
+
+        /**
+         * @brief  gets up to n available blocks
+         * @param  blocksRequired the number of blocks required
+         * @return the available block indices
+         */
+        std::vector<uint64_t> getNAvailableBlocks(uint64_t const blocksRequired) const;
+
+        /**
+         * @brief  collects runs of free blocks
+         * @param  from the block to start scanning from
+         * @param  maxExtents the maximum number of runs to collect
+         * @param  extents the collection to append the runs to
+         * @return the block at which the scan stopped; the total number of
+         *         blocks if the end of the bitmap was reached
+         */
+        uint64_t getFreeExtents(uint64_t const from,
+                                std::size_t const maxExtents,
+                                BlockExtents &extents) const;
+
+        /**
+         * @brief  finds free blocks for an allocation spanning several blocks,
+         *         preferably as one contiguous run at or after near
+         * @param  near the block the allocation should preferably start from
+         * @param  blocksRequired the number of blocks required
+         * @return the runs of free blocks found; these are not marked in use
+         */
+        BlockExtents getFreeBlocksNear(uint64_t const near,
+                                       uint64_t const blocksRequired) const;
+
+        /**
+         * @brief writes all dirty pages back to the image
+         */
+        void sync();
+
+      private:
+        uint64_t m_blocks;
+
+        // the container format version
+        unsigned int m_version;
+
+        // the raw bitmap bytes, one bit per block; pages not yet
+        // loaded are kept fully set so that scans pass over them
+        mutable std::vector<uint8_t> m_bytes;
+
+        // one flag per page of m_bytes indicating that it has been read in
+        mutable std::vector<bool> m_loadedPages;
+
+        // one flag per page of m_bytes indicating that it needs writing back
+        std::vector<bool> m_dirtyPages;
+        bool m_hasDirtyPages;
+
+        // true once the superblock has been marked as not cleanly unmounted
+        bool m_markedUnclean;
+
+        // the number of free blocks in each page and in total
+        std::vector<uint32_t> m_regionFree;
+        uint64_t m_freeBlocks;
+
+        // one bit per page that is set when the page has a free block, and
+        // above that one bit per 64 pages, so that the next page with a
+        // free block can be found without walking every page
+        std::vector<uint64_t> m_pagesWithFree;
+        std::vector<uint64_t> m_pageGroupsWithFree;
+
+        // the stream used for loading and writing back the bitmap
+        mutable SharedImageStream m_stream;
+
+        /**
+         * @brief  reads in the allocation superblock if the container
+         *         was cleanly unmounted
+         * @return true if the free block summary could be restored
+         */
+        bool readSuperblock();
+
+        /// writes the fixed part of the superblock
+        void writeSuperblockHeader(bool const clean);
+
+        /// marks the superblock as not cleanly unmounted, ahead of the
+        /// first change to the bitmap
+        void markUnclean();
+
+        /// reads in the whole bitmap and rebuilds the free block summary
+        void loadAllAndCount();
+
+        /// rebuilds the index of pages with free blocks from m_regionFree
+        void rebuildPageIndex();
+
+        /**
+         * @brief  finds the next page that has a free block
+         * @param  from the page to start from
+         * @return the page or the number of pages if there isn't one
+         */
+        uint64_t findNextPageWithFree(uint64_t const from) const;
+
+        /// makes sure that the given page of the bitmap has been read in
+        void loadPage(uint64_t const page) const;
+
+        /// stops the bitmap from ever touching the image again
+        void detach();
+    };
+
+}
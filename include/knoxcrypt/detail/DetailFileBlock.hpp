@@ -28,10 +28,12 @@
 
 #pragma once
 
+#include "knoxcrypt/AlignedBufferPool.hpp"
 #include "knoxcrypt/CoreIO.hpp"
 #include "knoxcrypt/ContainerImageStream.hpp"
 #include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
 
+#include <cstring>
 #include <iostream>
 #include <stdint.h>
 #include <vector>
@@ -40,35 +42,130 @@ namespace knoxcrypt { namespace detail
 {
 
     /**
-     * @brief gets the offset of a given file block
-     * @param block the file block that we want to get the offset of
-     * @return the offset of the file block
+     * @brief  whether block metadata is held in a table of its own rather
+     *         than at the start of each block (version 23 onwards)
+     * @param  io the core io (format version)
+     * @return true if the container has a block metadata table
+     */
+    inline bool hasBlockMetaTable(SharedCoreIO const &io)
+    {
+        return io->version >= VERSION_META_TABLE;
+    }
+
+    /**
+     * @brief  gets the offset at which the file blocks, or for version 23
+     *         onwards, the block metadata table, begin
+     * @param  io the core io (block count and format version)
+     * @return the offset
      */
-    inline uint64_t getOffsetOfFileBlock(long const blockSize,
-                                         uint64_t const block,
-                                         uint64_t const totalBlocks)
+    inline uint64_t getOffsetOfFileBlocksArea(SharedCoreIO const &io)
     {
-        uint64_t const volumeBitMapBytes = totalBlocks / uint64_t(8);
+        uint64_t const volumeBitMapBytes = io->blocks / uint64_t(8);
         return beginning()                 // where main start after IV
             + 8                            // number of fs blocks
             + volumeBitMapBytes            // volume bit map
             + 8                            // total number of files
-            + (blockSize * block);   // file block
+            + superblockBytes(io->version, io->blocks); // allocation summary
+    }
+
+    /**
+     * @brief  gets the offset of the first block's data when block metadata
+     *         is held in a table. Block data is aligned to the block size so
+     *         that it lines up with pages of the image file
+     * @param  io the core io (block size, block count and format version)
+     * @return the offset of the data of block 0
+     */
+    inline uint64_t getOffsetOfBlockDataArea(SharedCoreIO const &io)
+    {
+        uint64_t const tableEnd = getOffsetOfFileBlocksArea(io) + (FILE_BLOCK_META * io->blocks);
+        uint64_t const blockSize = io->blockSize;
+        return ((tableEnd + blockSize - 1) / blockSize) * blockSize;
+    }
+
+    /**
+     * @brief gets the offset of a given file block's metadata, its
+     * number of bytes written followed by its next index
+     * @param io the core io (block size, block count and format version)
+     * @param block the file block that we want to get the offset of
+     * @return the offset of the file block metadata
+     */
+    inline uint64_t getOffsetOfFileBlock(SharedCoreIO const &io,
+                                         uint64_t const block)
+    {
+        if (hasBlockMetaTable(io)) {
+            return getOffsetOfFileBlocksArea(io) + (FILE_BLOCK_META * block);
+        }
+        return getOffsetOfFileBlocksArea(io) + (io->blockSize * block);
+    }
+
+    /**
+     * @brief gets the offset of the data held by a given file block
+     * @param io the core io (block size, block count and format version)
+     * @param block the file block that we want to get the data offset of
+     * @return the offset of the file block data
+     */
+    inline uint64_t getOffsetOfFileBlockData(SharedCoreIO const &io,
+                                             uint64_t const block)
+    {
+        if (hasBlockMetaTable(io)) {
+            return getOffsetOfBlockDataArea(io) + (io->blockSize * block);
+        }
+        return getOffsetOfFileBlock(io, block) + FILE_BLOCK_META;
+    }
+
+    /**
+     * @brief  gets the number of data bytes that a file block can hold
+     * @param  io the core io (block size and format version)
+     * @return the capacity of a file block
+     */
+    inline uint32_t blockWriteSpace(SharedCoreIO const &io)
+    {
+        if (hasBlockMetaTable(io)) {
+            return io->blockSize;
+        }
+        return io->blockSize - FILE_BLOCK_META;
+    }
+
+    /**
+     * @brief reads the data of a run of file blocks lying next to each other
+     * in the image with a single read, leaving out any block headers stored
+     * in between
+     * @param io the core io (block size and format version)
+     * @param in the knoxcrypt image stream
+     * @param first the first file block of the run
+     * @param count the number of file blocks in the run
+     * @param buf receives count full blocks of data
+     */
+    inline void readFileBlockRun(SharedCoreIO const &io,
+                                 ContainerImageStream &in,
+                                 uint64_t const first,
+                                 uint64_t const count,
+                                 char * const buf)
+    {
+        if (hasBlockMetaTable(io)) {
+            (void)in.readAt(getOffsetOfFileBlockData(io, first), buf, count * io->blockSize);
+            return;
+        }
+        std::vector<char> blocks(count * io->blockSize);
+        (void)in.readAt(getOffsetOfFileBlock(io, first), &blocks.front(), blocks.size());
+        uint64_t const space = blockWriteSpace(io);
+        for (uint64_t b = 0; b < count; ++b) {
+            std::memcpy(buf + b * space, &blocks[b * io->blockSize + FILE_BLOCK_META], space);
+        }
     }
 
     /**
      * @brief gets the next file block index from the given file block
      * @param in the knoxcrypt image stream
+     * @param io the core io
      * @param n the file block to get the next index from
-     * @param totalBlocks the total number of blocks in the knoxcrypt
      * @return the next file block index
      */
     inline uint64_t getIndexOfNextFileBlockFromFileBlockN(knoxcrypt::ContainerImageStream &in,
-                                                          long const blockSize,
-                                                          uint64_t const n,
-                                                          uint64_t const totalBlocks)
+                                                          SharedCoreIO const &io,
+                                                          uint64_t const n)
     {
-        auto offset = getOffsetOfFileBlock(blockSize, n, totalBlocks) + 4;
+        auto offset = getOffsetOfFileBlock(io, n) + 4;
         (void)in.seekg(offset);
         uint8_t dat[8];
         (void)in.read((char*)dat, 8);
@@ -78,16 +175,15 @@ namespace knoxcrypt { namespace detail
     /**
      * @brief gets the next file block index from the given file block
      * @param in the knoxcrypt image stream
+     * @param io the core io
      * @param n the file block to get the next index from
-     * @param totalBlocks the total number of blocks in the knoxcrypt
      * @return the next file block index
      */
     inline uint32_t getNumberOfDataBytesWrittenToFileBlockN(knoxcrypt::ContainerImageStream &in,
-                                                            long const blockSize,
-                                                            uint64_t const n,
-                                                            uint64_t const totalBlocks)
+                                                            SharedCoreIO const &io,
+                                                            uint64_t const n)
     {
-        uint64_t offset = getOffsetOfFileBlock(blockSize, n, totalBlocks);
+        uint64_t offset = getOffsetOfFileBlock(io, n);
         (void)in.seekg(offset);
         uint8_t dat[4];
         (void)in.read((char*)dat, 4);
@@ -95,20 +191,12 @@ namespace knoxcrypt { namespace detail
     }
 
     /**
-     * @brief write a given file block to disk
-     * @param io the core io data structure
+     * @brief writes the metadata of a block that holds no data
      * @param out the image stream to write to
-     * @param block the block to write out
+     * @param block the block the metadata is for
      */
-    inline void writeBlock(SharedCoreIO const &io, ContainerImageStream &out, uint64_t const block)
+    inline void writeEmptyBlockMeta(ContainerImageStream &out, uint64_t const block)
     {
-        std::vector<uint8_t> ints;
-        ints.assign(io->blockSize - FILE_BLOCK_META, 0);
-
-        // write out block metadata
-        uint64_t offset = getOffsetOfFileBlock(io->blockSize, block, io->blocks);
-        (void)out.seekp(offset);
-
         // write m_bytesWritten; 0 to begin with
         uint8_t sizeDat[4];
         uint32_t size = 0;
@@ -119,12 +207,97 @@ namespace knoxcrypt { namespace detail
         uint8_t nextDat[8];
         convertUInt64ToInt8Array(block, nextDat);
         (void)out.write((char*)nextDat, 8);
+    }
+
+    /**
+     * @brief write a given file block to disk
+     * @param io the core io data structure
+     * @param out the image stream to write to
+     * @param block the block to write out
+     */
+    inline void writeBlock(SharedCoreIO const &io, ContainerImageStream &out, uint64_t const block)
+    {
+        // an aligned block-sized buffer so that the data goes out as a
+        // single aligned request
+        uint32_t const space = blockWriteSpace(io);
+        auto zeros(AlignedBufferPool::get(space)->acquire());
+        std::memset(zeros.get(), 0, space);
+
+        // write out block metadata
+        (void)out.seekp(getOffsetOfFileBlock(io, block));
+        writeEmptyBlockMeta(out, block);
 
         // write data bytes
-        (void)out.write((char*)&ints.front(), io->blockSize - FILE_BLOCK_META);
+        (void)out.seekp(getOffsetOfFileBlockData(io, block));
+        (void)out.write(zeros.get(), space);
 
         assert(!out.bad());
     }
+
+    /// the number of bytes used to store one extent in an extent map block
+    uint64_t const EXTENT_BYTES = 16;
+
+    /**
+     * @brief  computes how many extents fit in to a single extent map block
+     * @param  io the core io (block size and format version)
+     * @return the number of extents per map block
+     */
+    inline uint64_t extentsPerMapBlock(SharedCoreIO const &io)
+    {
+        return blockWriteSpace(io) / EXTENT_BYTES;
+    }
+
+    /**
+     * @brief  compresses the volume blocks making up a file in to runs of
+     *         consecutive blocks, reusing the storage of extents
+     * @param  blocks the volume block of each file block, in file order
+     * @param  extents replaced with the extents describing the blocks
+     */
+    inline void buildExtentsFromBlocks(std::vector<uint64_t> const &blocks, BlockExtents &extents)
+    {
+        extents.clear();
+        for (auto const block : blocks) {
+            if (!extents.empty() && extents.back().start + extents.back().length == block) {
+                ++extents.back().length;
+            } else {
+                extents.push_back(BlockExtent{block, 1});
+            }
+        }
+    }
+
+    /**
+     * @brief  compresses the volume blocks making up a file in to runs of
+     *         consecutive blocks
+     * @param  blocks the volume block of each file block, in file order
+     * @return the extents describing the blocks
+     */
+    inline BlockExtents buildExtentsFromBlocks(std::vector<uint64_t> const &blocks)
+    {
+        BlockExtents extents;
+        buildExtentsFromBlocks(blocks, extents);
+        return extents;
+    }
+
+    /**
+     * @brief serializes an extent as stored in an extent map block
+     * @param extent the extent to serialize
+     * @param array the bytes to write the extent to
+     */
+    inline void convertExtentToInt16Array(BlockExtent const &extent, uint8_t array[16])
+    {
+        convertUInt64ToInt8Array(extent.start, array);
+        convertUInt64ToInt8Array(extent.length, array + 8);
+    }
+
+    /**
+     * @brief  deserializes an extent as stored in an extent map block
+     * @param  array the bytes holding the extent
+     * @return the extent
+     */
+    inline BlockExtent convertInt16ArrayToExtent(uint8_t array[16])
+    {
+        return BlockExtent{convertInt8ArrayToInt64(array), convertInt8ArrayToInt64(array + 8)};
+    }
 }
 }
 
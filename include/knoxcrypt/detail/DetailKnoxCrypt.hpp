@@ -29,14 +29,22 @@
 #pragma once
 
 #include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
+#include "knoxcrypt/detail/DetailVersion.hpp"
 
 #include <boost/optional.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <stdint.h>
 #include <vector>
 #include <strings.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 namespace knoxcrypt { namespace detail
 {
 
@@ -46,8 +54,11 @@ namespace knoxcrypt { namespace detail
     uint64_t const FILE_BLOCK_META = 12;
     uint64_t const IV_BYTES = 8;
     uint64_t const HEADER_BYTES = 8;
-    long     const CIPHER_BUFFER_SIZE = 270000000;
     uint64_t const PASS_HASH_BYTES = 32;
+    uint64_t const BITMAP_PAGE_BYTES = 4096;
+    uint64_t const BITMAP_PAGE_BLOCKS = BITMAP_PAGE_BYTES * 8;
+    uint64_t const SUPERBLOCK_HEADER_BYTES = 17;
+    uint64_t const ENTRY_STATS_BYTES = 16;
 
     inline void convertUInt64ToInt8Array(uint64_t const bigNum, uint8_t array[8])
     {
@@ -93,6 +104,100 @@ namespace knoxcrypt { namespace detail
         return (IV_BYTES * 4) + HEADER_BYTES + PASS_HASH_BYTES;
     }
 
+    /**
+     * @brief gets the number of pages that make up the volume bitmap;
+     * each page is summarized by a single region in the superblock
+     * @param blocks the total number of blocks
+     * @return the number of bitmap pages
+     */
+    inline uint64_t bitmapPageCount(uint64_t const blocks)
+    {
+        uint64_t const bytes = blocks / uint64_t(8);
+        return (bytes + BITMAP_PAGE_BYTES - 1) / BITMAP_PAGE_BYTES;
+    }
+
+    /**
+     * @brief gets where the allocation superblock starts, i.e. after the
+     * block count, volume bitmap and file count
+     * @param blocks the total number of blocks
+     * @return the offset of the superblock
+     */
+    inline uint64_t superblockOffset(uint64_t const blocks)
+    {
+        return beginning() + 8 + (blocks / uint64_t(8)) + 8;
+    }
+
+    /**
+     * @brief gets the size of the allocation superblock. The superblock
+     * stores a clean-unmount flag (1 byte), the free block count (8 bytes),
+     * the region count (8 bytes) and then the free block count of each
+     * region (4 bytes each), where a region is one page of the bitmap.
+     * Containers prior to version 21 do not have a superblock
+     * @param version the container format version
+     * @param blocks the total number of blocks
+     * @return the superblock size in bytes
+     */
+    inline uint64_t superblockBytes(unsigned int const version, uint64_t const blocks)
+    {
+        if (version < VERSION_SUPERBLOCK) {
+            return 0;
+        }
+        return SUPERBLOCK_HEADER_BYTES + 4 * bitmapPageCount(blocks);
+    }
+
+    /**
+     * @brief gets the size of a folder entry's metadata. This is the in-use
+     * and type byte (1 byte), the name (MAX_FILENAME_LENGTH bytes) and the
+     * first block index (8 bytes). From version 24 onwards a file entry
+     * also records the file's size and block count (8 bytes each) so that
+     * the file doesn't have to be opened to be listed
+     * @param version the container format version
+     * @return the entry metadata size in bytes
+     */
+    inline uint64_t folderEntryBytes(unsigned int const version)
+    {
+        uint64_t const bytes = 1 + MAX_FILENAME_LENGTH + 8;
+        return version < VERSION_ENTRY_STATS ? bytes : bytes + ENTRY_STATS_BYTES;
+    }
+
+    /**
+     * @brief serializes the fixed part of the allocation superblock
+     * @param blocks the total number of blocks
+     * @param clean whether the container was cleanly unmounted
+     * @param freeBlocks the number of free blocks
+     * @param header the buffer to serialize to
+     */
+    inline void buildSuperblockHeader(uint64_t const blocks,
+                                      bool const clean,
+                                      uint64_t const freeBlocks,
+                                      uint8_t header[SUPERBLOCK_HEADER_BYTES])
+    {
+        header[0] = clean ? 1 : 0;
+        convertUInt64ToInt8Array(freeBlocks, header + 1);
+        convertUInt64ToInt8Array(bitmapPageCount(blocks), header + 9);
+    }
+
+    /**
+     * @brief serializes a complete allocation superblock
+     * @param blocks the total number of blocks
+     * @param clean whether the container was cleanly unmounted
+     * @param regionFree the number of free blocks in each bitmap page
+     * @return the superblock bytes
+     */
+    inline std::vector<uint8_t> buildSuperblock(uint64_t const blocks,
+                                                bool const clean,
+                                                std::vector<uint32_t> const &regionFree)
+    {
+        std::vector<uint8_t> superblock(superblockBytes(VERSION_SUPERBLOCK, blocks));
+        uint64_t freeBlocks(0);
+        for (uint64_t region = 0; region < regionFree.size(); ++region) {
+            convertInt32ToInt4Array(regionFree[region], &superblock[SUPERBLOCK_HEADER_BYTES + 4 * region]);
+            freeBlocks += regionFree[region];
+        }
+        buildSuperblockHeader(blocks, clean, freeBlocks, &superblock.front());
+        return superblock;
+    }
+
     /**
      * @brief gets the size of the knoxcrypt image
      * @param in the image stream
@@ -259,6 +364,390 @@ namespace knoxcrypt { namespace detail
         }
     }
 
+    /**
+     * @brief loads eight bitmap bytes as a single word such that bit n of
+     * the word corresponds to bit (n % 8) of byte (n / 8)
+     * @param bytes the bitmap bytes to load
+     * @return the bitmap word
+     */
+    inline uint64_t loadBitmapWord(uint8_t const * const bytes)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes, 8);
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        word = __builtin_bswap64(word);
+#endif
+        return word;
+    }
+
+    /**
+     * @brief counts the set bits in a word
+     * @param word the word to count the bits of
+     * @return the number of set bits
+     */
+    inline int popCount64(uint64_t word)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcountll(word);
+#else
+        word = word - ((word >> 1) & 0x5555555555555555ULL);
+        word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+        word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        return static_cast<int>((word * 0x0101010101010101ULL) >> 56);
+#endif
+    }
+
+    /**
+     * @brief counts the trailing zero bits of a word
+     * @param word the word to count the trailing zeros of; must be non-zero
+     * @return the index of the lowest set bit
+     */
+    inline int countTrailingZeros64(uint64_t const word)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(word);
+#else
+        int count = 0;
+        uint64_t w = word;
+        while ((w & 1) == 0) {
+            w >>= 1;
+            ++count;
+        }
+        return count;
+#endif
+    }
+
+    /**
+     * @brief skips over bitmap bytes in which every block is allocated,
+     * 128 and then 32 bytes at a time
+     * @param bitmap the volume bitmap bytes
+     * @param byte the byte to start from
+     * @param bytes the number of bitmap bytes
+     * @return the start of the first 32 byte run that has an unset bit or
+     * the start of the remaining tail that is too short to be skipped
+     */
+    inline uint64_t skipFullBitmapBytes(uint8_t const * const bitmap,
+                                        uint64_t byte,
+                                        uint64_t const bytes)
+    {
+#if defined(__AVX2__)
+        __m256i const allSet = _mm256_set1_epi8(char(0xFF));
+
+        // four lanes are and-ed together so that only one test is needed
+        // per 128 bytes; the 32 byte loop then finds the lane that failed
+        for (; byte + 128 <= bytes; byte += 128) {
+            __m256i const first = _mm256_and_si256(_mm256_loadu_si256((__m256i const *)(bitmap + byte)),
+                                                   _mm256_loadu_si256((__m256i const *)(bitmap + byte + 32)));
+            __m256i const second = _mm256_and_si256(_mm256_loadu_si256((__m256i const *)(bitmap + byte + 64)),
+                                                    _mm256_loadu_si256((__m256i const *)(bitmap + byte + 96)));
+            if (!_mm256_testc_si256(_mm256_and_si256(first, second), allSet)) {
+                break;
+            }
+        }
+        for (; byte + 32 <= bytes; byte += 32) {
+            __m256i const lanes = _mm256_loadu_si256((__m256i const *)(bitmap + byte));
+            if (!_mm256_testc_si256(lanes, allSet)) {
+                break;
+            }
+        }
+#else
+        for (; byte + 32 <= bytes; byte += 32) {
+            uint64_t const word = loadBitmapWord(bitmap + byte)
+                                & loadBitmapWord(bitmap + byte + 8)
+                                & loadBitmapWord(bitmap + byte + 16)
+                                & loadBitmapWord(bitmap + byte + 24);
+            if (~word) {
+                break;
+            }
+        }
+#endif
+        return byte;
+    }
+
+    /**
+     * @brief counts the allocated blocks recorded in a buffer of bitmap bytes
+     * @param bitmap the volume bitmap bytes
+     * @param bytes the number of bitmap bytes
+     * @return the number of allocated blocks
+     */
+    inline uint64_t countAllocatedBlocksInBitmap(uint8_t const * const bitmap,
+                                                 uint64_t const bytes)
+    {
+        // process a word at a time; any remaining bytes are handled singly
+        uint64_t allocatedBlocks(0);
+        uint64_t byte(0);
+        for (; byte + 8 <= bytes; byte += 8) {
+            allocatedBlocks += popCount64(loadBitmapWord(bitmap + byte));
+        }
+        for (; byte < bytes; ++byte) {
+            allocatedBlocks += popCount64(bitmap[byte]);
+        }
+        return allocatedBlocks;
+    }
+
+    using OptionalBlock = boost::optional<uint64_t>;
+
+    /**
+     * @brief finds the first available block in a buffer of bitmap bytes
+     * @param bitmap the volume bitmap bytes
+     * @param bytes the number of bitmap bytes
+     * @param blocks the total number of blocks
+     * @return the next available block
+     */
+    inline OptionalBlock findNextAvailableBlockInBitmap(uint8_t const * const bitmap,
+                                                        uint64_t const bytes,
+                                                        uint64_t const blocks)
+    {
+        // a word with any bit unset has a free block; the
+        // lowest set bit of its inverse is the first of them
+        uint64_t byte = skipFullBitmapBytes(bitmap, 0, bytes);
+        for (; byte + 8 <= bytes; byte += 8) {
+            uint64_t const freeBits = ~loadBitmapWord(bitmap + byte);
+            if (freeBits) {
+                uint64_t const block = (byte * 8) + countTrailingZeros64(freeBits);
+                return block < blocks ? OptionalBlock(block) : OptionalBlock();
+            }
+        }
+        for (; byte < bytes; ++byte) {
+            uint64_t const freeBits = uint8_t(~bitmap[byte]);
+            if (freeBits) {
+                uint64_t const block = (byte * 8) + countTrailingZeros64(freeBits);
+                return block < blocks ? OptionalBlock(block) : OptionalBlock();
+            }
+        }
+
+        // no available blocks found
+        return OptionalBlock();
+    }
+
+    /**
+     * @brief finds up to N available blocks in a buffer of bitmap bytes,
+     * writing them to a buffer supplied by the caller
+     * @param bitmap the volume bitmap bytes
+     * @param bytes the number of bitmap bytes
+     * @param blocksRequired the number of file blocks required
+     * @param out where to write the available file block indices; must
+     * have room for blocksRequired of them
+     * @return the number of blocks found. Note this might be less than
+     * blocksRequired if there are not enough blocks available
+     */
+    inline uint64_t findNAvailableBlocksInBitmap(uint8_t const * const bitmap,
+                                                 uint64_t const bytes,
+                                                 uint64_t const blocksRequired,
+                                                 uint64_t * const out)
+    {
+        // written through a local pointer rather than by index so that the
+        // count doesn't have to be reloaded after every store
+        uint64_t * const last = out + blocksRequired;
+        uint64_t * next = out;
+        if (next == last) {
+            return 0;
+        }
+
+        uint64_t byte(0);
+        for (; byte + 8 <= bytes; byte += 8) {
+            uint64_t freeBits = ~loadBitmapWord(bitmap + byte);
+
+            // a fully allocated word costs one compare; any run of them
+            // that follows is skipped in bulk
+            if (!freeBits) {
+                byte = skipFullBitmapBytes(bitmap, byte + 8, bytes) - 8;
+                continue;
+            }
+
+            // peel the free blocks off of the inverted word
+            uint64_t const firstBlock = byte * 8;
+            do {
+                *next = firstBlock + countTrailingZeros64(freeBits);
+                if (++next == last) {
+                    return blocksRequired;
+                }
+                freeBits &= freeBits - 1;
+            } while (freeBits);
+        }
+        for (; byte < bytes; ++byte) {
+            uint64_t freeBits = uint8_t(~bitmap[byte]);
+            while (freeBits) {
+                *next = (byte * 8) + countTrailingZeros64(freeBits);
+                if (++next == last) {
+                    return blocksRequired;
+                }
+                freeBits &= freeBits - 1;
+            }
+        }
+        return uint64_t(next - out);
+    }
+
+    /**
+     * @brief finds up to N available blocks in a buffer of bitmap bytes
+     * @param bitmap the volume bitmap bytes
+     * @param bytes the number of bitmap bytes
+     * @param blocksRequired the number of file blocks required
+     * @return a vector of available file block indices. Note this might
+     * be less that blocksRequired if there are not enough blocks available
+     */
+    inline std::vector<uint64_t> findNAvailableBlocksInBitmap(uint8_t const * const bitmap,
+                                                              uint64_t const bytes,
+                                                              uint64_t const blocksRequired)
+    {
+        std::vector<uint64_t> bitBuffer(blocksRequired);
+        if (blocksRequired > 0) {
+            bitBuffer.resize(findNAvailableBlocksInBitmap(bitmap, bytes, blocksRequired, &bitBuffer.front()));
+        }
+        return bitBuffer; // return all blocks that could be found
+    }
+
+    /**
+     * @brief sets or clears a bit of a two-level summary, in which each
+     * bit of the upper level records whether any bit of the corresponding
+     * lower level word is set
+     * @param lower the lower level words
+     * @param upper the upper level words
+     * @param bit the lower level bit to update
+     * @param set whether the bit should be set
+     */
+    inline void updateSummaryBit(std::vector<uint64_t> &lower,
+                                 std::vector<uint64_t> &upper,
+                                 uint64_t const bit,
+                                 bool const set)
+    {
+        uint64_t const word = bit / 64;
+        if (set) {
+            lower[word] |= uint64_t(1) << (bit % 64);
+            upper[word / 64] |= uint64_t(1) << (word % 64);
+        } else {
+            lower[word] &= ~(uint64_t(1) << (bit % 64));
+            if (lower[word] == 0) {
+                upper[word / 64] &= ~(uint64_t(1) << (word % 64));
+            }
+        }
+    }
+
+    /**
+     * @brief finds the first set bit at or after a given bit of a two-level
+     * summary (see updateSummaryBit). Only the upper level words and a
+     * couple of lower level words need to be looked at
+     * @param lower the lower level words
+     * @param upper the upper level words
+     * @param from the lower level bit to start from
+     * @param bits the number of lower level bits
+     * @return the first set bit or bits if there isn't one
+     */
+    inline uint64_t findNextSetBitInSummary(std::vector<uint64_t> const &lower,
+                                            std::vector<uint64_t> const &upper,
+                                            uint64_t const from,
+                                            uint64_t const bits)
+    {
+        if (from >= bits) {
+            return bits;
+        }
+        uint64_t word = from / 64;
+        uint64_t const here = lower[word] & (~uint64_t(0) << (from % 64));
+        if (here) {
+            return std::min(word * 64 + countTrailingZeros64(here), bits);
+        }
+
+        // find the next non-empty lower level word using the upper level
+        ++word;
+        uint64_t group = word / 64;
+        if (group >= upper.size()) {
+            return bits;
+        }
+        uint64_t groupBits = upper[group] & (~uint64_t(0) << (word % 64));
+        while (!groupBits) {
+            if (++group == upper.size()) {
+                return bits;
+            }
+            groupBits = upper[group];
+        }
+        word = group * 64 + countTrailingZeros64(groupBits);
+        return std::min(word * 64 + countTrailingZeros64(lower[word]), bits);
+    }
+
+    /**
+     * @brief loads the nth word of a bitmap, zero-padding a partial last word
+     * @param bitmap the volume bitmap bytes
+     * @param bytes the number of bitmap bytes
+     * @param word the index of the word to load
+     * @return the bitmap word
+     */
+    inline uint64_t loadBitmapWordAt(uint8_t const * const bitmap,
+                                     uint64_t const bytes,
+                                     uint64_t const word)
+    {
+        uint64_t const byte = word * 8;
+        if (byte + 8 <= bytes) {
+            return loadBitmapWord(bitmap + byte);
+        }
+        uint64_t tail(0);
+        for (uint64_t b = byte; b < bytes; ++b) {
+            tail |= uint64_t(bitmap[b]) << ((b - byte) * 8);
+        }
+        return tail;
+    }
+
+    /**
+     * @brief finds the first block at or after a given block whose
+     * allocation state matches the state being searched for
+     * @param bitmap the volume bitmap bytes
+     * @param bytes the number of bitmap bytes
+     * @param blocks the total number of blocks
+     * @param from the block to start searching from
+     * @param inUse true to search for an allocated block, false for a free one
+     * @return the matching block or blocks if there isn't one
+     */
+    inline uint64_t findNextBlockInBitmap(uint8_t const * const bitmap,
+                                          uint64_t const bytes,
+                                          uint64_t const blocks,
+                                          uint64_t const from,
+                                          bool const inUse)
+    {
+        uint64_t const words = (bytes + 7) / 8;
+        uint64_t word = from / 64;
+        if (from >= blocks || word >= words) {
+            return blocks;
+        }
+        uint64_t const flip = inUse ? 0 : ~uint64_t(0);
+        uint64_t bits = (loadBitmapWordAt(bitmap, bytes, word) ^ flip) & (~uint64_t(0) << (from % 64));
+        while (!bits) {
+            if (++word == words) {
+                return blocks;
+            }
+            bits = loadBitmapWordAt(bitmap, bytes, word) ^ flip;
+        }
+        return std::min(word * 64 + countTrailingZeros64(bits), blocks);
+    }
+
+    /**
+     * @brief collects runs of free blocks starting from a given block
+     * @param bitmap the volume bitmap bytes
+     * @param bytes the number of bitmap bytes
+     * @param blocks the total number of blocks
+     * @param from the block to start scanning from
+     * @param maxExtents the maximum number of runs to collect
+     * @param extents the collection to append the runs to
+     * @return the block at which the scan stopped, from which a later scan
+     * can carry on; blocks if the end of the bitmap was reached
+     */
+    inline uint64_t findFreeExtentsInBitmap(uint8_t const * const bitmap,
+                                            uint64_t const bytes,
+                                            uint64_t const blocks,
+                                            uint64_t const from,
+                                            std::size_t const maxExtents,
+                                            BlockExtents &extents)
+    {
+        uint64_t cursor = from;
+        for (std::size_t found = 0; found < maxExtents && cursor < blocks; ++found) {
+            uint64_t const start = findNextBlockInBitmap(bitmap, bytes, blocks, cursor, false);
+            if (start == blocks) {
+                return blocks;
+            }
+            cursor = findNextBlockInBitmap(bitmap, bytes, blocks, start, true);
+            extents.push_back(BlockExtent{start, cursor - start});
+        }
+        return cursor;
+    }
+
     /**
      * @brief gets the number of blocks currently allocated
      * @param in the knoxcrypt image stream
@@ -279,21 +768,7 @@ namespace knoxcrypt { namespace detail
         (void)in.read((char*)&buf.front(), bytes);
 
         // note this is quicker than calling isBlockInUse repeatedly
-        uint64_t allocatedBlocks(0);
-        for (uint64_t byte = 0; byte < bytes; ++byte) {
-            uint8_t dat = buf[byte];
-            if(dat == 0xFF) {
-                allocatedBlocks += 8;
-                continue;
-            } 
-            for(int i = 0; i < 8; ++i) {
-                if(isBitSetInByte(dat, i)) {
-                    ++allocatedBlocks;
-                }
-            }
-        }
-
-        return allocatedBlocks;
+        return countAllocatedBlocksInBitmap(&buf.front(), bytes);
     }
 
     /**
@@ -301,7 +776,6 @@ namespace knoxcrypt { namespace detail
      * @param in the image stream
      * @return the next available block
      */
-    using OptionalBlock = boost::optional<uint64_t>;
     inline OptionalBlock getNextAvailableBlock(knoxcrypt::ContainerImageStream &in, uint64_t const blocks_ = 0)
     {
         // get number of blocks that make up fs
@@ -319,31 +793,7 @@ namespace knoxcrypt { namespace detail
         std::vector<uint8_t> buf(bytes);
         (void)in.read((char*)&buf.front(), bytes);
 
-        // find out the next available bit
-        uint64_t bitCounter(0);
-
-        for (uint64_t i = 0; i < bytes; ++i) {
-            int availableBit = getNextAvailableBitInAByte(buf[i]);
-            if(availableBit > -1) {
-                bitCounter += availableBit;
-                break;
-            }
-            bitCounter += 8;
-        }
-
-        // no available blocks found
-        if (bitCounter == blocks) {
-            return OptionalBlock();
-        }
-
-        // next available block == bitCounter
-        // derive offset from bit counter. Note blocks
-        // to be stored starting at 0 index.
-        // Metadata starts at 8 (block count) + 8 (file count)
-        // + bytes (volume bit map size) + meta data size
-        //uint64_t const offset = 8 + 8 + bytes + getMetaDataSize(blocks) + (FILE_BLOCK_SIZE * bitCounter);
-
-        return OptionalBlock(bitCounter);
+        return findNextAvailableBlockInBitmap(&buf.front(), bytes, blocks);
     }
 
 
@@ -367,57 +817,33 @@ namespace knoxcrypt { namespace detail
         (void)in.seekg(beginning() + 8);
         (void)in.read((char*)&buf.front(), bytes);
 
-
-        // find n available blocks
-        uint64_t eightCounter(0);
-        std::vector<uint64_t> bitBuffer(blocksRequired);
-        uint64_t filled(0);
-        for (uint64_t i = 0; i < bytes; ++i) {
-            // only continue if at least one bit available
-            if(buf[i] != 0xFF) {
-                for (int b = 0; b < 8; ++b) {
-                    if(!isBitSetInByte(buf[i], b)) {
-                        bitBuffer[filled] = b + eightCounter;
-                        ++filled;
-                        if (filled == blocksRequired) {
-                            return bitBuffer;
-                        }
-                    }
-                }
-            } 
-            
-            eightCounter += 8;
-        }
-        return bitBuffer; // return all blocks that could be found
+        return findNAvailableBlocksInBitmap(&buf.front(), bytes, blocksRequired);
     }
 
     /**
      * @brief updates the volume bit map with newly allocated file blocks
-     * @param in the knoxcrypt image stream
+     * @param bitmap the in-memory volume bitmap
      * @param blocksUsed a vector of newly allocated file block indices
-     * @param totalBlocks total number of fs blocks
      */
-    inline void updateVolumeBitmap(ContainerImageStream &in,
-                                   std::vector<uint64_t> const &blocksUsed,
-                                   uint64_t const totalBlocks)
+    inline void updateVolumeBitmap(VolumeBitmap &bitmap,
+                                   std::vector<uint64_t> const &blocksUsed)
     {
         for (auto const & it : blocksUsed) {
-            setBlockToInUse(it, totalBlocks, in);
+            bitmap.setBlockInUse(it);
         }
     }
 
     /**
-     * @brief updates the volume bit map with newly allocated file blocks
-     * @param in the knoxcrypt image stream
+     * @brief updates the volume bit map with a newly (de)allocated file block
+     * @param bitmap the in-memory volume bitmap
      * @param blockUsed the used block
-     * @param totalBlocks total number of fs blocks
+     * @param set true if allocated, false if deallocated
      */
-    inline void updateVolumeBitmapWithOne(ContainerImageStream &in,
+    inline void updateVolumeBitmapWithOne(VolumeBitmap &bitmap,
                                           uint64_t const &blockUsed,
-                                          uint64_t const totalBlocks,
                                           bool const set = true)
     {
-        setBlockToInUse(blockUsed, totalBlocks, in, set);
+        bitmap.setBlockInUse(blockUsed, set);
     }
 
     /**
@@ -528,11 +954,20 @@ namespace knoxcrypt { namespace detail
         // store the filesystem's block-size which should be read
         // in when reading the filesystem. Prior to this, the block
         // size is always 4096.
+        //
+        // Version 21 further adds a superblock after the file count that
+        // summarizes block allocation; see superblockBytes. Version 22
+        // replaces the chaining of file blocks with per-file extent maps,
+        // version 23 moves block metadata in to a table of its own and
+        // version 24 records file sizes in folder entries.
         char v;
         (void)in.read((char*)&v, 1);
-        int version = (int)v;
-        if(version == 20) {
+        unsigned int version = (unsigned int)v;
+        if(version >= VERSION_BLOCK_SIZE && version <= LATEST_VERSION) {
             io->blockSize = detail::convertInt4ArrayToInt32(blockSizeArray);
+            io->version = version;
+        } else {
+            io->version = 0;
         }
         in.close();
         io->encProps.iv = knoxcrypt::detail::convertInt8ArrayToInt64(&ivBuffer.front());
@@ -0,0 +1,85 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/AlignedBufferPool.hpp"
+#include "test/SimpleTest.hpp"
+
+#include <stdint.h>
+
+using namespace simpletest;
+
+class AlignedBufferPoolTest
+{
+  public:
+    AlignedBufferPoolTest()
+    {
+        buffersAreAligned();
+        releasedBuffersAreReused();
+        idleBuffersAreBounded();
+    }
+
+  private:
+    void buffersAreAligned()
+    {
+        auto pool(std::make_shared<knoxcrypt::AlignedBufferPool>(1000, 4));
+        auto a(pool->acquire());
+        auto b(pool->acquire());
+        ASSERT_EQUAL(uintptr_t(0), uintptr_t(a.get()) % 4096, "AlignedBufferPoolTest::buffersAreAligned A");
+        ASSERT_EQUAL(uintptr_t(0), uintptr_t(b.get()) % 4096, "AlignedBufferPoolTest::buffersAreAligned B");
+        ASSERT_EQUAL(std::size_t(1000), pool->bufferSize(), "AlignedBufferPoolTest::buffersAreAligned size");
+    }
+
+    void releasedBuffersAreReused()
+    {
+        auto pool(std::make_shared<knoxcrypt::AlignedBufferPool>(4096, 4));
+        char *first;
+        {
+            auto buffer(pool->acquire());
+            first = buffer.get();
+        }
+        ASSERT_EQUAL(std::size_t(1), pool->idle(), "AlignedBufferPoolTest::releasedBuffersAreReused idle");
+        auto again(pool->acquire());
+        ASSERT_EQUAL(first, again.get(), "AlignedBufferPoolTest::releasedBuffersAreReused same buffer");
+        ASSERT_EQUAL(std::size_t(0), pool->idle(), "AlignedBufferPoolTest::releasedBuffersAreReused taken");
+        ASSERT_EQUAL(knoxcrypt::AlignedBufferPool::get(4096), knoxcrypt::AlignedBufferPool::get(4096),
+                     "AlignedBufferPoolTest::releasedBuffersAreReused shared pool");
+    }
+
+    void idleBuffersAreBounded()
+    {
+        auto pool(std::make_shared<knoxcrypt::AlignedBufferPool>(512, 2));
+        {
+            auto a(pool->acquire());
+            auto b(pool->acquire());
+            auto c(pool->acquire());
+        }
+        ASSERT_EQUAL(std::size_t(2), pool->idle(), "AlignedBufferPoolTest::idleBuffersAreBounded");
+    }
+};
@@ -0,0 +1,311 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/BlockIOEngine.hpp"
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/File.hpp"
+#include "knoxcrypt/OpenDisposition.hpp"
+#include "knoxcrypt/detail/DetailFileBlock.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace simpletest;
+
+class BlockIOEngineTest
+{
+  public:
+    BlockIOEngineTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        engineDisabledByDefault();
+        batchedReadsMatchImage();
+        batchedWritesReachImage();
+        queuedWriteBatchesReachImage();
+        failedRequestsReported();
+        fileReadsThroughEngine(0);
+        fileReadsThroughEngine(1024 * 1024);
+        sequentialReadsAhead();
+        fileWritesThroughEngine(knoxcrypt::detail::VERSION_EXTENT_MAP);
+        fileWritesThroughEngine(knoxcrypt::detail::LATEST_VERSION);
+    }
+
+    ~BlockIOEngineTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    /// the byte expected at position i of data written by this test
+    static char expected(uint64_t const i)
+    {
+        return char('A' + (i * 11 + i / 4096) % 53);
+    }
+
+    std::string pattern(uint64_t const bytes)
+    {
+        std::string data(bytes, 0);
+        for (uint64_t i = 0; i < bytes; ++i) {
+            data[i] = expected(i);
+        }
+        return data;
+    }
+
+    void engineDisabledByDefault()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        ASSERT_EQUAL(true, !knoxcrypt::BlockIOEngine::get(io), "BlockIOEngineTest::engineDisabledByDefault");
+    }
+
+    void batchedReadsMatchImage()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->ioQueueDepth = 4;
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(io);
+        uint64_t const bytes = 600 * 1024;
+        std::string const data(pattern(bytes));
+        {
+            knoxcrypt::ContainerImageStream out(io, std::ios::in | std::ios::out | std::ios::binary);
+            (void)out.writeAt(dataStart, data.c_str(), bytes);
+        }
+
+        // one large request, split across the workers, and a few small ones
+        std::vector<char> large(bytes);
+        std::vector<char> small(3 * 100);
+        knoxcrypt::BlockIOEngine::Batch batch;
+        batch.push_back(knoxcrypt::BlockIOEngine::Request{false, dataStart, &large.front(), bytes});
+        for (uint64_t i = 0; i < 3; ++i) {
+            batch.push_back(knoxcrypt::BlockIOEngine::Request{false, dataStart + 5000 + i * 70000, &small[i * 100], 100});
+        }
+        auto engine(knoxcrypt::BlockIOEngine::get(io));
+        ASSERT_EQUAL(4u, engine->queueDepth(), "BlockIOEngineTest::batchedReadsMatchImage depth");
+        ASSERT_EQUAL(true, engine->complete(engine->submit(batch)), "BlockIOEngineTest::batchedReadsMatchImage complete");
+        ASSERT_EQUAL(data, std::string(large.begin(), large.end()), "BlockIOEngineTest::batchedReadsMatchImage large");
+        bool smallMatch = true;
+        for (uint64_t i = 0; i < 3; ++i) {
+            smallMatch = smallMatch && std::string(&small[i * 100], 100) == data.substr(5000 + i * 70000, 100);
+        }
+        ASSERT_EQUAL(true, smallMatch, "BlockIOEngineTest::batchedReadsMatchImage small");
+    }
+
+    void batchedWritesReachImage()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->ioQueueDepth = 3;
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(io);
+        uint64_t const bytes = 300 * 1024;
+        std::string data(pattern(bytes));
+        auto engine(knoxcrypt::BlockIOEngine::get(io));
+        knoxcrypt::BlockIOEngine::Batch batch;
+        batch.push_back(knoxcrypt::BlockIOEngine::Request{true, dataStart, &data[0], bytes});
+        ASSERT_EQUAL(true, engine->complete(engine->submit(batch)), "BlockIOEngineTest::batchedWritesReachImage complete");
+
+        knoxcrypt::SharedCoreIO direct(createTestIO(testPath));
+        knoxcrypt::ContainerImageStream in(direct, std::ios::in | std::ios::binary);
+        std::vector<char> buf(bytes);
+        (void)in.readAt(dataStart, &buf.front(), bytes);
+        ASSERT_EQUAL(data, std::string(buf.begin(), buf.end()), "BlockIOEngineTest::batchedWritesReachImage");
+    }
+
+    void queuedWriteBatchesReachImage()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->ioQueueDepth = 1;
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(io);
+        uint64_t const bytes = 600 * 1024;
+        std::string data(pattern(bytes));
+
+        // the one worker services several slices of each batch, flushing
+        // between batches rather than after every slice
+        auto engine(knoxcrypt::BlockIOEngine::get(io));
+        knoxcrypt::BlockIOEngine::Batch first;
+        first.push_back(knoxcrypt::BlockIOEngine::Request{true, dataStart, &data[0], bytes / 2});
+        knoxcrypt::BlockIOEngine::Batch second;
+        second.push_back(knoxcrypt::BlockIOEngine::Request{true, dataStart + bytes / 2, &data[bytes / 2], bytes / 2});
+        auto firstTicket(engine->submit(first));
+        auto secondTicket(engine->submit(second));
+        ASSERT_EQUAL(true, engine->complete(firstTicket), "BlockIOEngineTest::queuedWriteBatchesReachImage first");
+        ASSERT_EQUAL(true, engine->complete(secondTicket), "BlockIOEngineTest::queuedWriteBatchesReachImage second");
+
+        knoxcrypt::SharedCoreIO direct(createTestIO(testPath));
+        knoxcrypt::ContainerImageStream in(direct, std::ios::in | std::ios::binary);
+        std::vector<char> buf(bytes);
+        (void)in.readAt(dataStart, &buf.front(), bytes);
+        ASSERT_EQUAL(data, std::string(buf.begin(), buf.end()), "BlockIOEngineTest::queuedWriteBatchesReachImage");
+    }
+
+    void failedRequestsReported()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->ioQueueDepth = 2;
+        uint64_t const size = boost::filesystem::file_size(testPath);
+        char buf[64];
+        knoxcrypt::BlockIOEngine::Batch batch;
+        batch.push_back(knoxcrypt::BlockIOEngine::Request{false, size - 32, buf, 64});
+        auto engine(knoxcrypt::BlockIOEngine::get(io));
+        ASSERT_EQUAL(false, engine->complete(engine->submit(batch)), "BlockIOEngineTest::failedRequestsReported failed");
+
+        // the worker that failed carries on servicing requests
+        batch.clear();
+        batch.push_back(knoxcrypt::BlockIOEngine::Request{false, 0, buf, 32});
+        batch.push_back(knoxcrypt::BlockIOEngine::Request{false, 32, buf + 32, 32});
+        ASSERT_EQUAL(true, engine->complete(engine->submit(batch)), "BlockIOEngineTest::failedRequestsReported recovered");
+    }
+
+    void fileReadsThroughEngine(uint64_t const cacheBytes)
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->ioQueueDepth = 4;
+        io->decryptedCacheBytes = cacheBytes;
+        io->writeBackBytes = cacheBytes / 2;
+        uint64_t const space = knoxcrypt::detail::blockWriteSpace(io);
+        uint64_t const bytes = space * 40 + 123;
+        std::string const data(pattern(bytes));
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(data.c_str(), bytes);
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        std::vector<char> buf(bytes);
+        ASSERT_EQUAL(std::streamsize(bytes), entry.read(&buf.front(), bytes),
+                     cacheBytes ? "BlockIOEngineTest::fileReadsThroughEngine cached count"
+                                : "BlockIOEngineTest::fileReadsThroughEngine count");
+        ASSERT_EQUAL(data, std::string(buf.begin(), buf.end()),
+                     cacheBytes ? "BlockIOEngineTest::fileReadsThroughEngine cached whole file"
+                                : "BlockIOEngineTest::fileReadsThroughEngine whole file");
+
+        // starting part way in to a block and finishing part way in to another
+        uint64_t const from = space * 3 + 17;
+        uint64_t const count = space * 20 + 5;
+        (void)entry.seek(from);
+        ASSERT_EQUAL(std::streamsize(count), entry.read(&buf.front(), count),
+                     cacheBytes ? "BlockIOEngineTest::fileReadsThroughEngine cached part count"
+                                : "BlockIOEngineTest::fileReadsThroughEngine part count");
+        ASSERT_EQUAL(data.substr(from, count), std::string(buf.begin(), buf.begin() + count),
+                     cacheBytes ? "BlockIOEngineTest::fileReadsThroughEngine cached part"
+                                : "BlockIOEngineTest::fileReadsThroughEngine part");
+        ASSERT_EQUAL(true, bool(io->ioEngine), cacheBytes ? "BlockIOEngineTest::fileReadsThroughEngine cached used"
+                                                          : "BlockIOEngineTest::fileReadsThroughEngine used");
+    }
+
+    void fileWritesThroughEngine(unsigned int const version)
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, version);
+        std::string const label(version == knoxcrypt::detail::LATEST_VERSION ? " (latest)" : " (v22)");
+        uint64_t startBlock;
+        std::string data;
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath, version));
+            io->ioQueueDepth = 4;
+            uint64_t const space = knoxcrypt::detail::blockWriteSpace(io);
+            data = pattern(space * 60 + 321);
+
+            // a partial block first so that the batch follows a full block
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(data.c_str(), 100);
+            entry.write(data.c_str() + 100, data.length() - 100);
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+            ASSERT_EQUAL(true, bool(io->ioEngine), "BlockIOEngineTest::fileWritesThroughEngine used" + label);
+        }
+
+        // read back one block at a time
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath, version));
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        ASSERT_EQUAL(uint64_t(data.length()), entry.fileSize(), "BlockIOEngineTest::fileWritesThroughEngine size" + label);
+        std::vector<char> buf(data.length());
+        ASSERT_EQUAL(std::streamsize(buf.size()), entry.read(&buf.front(), buf.size()),
+                     "BlockIOEngineTest::fileWritesThroughEngine count" + label);
+        ASSERT_EQUAL(data, std::string(buf.begin(), buf.end()), "BlockIOEngineTest::fileWritesThroughEngine content" + label);
+    }
+
+    std::string readInChunks(knoxcrypt::File &entry, uint64_t const from, uint64_t const chunk)
+    {
+        (void)entry.seek(from);
+        std::string result;
+        std::vector<char> buf(chunk);
+        std::streamsize count;
+        while ((count = entry.read(&buf.front(), chunk)) > 0) {
+            result.append(buf.begin(), buf.begin() + count);
+        }
+        return result;
+    }
+
+    void sequentialReadsAhead()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->ioQueueDepth = 4;
+        uint64_t const space = knoxcrypt::detail::blockWriteSpace(io);
+        uint64_t const bytes = space * 150 + 77;
+        std::string data(pattern(bytes));
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(data.c_str(), bytes);
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // small reads that don't line up with block boundaries
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildOverwriteDisposition());
+        ASSERT_EQUAL(data, readInChunks(entry, 0, 1000), "BlockIOEngineTest::sequentialReadsAhead whole file");
+        ASSERT_EQUAL(data.substr(space * 10 + 3), readInChunks(entry, space * 10 + 3, 333),
+                     "BlockIOEngineTest::sequentialReadsAhead from part way");
+
+        // blocks read ahead are not used once the file has been written to
+        std::string const changed(1000, 'z');
+        (void)readInChunks(entry, space * 50 + 5, space);
+        (void)entry.seek(space * 60 + 11);
+        entry.write(changed.c_str(), changed.length());
+        data.replace(space * 60 + 11, changed.length(), changed);
+        ASSERT_EQUAL(data.substr(space * 40 + 9), readInChunks(entry, space * 40 + 9, 1000),
+                     "BlockIOEngineTest::sequentialReadsAhead after write");
+    }
+
+    boost::filesystem::path m_uniquePath;
+};
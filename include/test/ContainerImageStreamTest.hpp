@@ -0,0 +1,572 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/File.hpp"
+#include "knoxcrypt/HostPageCache.hpp"
+#include "knoxcrypt/ImageCipher.hpp"
+#include "knoxcrypt/MappedImage.hpp"
+#include "knoxcrypt/OpenDisposition.hpp"
+#include "knoxcrypt/detail/DetailFileBlock.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace simpletest;
+
+class ContainerImageStreamTest
+{
+  public:
+    ContainerImageStreamTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        positionalWriteThenRead();
+        positionalReadsIgnoreStreamPosition();
+        positionalReadsFromManyThreads(0);
+        positionalReadsFromManyThreads(1024 * 1024);
+        positionalWritesFromManyThreads();
+        cipherPipelineMatchesCipherStream();
+        mappedReadsSeeImageContents();
+        mappedWritesReachImage();
+        mappedWritesExtendImage();
+        encryptedImageMapped();
+        encryptedFileContentsSurviveMapping();
+        fileContentsSurviveMapping();
+        plainStreamBypassesCache();
+        plainAppendsAtEnd();
+        plainOpenOfMissingImageFails();
+        fileContentsSurvivePlainIO();
+        dropHostCacheContentsSurvive(0);
+        dropHostCacheContentsSurvive(1024 * 1024);
+        dropHostCacheWritesWaitForWriteBack();
+    }
+
+    ~ContainerImageStreamTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    /// the byte expected at position i of the block data written by fillBlocks
+    static char expected(uint64_t const i)
+    {
+        return char('a' + (i * 7) % 26);
+    }
+
+    void fillBlocks(knoxcrypt::SharedCoreIO const &io, uint64_t const bytes)
+    {
+        std::vector<char> data(bytes);
+        for (uint64_t i = 0; i < bytes; ++i) {
+            data[i] = expected(i);
+        }
+        knoxcrypt::ContainerImageStream out(io, std::ios::in | std::ios::out | std::ios::binary);
+        (void)out.writeAt(knoxcrypt::detail::getOffsetOfBlockDataArea(io), &data.front(), bytes);
+    }
+
+    /// an io for an image whose cipher is NONE, optionally mapped
+    knoxcrypt::SharedCoreIO plainIO(boost::filesystem::path const &testPath, bool const mapImage)
+    {
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->encProps.cipher = cryptostreampp::Algorithm::NONE;
+        io->mapImage = mapImage;
+        return io;
+    }
+
+    boost::filesystem::path buildPlainImage()
+    {
+        boost::filesystem::path testPath = m_uniquePath / boost::filesystem::unique_path();
+        knoxcrypt::SharedCoreIO io(plainIO(testPath, false));
+        knoxcrypt::MakeKnoxCrypt kc(io, true);
+        kc.buildImage();
+        return testPath;
+    }
+
+    void positionalWriteThenRead()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(io);
+        fillBlocks(io, io->blockSize * 2);
+
+        knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::out | std::ios::binary);
+        (void)stream.writeAt(dataStart + 100, "hello", 5);
+        char buf[7];
+        (void)stream.readAt(dataStart + 99, buf, 7);
+        ASSERT_EQUAL(expected(99), buf[0], "ContainerImageStreamTest::positionalWriteThenRead before");
+        ASSERT_EQUAL(std::string("hello"), std::string(buf + 1, 5), "ContainerImageStreamTest::positionalWriteThenRead written");
+        ASSERT_EQUAL(expected(105), buf[6], "ContainerImageStreamTest::positionalWriteThenRead after");
+    }
+
+    void positionalReadsIgnoreStreamPosition()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(io);
+        fillBlocks(io, io->blockSize);
+
+        knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::binary);
+        (void)stream.seekg(dataStart + 500);
+        char byte;
+        (void)stream.readAt(dataStart + 3, &byte, 1);
+        ASSERT_EQUAL(expected(3), byte, "ContainerImageStreamTest::positionalReadsIgnoreStreamPosition");
+    }
+
+    void positionalReadsFromManyThreads(uint64_t const cacheBytes)
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->decryptedCacheBytes = cacheBytes;
+        uint64_t const blockSize = io->blockSize;
+        uint64_t const blocks = 32;
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(io);
+        fillBlocks(io, blockSize * blocks);
+
+        // every thread reads every block through the one stream, each
+        // starting at a different block
+        knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::binary);
+        std::atomic<int> mismatches(0);
+        std::vector<std::thread> threads;
+        for (uint64_t t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t]() {
+                std::vector<char> buf(blockSize);
+                for (uint64_t i = 0; i < blocks * 4; ++i) {
+                    uint64_t const b = (t * 8 + i) % blocks;
+                    (void)stream.readAt(dataStart + b * blockSize, &buf.front(), blockSize);
+                    for (uint64_t j = 0; j < blockSize; ++j) {
+                        if (buf[j] != expected(b * blockSize + j)) {
+                            ++mismatches;
+                            break;
+                        }
+                    }
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        ASSERT_EQUAL(0, mismatches.load(), cacheBytes ? "ContainerImageStreamTest::positionalReadsFromManyThreads cached"
+                                                      : "ContainerImageStreamTest::positionalReadsFromManyThreads uncached");
+    }
+
+    void positionalWritesFromManyThreads()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->decryptedCacheBytes = 1024 * 1024;
+        uint64_t const blockSize = io->blockSize;
+        uint64_t const blocks = 32;
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(io);
+
+        // each thread writes, and reads back, its own blocks through the one
+        // cached stream while the others do the same
+        knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::out | std::ios::binary);
+        std::atomic<int> mismatches(0);
+        std::vector<std::thread> threads;
+        for (uint64_t t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t]() {
+                std::vector<char> data(blockSize);
+                std::vector<char> buf(blockSize);
+                for (uint64_t b = t; b < blocks; b += 4) {
+                    for (uint64_t j = 0; j < blockSize; ++j) {
+                        data[j] = expected(b * blockSize + j);
+                    }
+                    (void)stream.writeAt(dataStart + b * blockSize, &data.front(), blockSize);
+                    (void)stream.readAt(dataStart + b * blockSize, &buf.front(), blockSize);
+                    if (buf != data) {
+                        ++mismatches;
+                    }
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        ASSERT_EQUAL(0, mismatches.load(), "ContainerImageStreamTest::positionalWritesFromManyThreads");
+
+        // and the image itself holds what was written
+        knoxcrypt::SharedCoreIO uncached(createTestIO(testPath));
+        knoxcrypt::ContainerImageStream in(uncached, std::ios::in | std::ios::binary);
+        std::vector<char> buf(blockSize * blocks);
+        (void)in.readAt(dataStart, &buf.front(), buf.size());
+        bool matches = true;
+        for (uint64_t i = 0; i < buf.size(); ++i) {
+            matches = matches && buf[i] == expected(i);
+        }
+        ASSERT_EQUAL(true, matches, "ContainerImageStreamTest::positionalWritesFromManyThreads image");
+    }
+
+    void cipherPipelineMatchesCipherStream()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        knoxcrypt::SharedCoreIO streamed(createTestIO(testPath));
+        streamed->cipherPipeline = false;
+        ASSERT_EQUAL(true, bool(knoxcrypt::ImageCipher::get(io)),
+                     "ContainerImageStreamTest::cipherPipelineMatchesCipherStream cipher");
+        ASSERT_EQUAL(false, bool(knoxcrypt::ImageCipher::get(streamed)),
+                     "ContainerImageStreamTest::cipherPipelineMatchesCipherStream switched off");
+
+        uint64_t const bytes = 3 * io->blockSize + 100;
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(io);
+        std::vector<char> data(bytes);
+        for (uint64_t i = 0; i < bytes; ++i) {
+            data[i] = expected(i);
+        }
+
+        // what one writes the other reads back
+        std::vector<char> buf(bytes);
+        {
+            knoxcrypt::ContainerImageStream out(io, std::ios::in | std::ios::out | std::ios::binary);
+            (void)out.writeAt(dataStart + 7, &data.front(), bytes);
+        }
+        {
+            knoxcrypt::ContainerImageStream in(streamed, std::ios::in | std::ios::binary);
+            (void)in.readAt(dataStart + 7, &buf.front(), bytes);
+        }
+        ASSERT_EQUAL(true, buf == data, "ContainerImageStreamTest::cipherPipelineMatchesCipherStream read by stream");
+        {
+            knoxcrypt::ContainerImageStream out(streamed, std::ios::in | std::ios::out | std::ios::binary);
+            (void)out.writeAt(dataStart + bytes + 13, &data.front(), bytes);
+        }
+        {
+            knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+            (void)in.readAt(dataStart + bytes + 13, &buf.front(), bytes);
+        }
+        ASSERT_EQUAL(true, buf == data, "ContainerImageStreamTest::cipherPipelineMatchesCipherStream read by pipeline");
+
+        // and the image itself holds encrypted bytes
+        std::ifstream image(testPath.c_str(), std::ios::in | std::ios::binary);
+        (void)image.seekg(dataStart + 7);
+        (void)image.read(&buf.front(), bytes);
+        ASSERT_EQUAL(false, buf == data, "ContainerImageStreamTest::cipherPipelineMatchesCipherStream encrypted");
+    }
+
+    void mappedReadsSeeImageContents()
+    {
+        boost::filesystem::path testPath = buildPlainImage();
+        knoxcrypt::SharedCoreIO io(plainIO(testPath, true));
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(io);
+        fillBlocks(plainIO(testPath, false), io->blockSize);
+
+        knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::binary);
+        ASSERT_EQUAL(true, bool(io->mappedImage), "ContainerImageStreamTest::mappedReadsSeeImageContents mapped");
+        char buf[3];
+        (void)stream.seekg(dataStart + 40);
+        (void)stream.read(buf, 3);
+        ASSERT_EQUAL(expected(42), buf[2], "ContainerImageStreamTest::mappedReadsSeeImageContents read");
+        ASSERT_EQUAL(std::streamoff(dataStart + 43), std::streamoff(stream.tellg()),
+                     "ContainerImageStreamTest::mappedReadsSeeImageContents position");
+
+        // reading past the end of the image fails as it would for a file
+        (void)stream.seekg(0, std::ios::end);
+        (void)stream.read(buf, 1);
+        ASSERT_EQUAL(std::streamoff(-1), std::streamoff(stream.tellg()),
+                     "ContainerImageStreamTest::mappedReadsSeeImageContents past end");
+    }
+
+    void mappedWritesReachImage()
+    {
+        boost::filesystem::path testPath = buildPlainImage();
+        knoxcrypt::SharedCoreIO io(plainIO(testPath, true));
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(io);
+        {
+            knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::out | std::ios::binary);
+            (void)stream.seekp(dataStart + 10);
+            (void)stream.write("mapped", 6);
+        }
+        knoxcrypt::MappedImage::get(io)->sync();
+
+        knoxcrypt::SharedCoreIO direct(plainIO(testPath, false));
+        knoxcrypt::ContainerImageStream in(direct, std::ios::in | std::ios::binary);
+        char buf[6];
+        (void)in.readAt(dataStart + 10, buf, 6);
+        ASSERT_EQUAL(std::string("mapped"), std::string(buf, 6), "ContainerImageStreamTest::mappedWritesReachImage");
+    }
+
+    void mappedWritesExtendImage()
+    {
+        boost::filesystem::path testPath = buildPlainImage();
+        knoxcrypt::SharedCoreIO io(plainIO(testPath, true));
+        uint64_t const size = boost::filesystem::file_size(testPath);
+        {
+            knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::out | std::ios::binary);
+            (void)stream.writeAt(size + 4, "tail", 4);
+            char buf[4];
+            (void)stream.readAt(size + 4, buf, 4);
+            ASSERT_EQUAL(std::string("tail"), std::string(buf, 4), "ContainerImageStreamTest::mappedWritesExtendImage read back");
+        }
+        ASSERT_EQUAL(size + 8, uint64_t(boost::filesystem::file_size(testPath)),
+                     "ContainerImageStreamTest::mappedWritesExtendImage size");
+    }
+
+    void encryptedImageMapped()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->mapImage = true;
+        knoxcrypt::SharedCoreIO streamed(createTestIO(testPath));
+        streamed->cipherPipeline = false;
+        ASSERT_EQUAL(true, bool(knoxcrypt::MappedImage::get(io)), "ContainerImageStreamTest::encryptedImageMapped mapped");
+
+        uint64_t const bytes = 2 * io->blockSize + 50;
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(io);
+        std::vector<char> data(bytes);
+        for (uint64_t i = 0; i < bytes; ++i) {
+            data[i] = expected(i + 3);
+        }
+
+        // what goes in through the mapping comes out of the cipher stream
+        // and vice versa
+        std::vector<char> buf(bytes);
+        {
+            knoxcrypt::ContainerImageStream out(io, std::ios::in | std::ios::out | std::ios::binary);
+            (void)out.writeAt(dataStart + 5, &data.front(), bytes);
+        }
+        {
+            knoxcrypt::ContainerImageStream in(streamed, std::ios::in | std::ios::binary);
+            (void)in.readAt(dataStart + 5, &buf.front(), bytes);
+        }
+        ASSERT_EQUAL(true, buf == data, "ContainerImageStreamTest::encryptedImageMapped read by stream");
+        {
+            knoxcrypt::ContainerImageStream out(streamed, std::ios::in | std::ios::out | std::ios::binary);
+            (void)out.writeAt(dataStart + bytes + 11, &data.front(), bytes);
+        }
+        {
+            knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+            (void)in.readAt(dataStart + bytes + 11, &buf.front(), bytes);
+        }
+        ASSERT_EQUAL(true, buf == data, "ContainerImageStreamTest::encryptedImageMapped read from mapping");
+
+        // and only ciphertext reaches the image
+        io->mappedImage->sync();
+        std::ifstream image(testPath.c_str(), std::ios::in | std::ios::binary);
+        (void)image.seekg(dataStart + 5);
+        (void)image.read(&buf.front(), bytes);
+        ASSERT_EQUAL(false, buf == data, "ContainerImageStreamTest::encryptedImageMapped encrypted");
+    }
+
+    void encryptedFileContentsSurviveMapping()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        std::string const text(createLargeStringToWrite());
+        uint64_t startBlock;
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            io->mapImage = true;
+            io->decryptedCacheBytes = 0;
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(text.c_str(), text.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+            ASSERT_EQUAL(true, bool(io->mappedImage), "ContainerImageStreamTest::encryptedFileContentsSurviveMapping mapped");
+        }
+
+        // read back through the cipher stream, now that the mapping has
+        // been released
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->cipherPipeline = false;
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        std::vector<char> buf(text.length());
+        entry.read(&buf.front(), text.length());
+        ASSERT_EQUAL(text, std::string(buf.begin(), buf.end()), "ContainerImageStreamTest::encryptedFileContentsSurviveMapping");
+    }
+
+    void fileContentsSurviveMapping()
+    {
+        boost::filesystem::path testPath = buildPlainImage();
+        std::string const text(createLargeStringToWrite());
+        uint64_t startBlock;
+        {
+            knoxcrypt::SharedCoreIO io(plainIO(testPath, true));
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(text.c_str(), text.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // read back without the mapping, now that it has been released
+        knoxcrypt::SharedCoreIO io(plainIO(testPath, false));
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        std::vector<char> buf(text.length());
+        entry.read(&buf.front(), text.length());
+        ASSERT_EQUAL(text, std::string(buf.begin(), buf.end()), "ContainerImageStreamTest::fileContentsSurviveMapping");
+    }
+
+    void plainStreamBypassesCache()
+    {
+        boost::filesystem::path testPath = buildPlainImage();
+        knoxcrypt::SharedCoreIO io(plainIO(testPath, false));
+        io->decryptedCacheBytes = 1024 * 1024;
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(io);
+        {
+            knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::out | std::ios::binary);
+            (void)stream.seekp(dataStart + 20);
+            (void)stream.write("plain", 5);
+            ASSERT_EQUAL(std::streamoff(dataStart + 25), std::streamoff(stream.tellp()),
+                         "ContainerImageStreamTest::plainStreamBypassesCache position");
+            char buf[5];
+            (void)stream.readAt(dataStart + 20, buf, 5);
+            ASSERT_EQUAL(std::string("plain"), std::string(buf, 5), "ContainerImageStreamTest::plainStreamBypassesCache read back");
+        }
+        ASSERT_EQUAL(false, bool(io->decryptedCache), "ContainerImageStreamTest::plainStreamBypassesCache no cache");
+
+        // nothing was transformed on the way to the image
+        std::ifstream in(testPath.string().c_str(), std::ios::in | std::ios::binary);
+        (void)in.seekg(dataStart + 20);
+        char buf[5];
+        (void)in.read(buf, 5);
+        ASSERT_EQUAL(std::string("plain"), std::string(buf, 5), "ContainerImageStreamTest::plainStreamBypassesCache on disk");
+    }
+
+    void plainAppendsAtEnd()
+    {
+        boost::filesystem::path testPath = buildPlainImage();
+        knoxcrypt::SharedCoreIO io(plainIO(testPath, false));
+        uint64_t const size = boost::filesystem::file_size(testPath);
+        {
+            knoxcrypt::ContainerImageStream stream(io, std::ios::out | std::ios::app | std::ios::binary);
+            (void)stream.seekp(0);
+            (void)stream.write("tail", 4);
+            ASSERT_EQUAL(false, stream.bad(), "ContainerImageStreamTest::plainAppendsAtEnd good");
+        }
+        ASSERT_EQUAL(size + 4, uint64_t(boost::filesystem::file_size(testPath)),
+                     "ContainerImageStreamTest::plainAppendsAtEnd size");
+        knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+        char buf[4];
+        (void)in.readAt(size, buf, 4);
+        ASSERT_EQUAL(std::string("tail"), std::string(buf, 4), "ContainerImageStreamTest::plainAppendsAtEnd contents");
+    }
+
+    void plainOpenOfMissingImageFails()
+    {
+        knoxcrypt::SharedCoreIO io(plainIO(m_uniquePath / boost::filesystem::unique_path(), false));
+
+        // as with a file stream, updating a missing file doesn't create it
+        knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::out | std::ios::binary);
+        ASSERT_EQUAL(false, stream.is_open(), "ContainerImageStreamTest::plainOpenOfMissingImageFails open");
+        char byte;
+        (void)stream.read(&byte, 1);
+        ASSERT_EQUAL(std::streamoff(-1), std::streamoff(stream.tellg()),
+                     "ContainerImageStreamTest::plainOpenOfMissingImageFails read");
+        ASSERT_EQUAL(false, boost::filesystem::exists(io->path), "ContainerImageStreamTest::plainOpenOfMissingImageFails not created");
+    }
+
+    void fileContentsSurvivePlainIO()
+    {
+        boost::filesystem::path testPath = buildPlainImage();
+        std::string const text(createLargeStringToWrite());
+        uint64_t startBlock;
+        {
+            knoxcrypt::SharedCoreIO io(plainIO(testPath, false));
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(text.c_str(), text.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // read back through the mapping this time
+        knoxcrypt::SharedCoreIO io(plainIO(testPath, true));
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        std::vector<char> buf(text.length());
+        entry.read(&buf.front(), text.length());
+        ASSERT_EQUAL(text, std::string(buf.begin(), buf.end()), "ContainerImageStreamTest::fileContentsSurvivePlainIO");
+    }
+
+    void dropHostCacheContentsSurvive(uint64_t const cacheBytes)
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        std::string const text(createLargeStringToWrite());
+        uint64_t startBlock;
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            io->dropHostCache = true;
+            io->decryptedCacheBytes = cacheBytes;
+            io->writeBackBytes = cacheBytes / 2;
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(text.c_str(), text.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->dropHostCache = true;
+        knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        std::vector<char> buf(text.length());
+        entry.read(&buf.front(), text.length());
+        ASSERT_EQUAL(text, std::string(buf.begin(), buf.end()),
+                     cacheBytes ? "ContainerImageStreamTest::dropHostCacheContentsSurvive cached"
+                                : "ContainerImageStreamTest::dropHostCacheContentsSurvive");
+    }
+
+    void dropHostCacheWritesWaitForWriteBack()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->dropHostCache = true;
+        auto host(knoxcrypt::HostPageCache::get(io));
+        ASSERT_EQUAL(true, bool(host), "ContainerImageStreamTest::dropHostCacheWritesWaitForWriteBack created");
+
+        // small writes are only noted until a sync point writes them back
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            std::string const text(createAString());
+            entry.write(text.c_str(), text.length());
+            entry.flush();
+        }
+        uint64_t const pending = host->pendingBytes();
+        ASSERT_EQUAL(true, pending > 0 && pending < knoxcrypt::HostPageCache::WRITEBACK_BYTES,
+                     "ContainerImageStreamTest::dropHostCacheWritesWaitForWriteBack noted");
+        host->writeBack();
+        ASSERT_EQUAL(uint64_t(0), host->pendingBytes(),
+                     "ContainerImageStreamTest::dropHostCacheWritesWaitForWriteBack written back");
+
+        // but a lot of writes are written back as they go
+        knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::out | std::ios::binary);
+        std::vector<char> const block(64 * 1024, 'x');
+        uint64_t const offset = knoxcrypt::detail::getOffsetOfFileBlockData(io, 1000);
+        for (int i = 0; i < 200; ++i) {
+            (void)stream.writeAt(offset, &block.front(), block.size());
+        }
+        ASSERT_EQUAL(true, host->pendingBytes() < knoxcrypt::HostPageCache::WRITEBACK_BYTES,
+                     "ContainerImageStreamTest::dropHostCacheWritesWaitForWriteBack bounded");
+    }
+
+    boost::filesystem::path m_uniquePath;
+};
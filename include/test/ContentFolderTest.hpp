@@ -71,6 +71,10 @@ class ContentFolderTest
         testRemoveFile();
         testRemoveEmptySubFolder();
         testRemoveNonEmptySubFolder();
+        testEntryStatsPersistedOnFlush();
+        testEntryStatsPersistedOnTruncate();
+        testEntryStatsOnPreviousVersionImage();
+        testDefaultImageRecordsEntryStats();
     }
 
     ~ContentFolderTest()
@@ -419,4 +423,111 @@ class ContentFolderTest
         }
     }
 
+    void testEntryStatsPersistedOnFlush()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        uint64_t blocks;
+        {
+            knoxcrypt::ContentFolder folder = createTestFolder(testPath);
+            std::string testString(createLargeStringToWrite());
+            knoxcrypt::File entry = *folder.getFile("some.log", knoxcrypt::OpenDisposition::buildAppendDisposition());
+            entry.write(testString.c_str(), testString.length());
+            entry.flush();
+            blocks = entry.blockCount();
+        }
+
+        // a fresh folder reads the stats straight from the entry metadata
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        knoxcrypt::ContentFolder folder(io, 0, std::string("root"));
+        auto info(folder.getEntryInfo("some.log"));
+        ASSERT_EQUAL(uint64_t(BIG_SIZE), info->size(), "ContentFolderTest::testEntryStatsPersistedOnFlush size");
+        ASSERT_EQUAL(blocks, info->blockCount(), "ContentFolderTest::testEntryStatsPersistedOnFlush blocks");
+        ASSERT_EQUAL(uint64_t(0), folder.getEntryInfo("vai.mp3")->size(),
+                     "ContentFolderTest::testEntryStatsPersistedOnFlush other entry");
+    }
+
+    void testEntryStatsPersistedOnTruncate()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        {
+            knoxcrypt::ContentFolder folder = createTestFolder(testPath);
+            std::string testString(createLargeStringToWrite());
+            knoxcrypt::File entry = *folder.getFile("some.log", knoxcrypt::OpenDisposition::buildAppendDisposition());
+            entry.write(testString.c_str(), testString.length());
+            entry.flush();
+            entry.truncate(10);
+        }
+
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        knoxcrypt::ContentFolder folder(io, 0, std::string("root"));
+        auto info(folder.getEntryInfo("some.log"));
+        ASSERT_EQUAL(uint64_t(10), info->size(), "ContentFolderTest::testEntryStatsPersistedOnTruncate size");
+        ASSERT_EQUAL(uint64_t(1), info->blockCount(), "ContentFolderTest::testEntryStatsPersistedOnTruncate blocks");
+    }
+
+    void testEntryStatsOnPreviousVersionImage()
+    {
+        unsigned int const version = knoxcrypt::detail::VERSION_META_TABLE;
+        boost::filesystem::path testPath = buildImage(m_uniquePath, version);
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath, version));
+            knoxcrypt::ContentFolder folder(io, 0, std::string("root"));
+            folder.addFile("test.txt");
+            folder.addFile("some.log");
+            std::string testString(createLargeStringToWrite());
+            knoxcrypt::File entry = *folder.getFile("some.log", knoxcrypt::OpenDisposition::buildAppendDisposition());
+            entry.write(testString.c_str(), testString.length());
+            entry.flush();
+        }
+
+        // older images keep the shorter entries; stats come from the file itself
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath, version));
+        knoxcrypt::ContentFolder folder(io, 0, std::string("root"));
+        std::vector<std::string> names;
+        for (auto entry = folder.begin(); entry != folder.end(); ++entry) {
+            names.push_back((*entry)->filename());
+        }
+        ASSERT_EQUAL(size_t(2), names.size(), "ContentFolderTest::testEntryStatsOnPreviousVersionImage count");
+        ASSERT_EQUAL(std::string("some.log"), names.back(), "ContentFolderTest::testEntryStatsOnPreviousVersionImage name");
+        ASSERT_EQUAL(uint64_t(BIG_SIZE), folder.getEntryInfo("some.log")->size(),
+                     "ContentFolderTest::testEntryStatsOnPreviousVersionImage size");
+    }
+
+    void testDefaultImageRecordsEntryStats()
+    {
+        // an image made with CoreIO's default version, as makeknoxcrypt does
+        boost::filesystem::path testPath = m_uniquePath / boost::filesystem::unique_path();
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->version = knoxcrypt::CoreIO().version;
+        {
+            knoxcrypt::MakeKnoxCrypt kc(io, true);
+            kc.buildImage();
+        }
+        io->version = 0;
+        knoxcrypt::detail::readImageIVAndRounds(io);
+        ASSERT_EQUAL(knoxcrypt::detail::VERSION_ENTRY_STATS, io->version,
+                     "ContentFolderTest::testDefaultImageRecordsEntryStats version");
+
+        uint64_t blocks;
+        {
+            knoxcrypt::ContentFolder folder(io, 0, std::string("root"));
+            folder.addFile("some.log");
+            std::string testString(createLargeStringToWrite());
+            knoxcrypt::File entry = *folder.getFile("some.log", knoxcrypt::OpenDisposition::buildAppendDisposition());
+            entry.write(testString.c_str(), testString.length());
+            entry.flush();
+            blocks = entry.blockCount();
+        }
+
+        // the stats follow the entry's name and first block index
+        knoxcrypt::File folderData(io, "root", 0, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        folderData.seek(8 + 1 + knoxcrypt::detail::MAX_FILENAME_LENGTH + 8);
+        uint8_t stats[knoxcrypt::detail::ENTRY_STATS_BYTES];
+        folderData.read((char*)stats, knoxcrypt::detail::ENTRY_STATS_BYTES);
+        ASSERT_EQUAL(uint64_t(BIG_SIZE), knoxcrypt::detail::convertInt8ArrayToInt64(stats),
+                     "ContentFolderTest::testDefaultImageRecordsEntryStats size");
+        ASSERT_EQUAL(blocks, knoxcrypt::detail::convertInt8ArrayToInt64(stats + 8),
+                     "ContentFolderTest::testDefaultImageRecordsEntryStats blocks");
+    }
+
 };
@@ -0,0 +1,338 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/DecryptedBlockCache.hpp"
+#include "knoxcrypt/File.hpp"
+#include "knoxcrypt/OpenDisposition.hpp"
+#include "knoxcrypt/detail/DetailFileBlock.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace simpletest;
+
+class DecryptedBlockCacheTest
+{
+  public:
+    DecryptedBlockCacheTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        pagesServedFromMemoryOnReread();
+        writesSeenByOtherStreams();
+        heldBytesStayWithinBudget();
+        fileContentsSurviveCaching();
+        cacheDisabledByDefault();
+        writesHeldBackUntilFlushed();
+        dirtyLimitForcesWriteBack();
+        fileWrittenBackOnFlush();
+    }
+
+    ~DecryptedBlockCacheTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+    knoxcrypt::SharedCoreIO cachingIO(boost::filesystem::path const &testPath,
+                                      uint64_t const budget = 1024 * 1024,
+                                      uint64_t const writeBack = 0)
+    {
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->decryptedCacheBytes = budget;
+        io->writeBackBytes = writeBack;
+        return io;
+    }
+
+    /// reads a byte straight from the image, bypassing any cache
+    char readImageByte(boost::filesystem::path const &testPath, uint64_t const offset)
+    {
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+        char byte;
+        (void)in.seekg(offset);
+        (void)in.read(&byte, 1);
+        return byte;
+    }
+
+    /// writes n recognisable bytes at the start of the block data area
+    void writeBlockData(knoxcrypt::SharedCoreIO const &io, uint64_t const n, char const seed)
+    {
+        std::vector<char> data(n);
+        for (uint64_t i = 0; i < n; ++i) {
+            data[i] = char(seed + i % 97);
+        }
+        knoxcrypt::ContainerImageStream out(io, std::ios::in | std::ios::out | std::ios::binary);
+        (void)out.seekp(knoxcrypt::detail::getOffsetOfBlockDataArea(io));
+        (void)out.write(&data.front(), n);
+    }
+
+    void pagesServedFromMemoryOnReread()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(cachingIO(testPath));
+        uint64_t const blockSize = io->blockSize;
+        writeBlockData(io, blockSize * 4, 'a');
+        auto cache(knoxcrypt::DecryptedBlockCache::get(io));
+
+        std::vector<char> first(blockSize * 2);
+        std::vector<char> second(blockSize * 2);
+        knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+        (void)in.seekg(knoxcrypt::detail::getOffsetOfBlockDataArea(io) + 10);
+        (void)in.read(&first.front(), first.size());
+        uint64_t const misses = cache->misses();
+        ASSERT_EQUAL(uint64_t(3), misses, "DecryptedBlockCacheTest::pagesServedFromMemoryOnReread misses");
+        ASSERT_EQUAL('a' + 10, first[0], "DecryptedBlockCacheTest::pagesServedFromMemoryOnReread first byte");
+
+        (void)in.seekg(knoxcrypt::detail::getOffsetOfBlockDataArea(io) + 10);
+        (void)in.read(&second.front(), second.size());
+        ASSERT_EQUAL(misses, cache->misses(), "DecryptedBlockCacheTest::pagesServedFromMemoryOnReread no new misses");
+        ASSERT_EQUAL(uint64_t(3), cache->hits(), "DecryptedBlockCacheTest::pagesServedFromMemoryOnReread hits");
+        ASSERT_EQUAL(true, first == second, "DecryptedBlockCacheTest::pagesServedFromMemoryOnReread same data");
+
+        // the position carries on from the end of a cached read
+        ASSERT_EQUAL(knoxcrypt::detail::getOffsetOfBlockDataArea(io) + 10 + second.size(), uint64_t(in.tellg()),
+                     "DecryptedBlockCacheTest::pagesServedFromMemoryOnReread position");
+    }
+
+    void writesSeenByOtherStreams()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(cachingIO(testPath));
+        uint64_t const blockSize = io->blockSize;
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(io);
+        writeBlockData(io, blockSize * 2, 'a');
+
+        knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+        char byte;
+        (void)in.seekg(dataStart + blockSize + 1);
+        (void)in.read(&byte, 1);
+        ASSERT_EQUAL(char('a' + (blockSize + 1) % 97), byte, "DecryptedBlockCacheTest::writesSeenByOtherStreams before");
+
+        // a second CoreIO for the same image shares the cache
+        knoxcrypt::SharedCoreIO other(cachingIO(testPath));
+        {
+            knoxcrypt::ContainerImageStream out(other, std::ios::in | std::ios::out | std::ios::binary);
+            (void)out.seekp(dataStart + blockSize + 1);
+            (void)out.write("Z", 1);
+        }
+        (void)in.seekg(dataStart + blockSize + 1);
+        (void)in.read(&byte, 1);
+        ASSERT_EQUAL('Z', byte, "DecryptedBlockCacheTest::writesSeenByOtherStreams after");
+
+        // and the write really made it to the image
+        knoxcrypt::SharedCoreIO uncached(createTestIO(testPath));
+        knoxcrypt::ContainerImageStream direct(uncached, std::ios::in | std::ios::binary);
+        (void)direct.seekg(dataStart + blockSize + 1);
+        (void)direct.read(&byte, 1);
+        ASSERT_EQUAL('Z', byte, "DecryptedBlockCacheTest::writesSeenByOtherStreams image");
+    }
+
+    void heldBytesStayWithinBudget()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO probe(createTestIO(testPath));
+        uint64_t const blockSize = probe->blockSize;
+        knoxcrypt::SharedCoreIO io(cachingIO(testPath, blockSize * 4));
+        writeBlockData(io, blockSize * 10, 'a');
+        auto cache(knoxcrypt::DecryptedBlockCache::get(io));
+
+        std::vector<char> data(blockSize * 10);
+        knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+        (void)in.seekg(knoxcrypt::detail::getOffsetOfBlockDataArea(io));
+        (void)in.read(&data.front(), data.size());
+        ASSERT_EQUAL(blockSize * 4, cache->bytes(), "DecryptedBlockCacheTest::heldBytesStayWithinBudget bytes");
+        ASSERT_EQUAL(char('a' + (blockSize * 10 - 1) % 97), data.back(),
+                     "DecryptedBlockCacheTest::heldBytesStayWithinBudget last byte");
+
+        // the first pages were evicted so reading them again misses
+        uint64_t const misses = cache->misses();
+        (void)in.seekg(knoxcrypt::detail::getOffsetOfBlockDataArea(io));
+        (void)in.read(&data.front(), blockSize);
+        ASSERT_EQUAL(misses + 1, cache->misses(), "DecryptedBlockCacheTest::heldBytesStayWithinBudget evicted");
+    }
+
+    void fileContentsSurviveCaching()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(cachingIO(testPath));
+        std::string const text(createLargeStringToWrite());
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(text.c_str(), text.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // overwrite part of it so that cached pages have to be patched
+        {
+            knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildOverwriteDisposition());
+            entry.seek(5000);
+            entry.write("xyz", 3);
+            entry.flush();
+        }
+
+        std::string expected(text);
+        expected.replace(5000, 3, "xyz");
+        std::vector<char> cached(text.length());
+        {
+            knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            entry.read(&cached.front(), text.length());
+        }
+        ASSERT_EQUAL(expected, std::string(cached.begin(), cached.end()),
+                     "DecryptedBlockCacheTest::fileContentsSurviveCaching cached read");
+
+        std::vector<char> uncached(text.length());
+        {
+            knoxcrypt::SharedCoreIO plain(createTestIO(testPath));
+            knoxcrypt::File entry(plain, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            entry.read(&uncached.front(), text.length());
+        }
+        ASSERT_EQUAL(expected, std::string(uncached.begin(), uncached.end()),
+                     "DecryptedBlockCacheTest::fileContentsSurviveCaching uncached read");
+    }
+
+    void cacheDisabledByDefault()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        ASSERT_EQUAL(true, !knoxcrypt::DecryptedBlockCache::get(io), "DecryptedBlockCacheTest::cacheDisabledByDefault");
+    }
+
+    void writesHeldBackUntilFlushed()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO plain(createTestIO(testPath));
+        uint64_t const blockSize = plain->blockSize;
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(plain);
+        writeBlockData(plain, blockSize * 4, 'a');
+
+        knoxcrypt::SharedCoreIO io(cachingIO(testPath, 1024 * 1024, 1024 * 1024));
+        auto cache(knoxcrypt::DecryptedBlockCache::get(io));
+        {
+            // spans the second and third pages
+            std::string const text(blockSize, 'Z');
+            knoxcrypt::ContainerImageStream out(io, std::ios::in | std::ios::out | std::ios::binary);
+            (void)out.seekp(dataStart + blockSize + 10);
+            (void)out.write(text.c_str(), text.length());
+        }
+        ASSERT_EQUAL(blockSize * 2, cache->dirtyBytes(), "DecryptedBlockCacheTest::writesHeldBackUntilFlushed dirty");
+        ASSERT_EQUAL(char('a' + (blockSize + 10) % 97), readImageByte(testPath, dataStart + blockSize + 10),
+                     "DecryptedBlockCacheTest::writesHeldBackUntilFlushed image untouched");
+
+        // visible through the cache straight away
+        {
+            knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+            char bytes[2];
+            (void)in.seekg(dataStart + blockSize * 2 + 9);
+            (void)in.read(bytes, 2);
+            ASSERT_EQUAL('Z', bytes[0], "DecryptedBlockCacheTest::writesHeldBackUntilFlushed cached A");
+            ASSERT_EQUAL(char('a' + (blockSize * 2 + 10) % 97), bytes[1],
+                         "DecryptedBlockCacheTest::writesHeldBackUntilFlushed cached B");
+        }
+
+        cache->flush();
+        ASSERT_EQUAL(uint64_t(0), cache->dirtyBytes(), "DecryptedBlockCacheTest::writesHeldBackUntilFlushed clean");
+        ASSERT_EQUAL('Z', readImageByte(testPath, dataStart + blockSize + 10),
+                     "DecryptedBlockCacheTest::writesHeldBackUntilFlushed image A");
+        ASSERT_EQUAL('Z', readImageByte(testPath, dataStart + blockSize * 2 + 9),
+                     "DecryptedBlockCacheTest::writesHeldBackUntilFlushed image B");
+        ASSERT_EQUAL(char('a' + (blockSize * 2 + 10) % 97), readImageByte(testPath, dataStart + blockSize * 2 + 10),
+                     "DecryptedBlockCacheTest::writesHeldBackUntilFlushed image C");
+    }
+
+    void dirtyLimitForcesWriteBack()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO plain(createTestIO(testPath));
+        uint64_t const blockSize = plain->blockSize;
+        uint64_t const dataStart = knoxcrypt::detail::getOffsetOfBlockDataArea(plain);
+        writeBlockData(plain, blockSize * 4, 'a');
+
+        knoxcrypt::SharedCoreIO io(cachingIO(testPath, 1024 * 1024, blockSize * 2));
+        auto cache(knoxcrypt::DecryptedBlockCache::get(io));
+        knoxcrypt::ContainerImageStream out(io, std::ios::in | std::ios::out | std::ios::binary);
+        for (uint64_t b = 0; b < 2; ++b) {
+            (void)out.seekp(dataStart + blockSize * b);
+            (void)out.write("Y", 1);
+        }
+        ASSERT_EQUAL(blockSize * 2, cache->dirtyBytes(), "DecryptedBlockCacheTest::dirtyLimitForcesWriteBack at limit");
+        ASSERT_EQUAL('a', readImageByte(testPath, dataStart), "DecryptedBlockCacheTest::dirtyLimitForcesWriteBack held");
+
+        (void)out.seekp(dataStart + blockSize * 2);
+        (void)out.write("Y", 1);
+        ASSERT_EQUAL(uint64_t(0), cache->dirtyBytes(), "DecryptedBlockCacheTest::dirtyLimitForcesWriteBack over limit");
+        ASSERT_EQUAL('Y', readImageByte(testPath, dataStart), "DecryptedBlockCacheTest::dirtyLimitForcesWriteBack written A");
+        ASSERT_EQUAL('Y', readImageByte(testPath, dataStart + blockSize * 2),
+                     "DecryptedBlockCacheTest::dirtyLimitForcesWriteBack written B");
+    }
+
+    void fileWrittenBackOnFlush()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(cachingIO(testPath, 1024 * 1024, 1024 * 1024));
+        std::string const text(createLargeStringToWrite());
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(text.c_str(), text.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+        {
+            knoxcrypt::File entry(io, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildOverwriteDisposition());
+            entry.seek(5000);
+            entry.write("xyz", 3);
+            entry.flush();
+        }
+        ASSERT_EQUAL(uint64_t(0), knoxcrypt::DecryptedBlockCache::get(io)->dirtyBytes(),
+                     "DecryptedBlockCacheTest::fileWrittenBackOnFlush clean");
+
+        std::string expected(text);
+        expected.replace(5000, 3, "xyz");
+        std::vector<char> uncached(text.length());
+        {
+            knoxcrypt::SharedCoreIO plain(createTestIO(testPath));
+            knoxcrypt::File entry(plain, "test.txt", startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            entry.read(&uncached.front(), text.length());
+        }
+        ASSERT_EQUAL(expected, std::string(uncached.begin(), uncached.end()),
+                     "DecryptedBlockCacheTest::fileWrittenBackOnFlush image");
+    }
+
+    boost::filesystem::path m_uniquePath;
+};
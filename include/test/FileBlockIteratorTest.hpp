@@ -57,10 +57,10 @@ class FileBlockIteratorTest
 
     void test()
     {
-        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        boost::filesystem::path testPath = buildImage(m_uniquePath, knoxcrypt::detail::VERSION_SUPERBLOCK);
 
-        // build some blocks to iterate over
-        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        // build some blocks to iterate over; only chained layouts can be iterated
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath, knoxcrypt::detail::VERSION_SUPERBLOCK));
         knoxcrypt::File entry(io, "test.txt");
         std::string testData(createLargeStringToWrite());
 
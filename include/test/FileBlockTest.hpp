@@ -70,7 +70,6 @@ class FileBlockTest
 
     void blockWriteAndReadTest()
     {
-        long const blocks = 2048;
         boost::filesystem::path testPath = buildImage(m_uniquePath);
 
         knoxcrypt::SharedCoreIO io(createTestIO(testPath));
@@ -84,12 +83,12 @@ class FileBlockTest
         // test that actual written correct
         assert(block.getDataBytesWritten() == 26);
         knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::out | std::ios::binary);
-        uint64_t size = knoxcrypt::detail::getNumberOfDataBytesWrittenToFileBlockN(stream, io->blockSize, 0, blocks);
+        uint64_t size = knoxcrypt::detail::getNumberOfDataBytesWrittenToFileBlockN(stream, io, 0);
         ASSERT_EQUAL(size, 26, "FileBlockTest::blockWriteAndReadTest(): correctly returned block size");
 
         // test that reported next index correct
         assert(block.getNextIndex() == 0);
-        uint64_t next = knoxcrypt::detail::getIndexOfNextFileBlockFromFileBlockN(stream, io->blockSize, 0, blocks);
+        uint64_t next = knoxcrypt::detail::getIndexOfNextFileBlockFromFileBlockN(stream, io, 0);
         stream.close();
         ASSERT_EQUAL(next, 0, "FileBlockTest::blockWriteAndReadTest(): correct block index");
 
@@ -29,6 +29,7 @@
 #include "knoxcrypt/ContainerImageStream.hpp"
 #include "knoxcrypt/File.hpp"
 #include "knoxcrypt/FileEntryException.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
 #include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
 #include "knoxcrypt/detail/DetailFileBlock.hpp"
 #include "test/SimpleTest.hpp"
@@ -53,6 +54,7 @@ class FileTest
         boost::filesystem::create_directories(m_uniquePath);
         testFileSizeReportedCorrectly();
         testBlocksAllocated();
+        testBigWriteAllocatesContiguousBlocks();
         testFileUnlink();
         testReadingFromNonReadableThrows();
         testWritingToNonWritableThrows();
@@ -72,6 +74,17 @@ class FileTest
         testSeekingFromCurrentPositive_bigSeek();
         testEdgeCaseEndOfBlockOverWrite();
         testEdgeCaseEndOfBlockAppend();
+        testSeekIntoInterleavedFile();
+        testExtentMapRecordsRuns();
+        testExtentMapSpillsAcrossMapBlocks();
+        testCorruptExtentMapThrows();
+        testReadingRunsOfBlocks(knoxcrypt::detail::VERSION_EXTENT_MAP);
+        testReadingRunsOfBlocks(knoxcrypt::detail::LATEST_VERSION);
+        testReadThenFlushLeavesContents();
+        testOverwriteAcrossBlocksKeepsBlockCount();
+        testSeekToExactBlockMultiple();
+        testTruncateUpdatesSizeAndBlockCount();
+        testGrowingBlockByBlockReusesStream();
     }
 
     ~FileTest()
@@ -110,11 +123,11 @@ class FileTest
     void testBlocksAllocated()
     {
         long const blocks = 2048;
-        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        boost::filesystem::path testPath = buildImage(m_uniquePath, knoxcrypt::detail::VERSION_SUPERBLOCK);
 
         // test write get file size from same entry
         {
-            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath, knoxcrypt::detail::VERSION_SUPERBLOCK));
             knoxcrypt::File entry(io, "test.txt");
             std::string testData(createLargeStringToWrite());
             std::vector<uint8_t> vec(testData.begin(), testData.end());
@@ -137,17 +150,50 @@ class FileTest
         }
     }
 
+    void testBigWriteAllocatesContiguousBlocks()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, knoxcrypt::detail::VERSION_SUPERBLOCK);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath, knoxcrypt::detail::VERSION_SUPERBLOCK));
+
+        // leave a hole too small for the write at blocks 1 and 2
+        knoxcrypt::VolumeBitmap::get(io)->setBlockInUse(3);
+
+        knoxcrypt::File entry(io, "test.txt");
+        std::string testData(createLargeStringToWrite());
+        std::vector<uint8_t> vec(testData.begin(), testData.end());
+        entry.write((char*)&vec.front(), BIG_SIZE);
+        entry.flush();
+
+        uint64_t block = entry.getStartVolumeBlockIndex();
+        ASSERT_EQUAL(4, block, "testBigWriteAllocatesContiguousBlocks start");
+        bool contiguous = true;
+        while (true) {
+            knoxcrypt::FileBlock fileBlock(io, block, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            uint64_t const next = fileBlock.getNextIndex();
+            if (next == block) {
+                break;
+            }
+            contiguous = contiguous && (next == block + 1);
+            block = next;
+        }
+        ASSERT_EQUAL(true, contiguous, "testBigWriteAllocatesContiguousBlocks contiguous");
+
+        // the hole is still used by smaller allocations
+        ASSERT_EQUAL(1, *knoxcrypt::VolumeBitmap::get(io)->getNextAvailableBlock(),
+                     "testBigWriteAllocatesContiguousBlocks hole still free");
+    }
+
     void testFileUnlink()
     {
         long const blocks = 2048;
-        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        boost::filesystem::path testPath = buildImage(m_uniquePath, knoxcrypt::detail::VERSION_SUPERBLOCK);
 
         // for storing block indices to make sure they've been deallocated after unlink
         std::vector<uint64_t> blockIndices;
 
         // test write followed by unlink
         {
-            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath, knoxcrypt::detail::VERSION_SUPERBLOCK));
             knoxcrypt::File entry(io, "test.txt");
             std::string testData(createLargeStringToWrite());
             std::vector<uint8_t> vec(testData.begin(), testData.end());
@@ -178,7 +224,7 @@ class FileTest
 
         // test that filesize is 0 when read back in
         {
-            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath, knoxcrypt::detail::VERSION_SUPERBLOCK));
             knoxcrypt::File entry(io, "test.txt");
             ASSERT_EQUAL(0, entry.fileSize(), "testFileUnlink B");
 
@@ -540,7 +586,7 @@ class FileTest
             std::string const testString("Hello and goodbye!");
             std::string testData(testString);
             std::vector<uint8_t> vec(testData.begin(), testData.end());
-            entry.write((char*)&vec.front(), BIG_SIZE);
+            entry.write((char*)&vec.front(), vec.size());
             entry.flush();
         }
 
@@ -752,6 +798,264 @@ class FileTest
         }
     }
 
+    void testSeekIntoInterleavedFile()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        uint64_t startA;
+
+        // two files growing a block at a time end up with interleaved blocks
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            knoxcrypt::File entryA(io, "a.txt");
+            knoxcrypt::File entryB(io, "b.txt");
+            std::vector<char> chunk(4000);
+            for (int c = 0; c < 20; ++c) {
+                std::fill(chunk.begin(), chunk.end(), char('a' + c));
+                entryA.write(&chunk.front(), chunk.size());
+                std::fill(chunk.begin(), chunk.end(), 'z');
+                entryB.write(&chunk.front(), chunk.size());
+            }
+            entryA.flush();
+            entryB.flush();
+            startA = entryA.getStartVolumeBlockIndex();
+        }
+
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        knoxcrypt::File entry(io, "a.txt", startA,
+                              knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        ASSERT_EQUAL(80000, entry.fileSize(), "FileTest::testSeekIntoInterleavedFile size");
+        bool correct = true;
+        for (std::streamoff off : {std::streamoff(0), std::streamoff(39999), std::streamoff(76001)}) {
+            entry.seek(off, std::ios_base::beg);
+            char c;
+            entry.read(&c, 1);
+            correct = correct && (c == char('a' + off / 4000));
+        }
+        entry.seek(-1, std::ios_base::end);
+        char last;
+        entry.read(&last, 1);
+        ASSERT_EQUAL(true, correct, "FileTest::testSeekIntoInterleavedFile seek from begin");
+        ASSERT_EQUAL('t', last, "FileTest::testSeekIntoInterleavedFile seek from end");
+    }
+
+    void testReadingRunsOfBlocks(unsigned int const version)
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, version);
+        std::string const label(version == knoxcrypt::detail::LATEST_VERSION ? " (latest)" : " (v22)");
+        std::string testData;
+        uint64_t startA;
+
+        // a file made up of two runs of blocks with another file in between
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath, version));
+            knoxcrypt::File entryA(io, "a.txt");
+            knoxcrypt::File entryB(io, "b.txt");
+            for (int c = 0; c < 2; ++c) {
+                std::string const chunk(createLargeStringToWrite(std::string(1, char('a' + c)) + "bcdefg"));
+                entryA.write(chunk.c_str(), chunk.length());
+                entryB.write(chunk.c_str(), 5000);
+                testData.append(chunk);
+            }
+            entryA.flush();
+            entryB.flush();
+            startA = entryA.getStartVolumeBlockIndex();
+        }
+
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath, version));
+        knoxcrypt::File entry(io, "a.txt", startA,
+                              knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        std::vector<char> vec(testData.length());
+        ASSERT_EQUAL(std::streamsize(vec.size()), entry.read(&vec.front(), vec.size()),
+                     "FileTest::testReadingRunsOfBlocks count" + label);
+        ASSERT_EQUAL(true, testData == std::string(vec.begin(), vec.end()),
+                     "FileTest::testReadingRunsOfBlocks content" + label);
+
+        // small reads go block by block
+        entry.seek(5, std::ios_base::beg);
+        std::string small;
+        char buf[1000];
+        std::streamsize count;
+        while ((count = entry.read(buf, sizeof(buf))) > 0) {
+            small.append(buf, count);
+        }
+        ASSERT_EQUAL(true, testData.substr(5) == small, "FileTest::testReadingRunsOfBlocks small reads" + label);
+    }
+
+    void testReadThenFlushLeavesContents()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        std::string const testData(createLargeStringToWrite());
+        uint64_t startBlock;
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(testData.c_str(), testData.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // read bytes go straight to the caller and are never written back
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            knoxcrypt::File entry(io, "test.txt", startBlock,
+                                  knoxcrypt::OpenDisposition::buildOverwriteDisposition());
+            char buf[100];
+            entry.read(buf, sizeof(buf));
+            ASSERT_EQUAL(testData.substr(0, sizeof(buf)), std::string(buf, sizeof(buf)),
+                         "FileTest::testReadThenFlushLeavesContents read");
+            entry.flush();
+        }
+
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        knoxcrypt::File entry(io, "test.txt", startBlock,
+                              knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        std::vector<char> vec(testData.length());
+        entry.read(&vec.front(), vec.size());
+        ASSERT_EQUAL(true, testData == std::string(vec.begin(), vec.end()),
+                     "FileTest::testReadThenFlushLeavesContents content");
+    }
+
+    void testOverwriteAcrossBlocksKeepsBlockCount()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+
+        uint64_t blocks;
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            knoxcrypt::File entry(io, "test.txt");
+            std::string testData(createLargeStringToWrite());
+            entry.write(testData.c_str(), BIG_SIZE);
+            entry.flush();
+            blocks = entry.blockCount();
+        }
+
+        // an overwrite spanning several blocks should reuse the file's
+        // existing blocks rather than append new ones
+        int const seekPos = 100;
+        std::string const testData(createLargeStringToWrite("goodbye...!!"));
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            knoxcrypt::File entry(io, "test.txt", 1,
+                                  knoxcrypt::OpenDisposition::buildOverwriteDisposition());
+            entry.seek(seekPos);
+            entry.write(testData.c_str(), testData.length());
+            entry.flush();
+            ASSERT_EQUAL(BIG_SIZE, entry.fileSize(), "FileTest::testOverwriteAcrossBlocksKeepsBlockCount size");
+            ASSERT_EQUAL(blocks, entry.blockCount(), "FileTest::testOverwriteAcrossBlocksKeepsBlockCount blocks");
+        }
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            knoxcrypt::File entry(io, "test.txt", 1,
+                                  knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            std::vector<uint8_t> vec(testData.length());
+            entry.seek(seekPos);
+            entry.read((char*)&vec.front(), testData.length());
+            std::string const recovered(vec.begin(), vec.end());
+            ASSERT_EQUAL(testData, recovered, "FileTest::testOverwriteAcrossBlocksKeepsBlockCount content");
+        }
+    }
+
+    void testSeekToExactBlockMultiple()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+
+        // bytes that differ from block to block so a misplaced seek shows
+        std::string testData;
+        for (int i = 0; i < BIG_SIZE; ++i) {
+            testData.push_back(char('a' + (i / 7) % 26));
+        }
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(testData.c_str(), BIG_SIZE);
+            entry.flush();
+        }
+
+        long const space = knoxcrypt::detail::blockWriteSpace(io);
+        knoxcrypt::File entry(io, "test.txt", 1,
+                              knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        for (long const off : {space, space * 2, space * 5}) {
+            entry.seek(off);
+            std::vector<uint8_t> vec(20);
+            entry.read((char*)&vec.front(), vec.size());
+            std::string const recovered(vec.begin(), vec.end());
+            ASSERT_EQUAL(testData.substr(off, vec.size()), recovered,
+                         "FileTest::testSeekToExactBlockMultiple");
+        }
+    }
+
+    void testGrowingBlockByBlockReusesStream()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        long const space = knoxcrypt::detail::blockWriteSpace(io);
+
+        std::string testData;
+        for (int i = 0; i < BIG_SIZE; ++i) {
+            testData.push_back(char('a' + (i / 11) % 26));
+        }
+
+        // each write starts a new block; the image stream and the extent
+        // map's buffers are kept from one block to the next
+        knoxcrypt::SharedImageStream stream;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            for (long off = 0; off < BIG_SIZE; off += space) {
+                long const n = std::min(space, long(BIG_SIZE) - off);
+                entry.write(testData.c_str() + off, n);
+                if (!stream) {
+                    stream = entry.getStream();
+                }
+                ASSERT_EQUAL(true, stream == entry.getStream() && stream->is_open(),
+                             "FileTest::testGrowingBlockByBlockReusesStream stream");
+            }
+            entry.flush();
+        }
+
+        knoxcrypt::File entry(io, "test.txt", 1,
+                              knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        std::vector<uint8_t> vec(BIG_SIZE);
+        entry.read((char*)&vec.front(), BIG_SIZE);
+        std::string const recovered(vec.begin(), vec.end());
+        ASSERT_EQUAL(testData, recovered, "FileTest::testGrowingBlockByBlockReusesStream content");
+    }
+
+    void testTruncateUpdatesSizeAndBlockCount()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        long const space = knoxcrypt::detail::blockWriteSpace(io);
+
+        knoxcrypt::File entry(io, "test.txt");
+        std::string testData(createLargeStringToWrite());
+        entry.write(testData.c_str(), BIG_SIZE);
+        entry.flush();
+
+        entry.truncate(space * 3 + 10);
+        ASSERT_EQUAL(uint64_t(space * 3 + 10), entry.fileSize(),
+                     "FileTest::testTruncateUpdatesSizeAndBlockCount size");
+        ASSERT_EQUAL(uint64_t(4), entry.blockCount(),
+                     "FileTest::testTruncateUpdatesSizeAndBlockCount blocks");
+
+        entry.truncate(space * 2);
+        ASSERT_EQUAL(uint64_t(space * 2), entry.fileSize(),
+                     "FileTest::testTruncateUpdatesSizeAndBlockCount multiple size");
+        ASSERT_EQUAL(uint64_t(2), entry.blockCount(),
+                     "FileTest::testTruncateUpdatesSizeAndBlockCount multiple blocks");
+
+        entry.truncate(10);
+        ASSERT_EQUAL(uint64_t(10), entry.fileSize(),
+                     "FileTest::testTruncateUpdatesSizeAndBlockCount small size");
+        ASSERT_EQUAL(uint64_t(1), entry.blockCount(),
+                     "FileTest::testTruncateUpdatesSizeAndBlockCount small blocks");
+
+        // a reopened file agrees
+        knoxcrypt::File reopened(io, "test.txt", 1,
+                                 knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        ASSERT_EQUAL(uint64_t(10), reopened.fileSize(),
+                     "FileTest::testTruncateUpdatesSizeAndBlockCount reopened");
+    }
+
     void testEdgeCaseEndOfBlockOverWrite()
     {
         boost::filesystem::path testPath = buildImage(m_uniquePath);
@@ -827,4 +1131,126 @@ class FileTest
             ASSERT_EQUAL(recovered, testData, "FileTest:: testEdgeCaseEndOfBlockAppend() content");
         }
     }
+
+    void testExtentMapRecordsRuns()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        std::string testData(createLargeStringToWrite());
+        uint64_t startBlock;
+        uint64_t allocatedBefore;
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            allocatedBefore = knoxcrypt::VolumeBitmap::get(io)->getNumberOfAllocatedBlocks();
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(testData.c_str(), 100);
+            startBlock = entry.getStartVolumeBlockIndex();
+
+            // a file of a single block refers to itself
+            knoxcrypt::FileBlock first(io, startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            ASSERT_EQUAL(startBlock, first.getNextIndex(), "FileTest::testExtentMapRecordsRuns single block");
+
+            entry.write(testData.c_str() + 100, testData.length() - 100);
+            entry.flush();
+        }
+
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+
+            // the blocks were allocated in one run so the map holds one extent
+            knoxcrypt::FileBlock first(io, startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            knoxcrypt::FileBlock map(io, first.getNextIndex(), knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            ASSERT_EQUAL(knoxcrypt::detail::EXTENT_BYTES, map.getDataBytesWritten(),
+                         "FileTest::testExtentMapRecordsRuns one extent");
+
+            knoxcrypt::File entry(io, "test.txt", startBlock,
+                                  knoxcrypt::OpenDisposition::buildAppendDisposition());
+            ASSERT_EQUAL(testData.length(), entry.fileSize(), "FileTest::testExtentMapRecordsRuns size");
+            std::vector<char> vec(testData.length());
+            entry.seek(0);
+            entry.read(&vec.front(), vec.size());
+            ASSERT_EQUAL(testData, std::string(vec.begin(), vec.end()), "FileTest::testExtentMapRecordsRuns content");
+
+            // unlinking releases the data blocks and the map block
+            entry.unlink();
+            ASSERT_EQUAL(allocatedBefore, knoxcrypt::VolumeBitmap::get(io)->getNumberOfAllocatedBlocks(),
+                         "FileTest::testExtentMapRecordsRuns unlink");
+        }
+    }
+
+    void testCorruptExtentMapThrows()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        std::string testData(createLargeStringToWrite());
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            entry.write(testData.c_str(), testData.length());
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        // an extent running past the end of the image
+        {
+            knoxcrypt::FileBlock first(io, startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+            knoxcrypt::FileBlock map(io, first.getNextIndex(), knoxcrypt::OpenDisposition::buildOverwriteDisposition());
+            uint8_t bytes[knoxcrypt::detail::EXTENT_BYTES];
+            knoxcrypt::detail::convertExtentToInt16Array(knoxcrypt::BlockExtent{io->blocks - 2, 5}, bytes);
+            (void)map.write((char*)bytes, knoxcrypt::detail::EXTENT_BYTES);
+            map.getStream()->flush();
+        }
+
+        bool caught = false;
+        try {
+            knoxcrypt::File entry(io, "test.txt", startBlock,
+                                  knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        } catch (std::runtime_error const &) {
+            caught = true;
+        }
+        ASSERT_EQUAL(true, caught, "FileTest::testCorruptExtentMapThrows");
+    }
+
+    void testExtentMapSpillsAcrossMapBlocks()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        auto bitmap(knoxcrypt::VolumeBitmap::get(io));
+
+        // leave only every other block free so that each file block is an extent
+        for (uint64_t block = 2; block < 1024; block += 2) {
+            bitmap->setBlockInUse(block);
+        }
+        uint64_t const allocatedBefore = bitmap->getNumberOfAllocatedBlocks();
+        uint64_t const blockSpace = knoxcrypt::detail::blockWriteSpace(io);
+        uint64_t const blocks = knoxcrypt::detail::extentsPerMapBlock(io) + 40;
+        std::string testData(blocks * blockSpace, 'k');
+        for (uint64_t i = 0; i < blocks; ++i) {
+            testData[i * blockSpace] = char('a' + i % 26);
+        }
+
+        uint64_t startBlock;
+        {
+            knoxcrypt::File entry(io, "test.txt");
+            for (uint64_t i = 0; i < blocks; ++i) {
+                entry.write(testData.c_str() + i * blockSpace, blockSpace);
+            }
+            entry.flush();
+            startBlock = entry.getStartVolumeBlockIndex();
+        }
+
+        knoxcrypt::File entry(io, "test.txt", startBlock,
+                              knoxcrypt::OpenDisposition::buildOverwriteDisposition());
+        ASSERT_EQUAL(testData.length(), entry.fileSize(), "FileTest::testExtentMapSpillsAcrossMapBlocks size");
+        std::vector<char> vec(testData.length());
+        entry.read(&vec.front(), vec.size());
+        ASSERT_EQUAL(true, testData == std::string(vec.begin(), vec.end()),
+                     "FileTest::testExtentMapSpillsAcrossMapBlocks content");
+
+        // shrinking back to a single block drops the map altogether
+        entry.truncate(10);
+        knoxcrypt::FileBlock first(io, startBlock, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
+        ASSERT_EQUAL(startBlock, first.getNextIndex(), "FileTest::testExtentMapSpillsAcrossMapBlocks truncate");
+        ASSERT_EQUAL(allocatedBefore + 1, bitmap->getNumberOfAllocatedBlocks(),
+                     "FileTest::testExtentMapSpillsAcrossMapBlocks blocks released");
+    }
 };
@@ -38,6 +38,10 @@
 #include <boost/filesystem/operations.hpp>
 
 #include <cassert>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
 
 using namespace simpletest;
 
@@ -51,6 +55,9 @@ class MakeKnoxCryptTest
         firstBlockIsReportedAsBeingFree();
         blocksCanBeSetAndCleared();
         testThatRootFolderContainsZeroEntries();
+        versionIsReadBackFromHeader();
+        blockDataIsAlignedToBlockSize();
+        blocksWrittenInRunsMatch();
     }
 
     ~MakeKnoxCryptTest()
@@ -129,18 +136,83 @@ class MakeKnoxCryptTest
     void testThatRootFolderContainsZeroEntries()
     {
         boost::filesystem::path testPath = buildImage(m_uniquePath);
-        uint64_t blocks(2048);
         // open a stream and read the first byte which signifies number of entries
         knoxcrypt::SharedCoreIO io(createTestIO(testPath));
-        uint64_t offset = knoxcrypt::detail::getOffsetOfFileBlock(io->blockSize, 0, blocks);
+        uint64_t offset = knoxcrypt::detail::getOffsetOfFileBlockData(io, 0);
         knoxcrypt::ContainerImageStream is(io, std::ios::in | std::ios::out | std::ios::binary);
-        is.seekg(offset + knoxcrypt::detail::FILE_BLOCK_META);
+        is.seekg(offset);
         uint8_t bytes[8];
         (void)is.read((char*)bytes, 8);
         uint64_t const count = knoxcrypt::detail::convertInt8ArrayToInt64(bytes);
         ASSERT_EQUAL(count, 0, "testThatRootFolderContainsZeroEntries");
     }
 
+    void versionIsReadBackFromHeader()
+    {
+        for (unsigned int version : {knoxcrypt::detail::VERSION_BLOCK_SIZE,
+                                     knoxcrypt::detail::VERSION_SUPERBLOCK,
+                                     knoxcrypt::detail::VERSION_EXTENT_MAP,
+                                     knoxcrypt::detail::VERSION_META_TABLE,
+                                     knoxcrypt::detail::VERSION_ENTRY_STATS}) {
+            boost::filesystem::path testPath = m_uniquePath / boost::filesystem::unique_path();
+            {
+                knoxcrypt::SharedCoreIO io(createTestIO(testPath, version));
+                knoxcrypt::MakeKnoxCrypt kc(io, true);
+                kc.buildImage();
+            }
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            io->version = 0;
+            knoxcrypt::detail::readImageIVAndRounds(io);
+            ASSERT_EQUAL(version, io->version, "MakeKnoxCryptTest::versionIsReadBackFromHeader");
+        }
+    }
+
+    void blockDataIsAlignedToBlockSize()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath, knoxcrypt::detail::VERSION_META_TABLE);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath, knoxcrypt::detail::VERSION_META_TABLE));
+
+        // blocks hold a whole block's worth of data, starting on a block boundary
+        ASSERT_EQUAL(io->blockSize, knoxcrypt::detail::blockWriteSpace(io),
+                     "MakeKnoxCryptTest::blockDataIsAlignedToBlockSize write space");
+        ASSERT_EQUAL(0, knoxcrypt::detail::getOffsetOfFileBlockData(io, 5) % io->blockSize,
+                     "MakeKnoxCryptTest::blockDataIsAlignedToBlockSize aligned");
+
+        // the metadata table is written out in full, with every block empty
+        knoxcrypt::ContainerImageStream is(io, std::ios::in | std::ios::binary);
+        ASSERT_EQUAL(uint64_t(0), uint64_t(knoxcrypt::detail::getNumberOfDataBytesWrittenToFileBlockN(is, io, 2047)),
+                     "MakeKnoxCryptTest::blockDataIsAlignedToBlockSize empty");
+        ASSERT_EQUAL(uint64_t(2047), knoxcrypt::detail::getIndexOfNextFileBlockFromFileBlockN(is, io, 2047),
+                     "MakeKnoxCryptTest::blockDataIsAlignedToBlockSize next");
+        is.close();
+
+        // the image extends at least as far as the start of the block data
+        ASSERT_EQUAL(true, boost::filesystem::file_size(testPath) >= knoxcrypt::detail::getOffsetOfBlockDataArea(io),
+                     "MakeKnoxCryptTest::blockDataIsAlignedToBlockSize size");
+    }
+
+    void blocksWrittenInRunsMatch()
+    {
+        for (unsigned int version : {knoxcrypt::detail::VERSION_EXTENT_MAP,
+                                     knoxcrypt::detail::VERSION_META_TABLE}) {
+            std::vector<std::string> images;
+            for (unsigned int depth : {0u, 4u}) {
+                boost::filesystem::path testPath = m_uniquePath / boost::filesystem::unique_path();
+                {
+                    knoxcrypt::SharedCoreIO io(createTestIO(testPath, version));
+                    io->ioQueueDepth = depth;
+                    knoxcrypt::MakeKnoxCrypt kc(io);
+                    kc.buildImage();
+                }
+                std::ifstream in(testPath.string().c_str(), std::ios::binary);
+                images.push_back(std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()));
+            }
+            ASSERT_EQUAL(true, !images[0].empty() && images[0] == images[1],
+                         version == knoxcrypt::detail::VERSION_META_TABLE ? "MakeKnoxCryptTest::blocksWrittenInRunsMatch (latest)"
+                                                                          : "MakeKnoxCryptTest::blocksWrittenInRunsMatch (v22)");
+        }
+    }
+
     boost::filesystem::path m_uniquePath;
 
 };
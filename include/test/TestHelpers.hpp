@@ -50,12 +50,15 @@ int testFailures = 0;
 int passedPoints = 0;
 std::vector<std::string> failingTestPoints;
 
-knoxcrypt::SharedCoreIO createTestIO(boost::filesystem::path const &testPath)
+knoxcrypt::SharedCoreIO createTestIO(boost::filesystem::path const &testPath,
+                                     unsigned int const version = knoxcrypt::detail::LATEST_VERSION,
+                                     uint64_t const blocks = 2048)
 {
     knoxcrypt::SharedCoreIO io = std::make_shared<knoxcrypt::CoreIO>();
     io->path = testPath.string();
-    io->blocks = 2048;
-    io->freeBlocks = 2048;
+    io->version = version;
+    io->blocks = blocks;
+    io->freeBlocks = blocks;
     io->encProps.password = "abcd1234";
     io->encProps.iv = uint64_t(3081342484970028645);
     io->encProps.iv2 = uint64_t(3081342484970028645);
@@ -70,11 +73,12 @@ knoxcrypt::SharedCoreIO createTestIO(boost::filesystem::path const &testPath)
     return io;
 }
 
-inline boost::filesystem::path buildImage(boost::filesystem::path const &path)
+inline boost::filesystem::path buildImage(boost::filesystem::path const &path,
+                                          unsigned int const version = knoxcrypt::detail::LATEST_VERSION)
 {
     std::string testImage(boost::filesystem::unique_path().string());
     boost::filesystem::path testPath = path / testImage;
-    knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+    knoxcrypt::SharedCoreIO io(createTestIO(testPath, version));
     bool const sparse = true; // quicker testing with sparse images
     knoxcrypt::MakeKnoxCrypt kc(io, sparse);
     kc.buildImage();
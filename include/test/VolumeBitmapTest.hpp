@@ -0,0 +1,528 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/CompoundFolder.hpp"
+#include "knoxcrypt/CoreIO.hpp"
+#include "knoxcrypt/FileBlockBuilder.hpp"
+#include "knoxcrypt/OpenDisposition.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+#include "test/SimpleTest.hpp"
+#include "test/TestHelpers.hpp"
+#include "utility/MakeKnoxCrypt.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <random>
+#include <vector>
+
+using namespace simpletest;
+
+class VolumeBitmapTest
+{
+  public:
+    VolumeBitmapTest() : m_uniquePath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(m_uniquePath);
+        blocksCanBeSetAndCleared();
+        changesOnlyWrittenOnSync();
+        bitmapSharedBetweenIOs();
+        freeExtentsAreCollectedAsRuns();
+        blockCacheServesBlocksFromExtents();
+        summaryRestoredAfterCleanUnmount();
+        bitmapRescannedAfterUncleanUnmount();
+        readOnlyMountLeavesImageClean();
+        versionTwentyImagesHaveNoSummary();
+        summaryIndexFindsNextSetBit();
+        fullPagesAreSkipped();
+        freeBlocksNearSpanPagesAndWrap();
+        bitmapKernelsMatchBitwiseScan();
+        bitmapKernelsOnFullAndFreeBitmaps();
+        bitmapKernelsFindFreeBitInLastPartialWord();
+    }
+
+    ~VolumeBitmapTest()
+    {
+        boost::filesystem::remove_all(m_uniquePath);
+    }
+
+  private:
+
+    /// bitmap lengths either side of the 8 byte words and 32 byte runs
+    /// the kernels work in, so that every tail path is taken
+    static std::vector<uint64_t> awkwardLengths()
+    {
+        return {1, 7, 8, 9, 31, 32, 33, 39, 63, 64, 65, 100, 1000};
+    }
+
+    /// the free blocks of a bitmap, found a bit at a time
+    static std::vector<uint64_t> freeBlocks(std::vector<uint8_t> const &bitmap)
+    {
+        std::vector<uint64_t> blocks;
+        for (uint64_t bit = 0; bit < bitmap.size() * 8; ++bit) {
+            uint8_t byte = bitmap[bit / 8];
+            if (!knoxcrypt::detail::isBitSetInByte(byte, bit % 8)) {
+                blocks.push_back(bit);
+            }
+        }
+        return blocks;
+    }
+
+    /// checks every kernel against freeBlocks
+    static bool kernelsAgree(std::vector<uint8_t> const &bitmap)
+    {
+        uint64_t const bytes = bitmap.size();
+        uint64_t const blocks = bytes * 8;
+        auto const expected(freeBlocks(bitmap));
+        if (knoxcrypt::detail::countAllocatedBlocksInBitmap(&bitmap.front(), bytes) != blocks - expected.size()) {
+            return false;
+        }
+        auto const next(knoxcrypt::detail::findNextAvailableBlockInBitmap(&bitmap.front(), bytes, blocks));
+        if (expected.empty() ? bool(next) : (!next || *next != expected.front())) {
+            return false;
+        }
+        for (uint64_t n : {uint64_t(1), uint64_t(3), uint64_t(expected.size()), uint64_t(expected.size() + 5)}) {
+            auto const found(knoxcrypt::detail::findNAvailableBlocksInBitmap(&bitmap.front(), bytes, n));
+            std::vector<uint64_t> const wanted(expected.begin(), expected.begin() + std::min(n, uint64_t(expected.size())));
+            if (found != wanted) {
+                return false;
+            }
+        }
+
+        // a run is only skipped if all of its blocks are allocated
+        uint64_t const skipped = knoxcrypt::detail::skipFullBitmapBytes(&bitmap.front(), 0, bytes);
+        return skipped % 32 == 0 && skipped <= bytes &&
+               (expected.empty() || expected.front() >= skipped * 8) &&
+               (skipped + 32 > bytes || skipped * 8 + 256 > expected.front());
+    }
+
+    void bitmapKernelsMatchBitwiseScan()
+    {
+        std::mt19937_64 rng(7);
+        bool agree = true;
+        for (uint64_t const bytes : awkwardLengths()) {
+            for (int fill = 0; fill < 4; ++fill) {
+                // mostly allocated so that whole runs get skipped
+                std::vector<uint8_t> bitmap(bytes);
+                for (auto & byte : bitmap) {
+                    byte = static_cast<uint8_t>(rng() | (fill > 0 ? rng() : 0) | (fill > 1 ? rng() : 0));
+                    if (fill == 3 && rng() % 16) {
+                        byte = 0xFF;
+                    }
+                }
+                agree = agree && kernelsAgree(bitmap);
+            }
+        }
+        ASSERT_EQUAL(true, agree, "VolumeBitmapTest::bitmapKernelsMatchBitwiseScan");
+    }
+
+    void bitmapKernelsOnFullAndFreeBitmaps()
+    {
+        for (uint64_t const bytes : awkwardLengths()) {
+            std::vector<uint8_t> const full(bytes, 0xFF);
+            ASSERT_EQUAL(bytes * 8, knoxcrypt::detail::countAllocatedBlocksInBitmap(&full.front(), bytes),
+                         "VolumeBitmapTest::bitmapKernelsOnFullAndFreeBitmaps full count");
+            ASSERT_EQUAL(false, bool(knoxcrypt::detail::findNextAvailableBlockInBitmap(&full.front(), bytes, bytes * 8)),
+                         "VolumeBitmapTest::bitmapKernelsOnFullAndFreeBitmaps full next");
+            ASSERT_EQUAL(true, knoxcrypt::detail::findNAvailableBlocksInBitmap(&full.front(), bytes, 4).empty(),
+                         "VolumeBitmapTest::bitmapKernelsOnFullAndFreeBitmaps full n");
+            ASSERT_EQUAL(bytes - bytes % 32, knoxcrypt::detail::skipFullBitmapBytes(&full.front(), 0, bytes),
+                         "VolumeBitmapTest::bitmapKernelsOnFullAndFreeBitmaps full skip");
+
+            std::vector<uint8_t> const free(bytes, 0);
+            ASSERT_EQUAL(uint64_t(0), knoxcrypt::detail::countAllocatedBlocksInBitmap(&free.front(), bytes),
+                         "VolumeBitmapTest::bitmapKernelsOnFullAndFreeBitmaps free count");
+            ASSERT_EQUAL(uint64_t(0), *knoxcrypt::detail::findNextAvailableBlockInBitmap(&free.front(), bytes, bytes * 8),
+                         "VolumeBitmapTest::bitmapKernelsOnFullAndFreeBitmaps free next");
+            auto const all(knoxcrypt::detail::findNAvailableBlocksInBitmap(&free.front(), bytes, bytes * 8));
+            ASSERT_EQUAL(true, all.size() == bytes * 8 && all.back() == bytes * 8 - 1,
+                         "VolumeBitmapTest::bitmapKernelsOnFullAndFreeBitmaps free n");
+            ASSERT_EQUAL(uint64_t(0), knoxcrypt::detail::skipFullBitmapBytes(&free.front(), 0, bytes),
+                         "VolumeBitmapTest::bitmapKernelsOnFullAndFreeBitmaps free skip");
+        }
+    }
+
+    void bitmapKernelsFindFreeBitInLastPartialWord()
+    {
+        for (uint64_t const bytes : {uint64_t(9), uint64_t(15), uint64_t(33), uint64_t(39), uint64_t(71), uint64_t(1001)}) {
+            for (int bit = 0; bit < 8; ++bit) {
+                // only the final byte, past the last whole word, has a free block
+                std::vector<uint8_t> bitmap(bytes, 0xFF);
+                knoxcrypt::detail::setBitInByte(bitmap.back(), bit, false);
+                uint64_t const block = (bytes - 1) * 8 + bit;
+
+                ASSERT_EQUAL(bytes * 8 - 1, knoxcrypt::detail::countAllocatedBlocksInBitmap(&bitmap.front(), bytes),
+                             "VolumeBitmapTest::bitmapKernelsFindFreeBitInLastPartialWord count");
+                auto const next(knoxcrypt::detail::findNextAvailableBlockInBitmap(&bitmap.front(), bytes, bytes * 8));
+                ASSERT_EQUAL(true, next && *next == block,
+                             "VolumeBitmapTest::bitmapKernelsFindFreeBitInLastPartialWord next");
+                auto const found(knoxcrypt::detail::findNAvailableBlocksInBitmap(&bitmap.front(), bytes, 2));
+                ASSERT_EQUAL(true, found.size() == 1 && found[0] == block,
+                             "VolumeBitmapTest::bitmapKernelsFindFreeBitInLastPartialWord n");
+
+                // a block past the end of the volume isn't available
+                ASSERT_EQUAL(false, bool(knoxcrypt::detail::findNextAvailableBlockInBitmap(&bitmap.front(), bytes, block)),
+                             "VolumeBitmapTest::bitmapKernelsFindFreeBitInLastPartialWord beyond volume");
+            }
+        }
+    }
+
+    void blocksCanBeSetAndCleared()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        auto bitmap(knoxcrypt::VolumeBitmap::get(io));
+
+        // block 0 is taken by the root folder
+        ASSERT_EQUAL(true, bitmap->isBlockInUse(0), "VolumeBitmapTest::blocksCanBeSetAndCleared root in use");
+        ASSERT_EQUAL(1, *bitmap->getNextAvailableBlock(), "VolumeBitmapTest::blocksCanBeSetAndCleared next A");
+
+        bitmap->setBlockInUse(1);
+        bitmap->setBlockInUse(2);
+        ASSERT_EQUAL(3, *bitmap->getNextAvailableBlock(), "VolumeBitmapTest::blocksCanBeSetAndCleared next B");
+        ASSERT_EQUAL(3, bitmap->getNumberOfAllocatedBlocks(), "VolumeBitmapTest::blocksCanBeSetAndCleared count");
+
+        bitmap->setBlockInUse(1, false);
+        ASSERT_EQUAL(1, *bitmap->getNextAvailableBlock(), "VolumeBitmapTest::blocksCanBeSetAndCleared next C");
+        auto available(bitmap->getNAvailableBlocks(3));
+        ASSERT_EQUAL(3, available.size(), "VolumeBitmapTest::blocksCanBeSetAndCleared n available size");
+        ASSERT_EQUAL(1, available[0], "VolumeBitmapTest::blocksCanBeSetAndCleared n available A");
+        ASSERT_EQUAL(3, available[1], "VolumeBitmapTest::blocksCanBeSetAndCleared n available B");
+        ASSERT_EQUAL(4, available[2], "VolumeBitmapTest::blocksCanBeSetAndCleared n available C");
+    }
+
+    void changesOnlyWrittenOnSync()
+    {
+        long const blocks = 2048;
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        auto bitmap(knoxcrypt::VolumeBitmap::get(io));
+
+        // one block on the first page, one on a later page
+        bitmap->setBlockInUse(5);
+        bitmap->setBlockInUse(blocks - 1);
+        {
+            knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+            ASSERT_EQUAL(false, knoxcrypt::detail::isBlockInUse(5, blocks, in),
+                         "VolumeBitmapTest::changesOnlyWrittenOnSync not yet written");
+        }
+
+        bitmap->sync();
+        {
+            knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+            ASSERT_EQUAL(true, knoxcrypt::detail::isBlockInUse(5, blocks, in),
+                         "VolumeBitmapTest::changesOnlyWrittenOnSync written A");
+            ASSERT_EQUAL(true, knoxcrypt::detail::isBlockInUse(blocks - 1, blocks, in),
+                         "VolumeBitmapTest::changesOnlyWrittenOnSync written B");
+            ASSERT_EQUAL(uint64_t(3), knoxcrypt::detail::getNumberOfAllocatedBlocks(in),
+                         "VolumeBitmapTest::changesOnlyWrittenOnSync allocated count");
+        }
+    }
+
+    void bitmapSharedBetweenIOs()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO ioA(createTestIO(testPath));
+        knoxcrypt::SharedCoreIO ioB(createTestIO(testPath));
+        knoxcrypt::VolumeBitmap::get(ioA)->setBlockInUse(1);
+        ASSERT_EQUAL(true, knoxcrypt::VolumeBitmap::get(ioB)->isBlockInUse(1),
+                     "VolumeBitmapTest::bitmapSharedBetweenIOs");
+    }
+
+    void freeExtentsAreCollectedAsRuns()
+    {
+        // blocks 0-2, 5 and 9-12 in use out of 16
+        std::vector<uint8_t> bitmap{0x27, 0x1E};
+        knoxcrypt::BlockExtents extents;
+        uint64_t cursor = knoxcrypt::detail::findFreeExtentsInBitmap(&bitmap.front(), bitmap.size(), 16,
+                                                                     0, 2, extents);
+        ASSERT_EQUAL(2, extents.size(), "VolumeBitmapTest::freeExtentsAreCollectedAsRuns first batch");
+        ASSERT_EQUAL(3, extents[0].start, "VolumeBitmapTest::freeExtentsAreCollectedAsRuns start A");
+        ASSERT_EQUAL(2, extents[0].length, "VolumeBitmapTest::freeExtentsAreCollectedAsRuns length A");
+        ASSERT_EQUAL(6, extents[1].start, "VolumeBitmapTest::freeExtentsAreCollectedAsRuns start B");
+        ASSERT_EQUAL(3, extents[1].length, "VolumeBitmapTest::freeExtentsAreCollectedAsRuns length B");
+        ASSERT_EQUAL(9, cursor, "VolumeBitmapTest::freeExtentsAreCollectedAsRuns cursor");
+
+        // carries on from the cursor up to the end of the bitmap
+        cursor = knoxcrypt::detail::findFreeExtentsInBitmap(&bitmap.front(), bitmap.size(), 16,
+                                                            cursor, 2, extents);
+        ASSERT_EQUAL(3, extents.size(), "VolumeBitmapTest::freeExtentsAreCollectedAsRuns second batch");
+        ASSERT_EQUAL(13, extents[2].start, "VolumeBitmapTest::freeExtentsAreCollectedAsRuns start C");
+        ASSERT_EQUAL(3, extents[2].length, "VolumeBitmapTest::freeExtentsAreCollectedAsRuns length C");
+        ASSERT_EQUAL(16, cursor, "VolumeBitmapTest::freeExtentsAreCollectedAsRuns end");
+    }
+
+    void blockCacheServesBlocksFromExtents()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        io->useBlockCache = true;
+        auto bitmap(knoxcrypt::VolumeBitmap::get(io));
+        bitmap->setBlockInUse(2);
+
+        // the builder caches [1,2) and [3,2048)
+        knoxcrypt::FileBlockBuilder builder(io);
+        knoxcrypt::SharedImageStream stream;
+        auto const disposition = knoxcrypt::OpenDisposition::buildAppendDisposition();
+        ASSERT_EQUAL(1, builder.buildWritableFileBlock(io, disposition, stream).getIndex(),
+                     "VolumeBitmapTest::blockCacheServesBlocksFromExtents A");
+
+        // a block allocated behind the cache's back is skipped over
+        bitmap->setBlockInUse(3);
+        ASSERT_EQUAL(4, builder.buildWritableFileBlock(io, disposition, stream).getIndex(),
+                     "VolumeBitmapTest::blockCacheServesBlocksFromExtents B");
+        ASSERT_EQUAL(5, builder.buildWritableFileBlock(io, disposition, stream).getIndex(),
+                     "VolumeBitmapTest::blockCacheServesBlocksFromExtents C");
+    }
+
+    // an io that doesn't hold on to the bitmap, for peeking at the superblock
+    knoxcrypt::SharedCoreIO createProbeIO(boost::filesystem::path const &testPath)
+    {
+        auto probe(std::make_shared<knoxcrypt::CoreIO>(*createTestIO(testPath)));
+        probe->volumeBitmap.reset();
+        return probe;
+    }
+
+    // reads the clean flag and free block count from the superblock
+    std::pair<bool, uint64_t> readSuperblockHeader(knoxcrypt::SharedCoreIO const &io)
+    {
+        knoxcrypt::ContainerImageStream in(io, std::ios::in | std::ios::binary);
+        (void)in.seekg(knoxcrypt::detail::superblockOffset(io->blocks));
+        uint8_t header[knoxcrypt::detail::SUPERBLOCK_HEADER_BYTES];
+        (void)in.read((char*)header, knoxcrypt::detail::SUPERBLOCK_HEADER_BYTES);
+        return std::make_pair(header[0] == 1, knoxcrypt::detail::convertInt8ArrayToInt64(header + 1));
+    }
+
+    void summaryRestoredAfterCleanUnmount()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO probe(createProbeIO(testPath));
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+            knoxcrypt::VolumeBitmap::get(io)->setBlockInUse(5);
+            knoxcrypt::VolumeBitmap::get(io)->sync();
+            ASSERT_EQUAL(false, readSuperblockHeader(probe).first,
+                         "VolumeBitmapTest::summaryRestoredAfterCleanUnmount mounted");
+        }
+        auto const header(readSuperblockHeader(probe));
+        ASSERT_EQUAL(true, header.first, "VolumeBitmapTest::summaryRestoredAfterCleanUnmount clean");
+        ASSERT_EQUAL(2046, header.second, "VolumeBitmapTest::summaryRestoredAfterCleanUnmount free");
+
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+
+        auto bitmap(knoxcrypt::VolumeBitmap::get(io));
+        ASSERT_EQUAL(2, bitmap->getNumberOfAllocatedBlocks(),
+                     "VolumeBitmapTest::summaryRestoredAfterCleanUnmount allocated");
+        ASSERT_EQUAL(true, bitmap->isBlockInUse(5), "VolumeBitmapTest::summaryRestoredAfterCleanUnmount in use");
+        ASSERT_EQUAL(1, *bitmap->getNextAvailableBlock(),
+                     "VolumeBitmapTest::summaryRestoredAfterCleanUnmount next");
+    }
+
+    void bitmapRescannedAfterUncleanUnmount()
+    {
+        long const blocks = 2048;
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO probe(createProbeIO(testPath));
+
+        // as if blocks were allocated but the summary never made it to disk
+        {
+            knoxcrypt::ContainerImageStream out(probe, std::ios::in | std::ios::out | std::ios::binary);
+            knoxcrypt::detail::setBlockToInUse(3, blocks, out);
+            knoxcrypt::detail::setBlockToInUse(4, blocks, out);
+            uint8_t header[knoxcrypt::detail::SUPERBLOCK_HEADER_BYTES];
+            knoxcrypt::detail::buildSuperblockHeader(blocks, false, blocks - 1, header);
+            (void)out.seekp(knoxcrypt::detail::superblockOffset(blocks));
+            (void)out.write((char*)header, knoxcrypt::detail::SUPERBLOCK_HEADER_BYTES);
+            out.flush();
+        }
+
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+        ASSERT_EQUAL(3, knoxcrypt::VolumeBitmap::get(io)->getNumberOfAllocatedBlocks(),
+                     "VolumeBitmapTest::bitmapRescannedAfterUncleanUnmount allocated");
+        ASSERT_EQUAL(uint64_t(blocks - 3), readSuperblockHeader(probe).second,
+                     "VolumeBitmapTest::bitmapRescannedAfterUncleanUnmount summary rebuilt");
+    }
+
+    void readOnlyMountLeavesImageClean()
+    {
+        boost::filesystem::path testPath = buildImage(m_uniquePath);
+        knoxcrypt::SharedCoreIO probe(createProbeIO(testPath));
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath));
+
+        // lookups alone don't mark the image as in use
+        auto bitmap(knoxcrypt::VolumeBitmap::get(io));
+        ASSERT_EQUAL(1, bitmap->getNumberOfAllocatedBlocks(),
+                     "VolumeBitmapTest::readOnlyMountLeavesImageClean allocated");
+        ASSERT_EQUAL(true, bitmap->isBlockInUse(0), "VolumeBitmapTest::readOnlyMountLeavesImageClean in use");
+        ASSERT_EQUAL(true, readSuperblockHeader(probe).first,
+                     "VolumeBitmapTest::readOnlyMountLeavesImageClean clean");
+
+        // the first change does
+        bitmap->setBlockInUse(7);
+        ASSERT_EQUAL(false, readSuperblockHeader(probe).first,
+                     "VolumeBitmapTest::readOnlyMountLeavesImageClean modified");
+    }
+
+    void versionTwentyImagesHaveNoSummary()
+    {
+        boost::filesystem::path testPath = m_uniquePath / boost::filesystem::unique_path();
+        unsigned int const version = knoxcrypt::detail::VERSION_BLOCK_SIZE;
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath, version));
+            knoxcrypt::MakeKnoxCrypt kc(io, true);
+            kc.buildImage();
+        }
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath, version));
+        ASSERT_EQUAL(0, knoxcrypt::detail::superblockBytes(io->version, io->blocks),
+                     "VolumeBitmapTest::versionTwentyImagesHaveNoSummary bytes");
+        ASSERT_EQUAL(1, knoxcrypt::VolumeBitmap::get(io)->getNumberOfAllocatedBlocks(),
+                     "VolumeBitmapTest::versionTwentyImagesHaveNoSummary allocated");
+
+        // folder data still round trips through the version 20 block layout
+        {
+            knoxcrypt::CompoundFolder root(io, uint64_t(0));
+            root.addFile("test.txt");
+        }
+        knoxcrypt::SharedCoreIO ioB(createTestIO(testPath, version));
+        knoxcrypt::CompoundFolder root(ioB, uint64_t(0));
+        ASSERT_EQUAL(true, bool(root.getEntryInfo("test.txt")),
+                     "VolumeBitmapTest::versionTwentyImagesHaveNoSummary root");
+    }
+
+    void summaryIndexFindsNextSetBit()
+    {
+        // 64 * 64 * 2 lower level bits
+        std::vector<uint64_t> lower(128, 0);
+        std::vector<uint64_t> upper(2, 0);
+        knoxcrypt::detail::updateSummaryBit(lower, upper, 5, true);
+        knoxcrypt::detail::updateSummaryBit(lower, upper, 7000, true);
+        uint64_t const bits = 8192;
+        ASSERT_EQUAL(5, knoxcrypt::detail::findNextSetBitInSummary(lower, upper, 0, bits),
+                     "VolumeBitmapTest::summaryIndexFindsNextSetBit A");
+        ASSERT_EQUAL(7000, knoxcrypt::detail::findNextSetBitInSummary(lower, upper, 6, bits),
+                     "VolumeBitmapTest::summaryIndexFindsNextSetBit B");
+        ASSERT_EQUAL(bits, knoxcrypt::detail::findNextSetBitInSummary(lower, upper, 7001, bits),
+                     "VolumeBitmapTest::summaryIndexFindsNextSetBit C");
+        knoxcrypt::detail::updateSummaryBit(lower, upper, 5, false);
+        ASSERT_EQUAL(0, upper[0], "VolumeBitmapTest::summaryIndexFindsNextSetBit D");
+        ASSERT_EQUAL(7000, knoxcrypt::detail::findNextSetBitInSummary(lower, upper, 0, bits),
+                     "VolumeBitmapTest::summaryIndexFindsNextSetBit E");
+    }
+
+    void fullPagesAreSkipped()
+    {
+        // four pages of bitmap
+        uint64_t const blocks = 4 * knoxcrypt::detail::BITMAP_PAGE_BLOCKS;
+        boost::filesystem::path testPath = m_uniquePath / boost::filesystem::unique_path();
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath, knoxcrypt::detail::LATEST_VERSION, blocks));
+            knoxcrypt::MakeKnoxCrypt kc(io, true);
+            kc.buildImage();
+        }
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath, knoxcrypt::detail::LATEST_VERSION, blocks));
+        auto bitmap(knoxcrypt::VolumeBitmap::get(io));
+        uint64_t const threePages = 3 * knoxcrypt::detail::BITMAP_PAGE_BLOCKS;
+        for (uint64_t block = 1; block < threePages; ++block) {
+            bitmap->setBlockInUse(block);
+        }
+        ASSERT_EQUAL(threePages, *bitmap->getNextAvailableBlock(), "VolumeBitmapTest::fullPagesAreSkipped A");
+
+        knoxcrypt::BlockExtents extents;
+        (void)bitmap->getFreeExtents(0, 4, extents);
+        ASSERT_EQUAL(1, extents.size(), "VolumeBitmapTest::fullPagesAreSkipped extents");
+        ASSERT_EQUAL(threePages, extents[0].start, "VolumeBitmapTest::fullPagesAreSkipped extent start");
+
+        auto const available(bitmap->getNAvailableBlocks(2));
+        ASSERT_EQUAL(2, available.size(), "VolumeBitmapTest::fullPagesAreSkipped available");
+        ASSERT_EQUAL(threePages + 1, available[1], "VolumeBitmapTest::fullPagesAreSkipped available block");
+        auto const near(bitmap->getFreeBlocksNear(10, 3));
+        ASSERT_EQUAL(1, near.size(), "VolumeBitmapTest::fullPagesAreSkipped near");
+        ASSERT_EQUAL(threePages, near[0].start, "VolumeBitmapTest::fullPagesAreSkipped near start");
+
+        bitmap->setBlockInUse(40000, false);
+        ASSERT_EQUAL(40000, *bitmap->getNextAvailableBlock(), "VolumeBitmapTest::fullPagesAreSkipped B");
+    }
+
+    void freeBlocksNearSpanPagesAndWrap()
+    {
+        // four pages of bitmap
+        uint64_t const blocks = 4 * knoxcrypt::detail::BITMAP_PAGE_BLOCKS;
+        boost::filesystem::path testPath = m_uniquePath / boost::filesystem::unique_path();
+        {
+            knoxcrypt::SharedCoreIO io(createTestIO(testPath, knoxcrypt::detail::LATEST_VERSION, blocks));
+            knoxcrypt::MakeKnoxCrypt kc(io, true);
+            kc.buildImage();
+        }
+        knoxcrypt::SharedCoreIO io(createTestIO(testPath, knoxcrypt::detail::LATEST_VERSION, blocks));
+        auto bitmap(knoxcrypt::VolumeBitmap::get(io));
+
+        // the first three pages are full apart from a short hole and a run
+        // that crosses from the second page in to the third
+        uint64_t const threePages = 3 * knoxcrypt::detail::BITMAP_PAGE_BLOCKS;
+        uint64_t const crossing = 2 * knoxcrypt::detail::BITMAP_PAGE_BLOCKS - 50;
+        for (uint64_t block = 0; block < threePages; ++block) {
+            bool const free = (block >= 1000 && block < 1010) || (block >= crossing && block < crossing + 100);
+            bitmap->setBlockInUse(block, !free);
+        }
+
+        auto extents(bitmap->getFreeBlocksNear(threePages + 10, 50));
+        ASSERT_EQUAL(1, extents.size(), "VolumeBitmapTest::freeBlocksNearSpanPagesAndWrap A");
+        ASSERT_EQUAL(threePages + 10, extents[0].start, "VolumeBitmapTest::freeBlocksNearSpanPagesAndWrap B");
+        ASSERT_EQUAL(50, extents[0].length, "VolumeBitmapTest::freeBlocksNearSpanPagesAndWrap C");
+
+        // with the last page full the search wraps round to the start and
+        // the run crossing the page boundary is found whole
+        for (uint64_t block = threePages; block < blocks; ++block) {
+            bitmap->setBlockInUse(block);
+        }
+        extents = bitmap->getFreeBlocksNear(threePages + 10, 100);
+        ASSERT_EQUAL(1, extents.size(), "VolumeBitmapTest::freeBlocksNearSpanPagesAndWrap D");
+        ASSERT_EQUAL(crossing, extents[0].start, "VolumeBitmapTest::freeBlocksNearSpanPagesAndWrap E");
+        ASSERT_EQUAL(100, extents[0].length, "VolumeBitmapTest::freeBlocksNearSpanPagesAndWrap F");
+
+        // no run is long enough so the runs are pieced together in order
+        extents = bitmap->getFreeBlocksNear(threePages + 10, 105);
+        ASSERT_EQUAL(2, extents.size(), "VolumeBitmapTest::freeBlocksNearSpanPagesAndWrap G");
+        ASSERT_EQUAL(1000, extents[0].start, "VolumeBitmapTest::freeBlocksNearSpanPagesAndWrap H");
+        ASSERT_EQUAL(10, extents[0].length, "VolumeBitmapTest::freeBlocksNearSpanPagesAndWrap I");
+        ASSERT_EQUAL(crossing, extents[1].start, "VolumeBitmapTest::freeBlocksNearSpanPagesAndWrap J");
+        ASSERT_EQUAL(95, extents[1].length, "VolumeBitmapTest::freeBlocksNearSpanPagesAndWrap K");
+
+        // and fewer blocks than required are found when the volume is short
+        extents = bitmap->getFreeBlocksNear(0, 200);
+        ASSERT_EQUAL(2, extents.size(), "VolumeBitmapTest::freeBlocksNearSpanPagesAndWrap L");
+        ASSERT_EQUAL(100, extents[1].length, "VolumeBitmapTest::freeBlocksNearSpanPagesAndWrap M");
+    }
+
+    boost::filesystem::path m_uniquePath;
+
+};
@@ -30,32 +30,22 @@
 #pragma once
 
 #include "utility/EventType.hpp"
-#include <boost/timer/progress_display.hpp>
 
-#include <memory>
+#include <iostream>
 
 namespace knoxcrypt
 {
 
-    void cipherCallback(EventType eventType, long const amount)
+    /// keystream is generated as and when offsets are touched, so key
+    /// generation is the only cipher set up worth reporting
+    void cipherCallback(EventType eventType)
     {
-        static std::shared_ptr<boost::timer::progress_display> pd;
         if(eventType == EventType::KeyGenBegin) {
             std::cout<<"Generating key...\n"<<std::endl;
         }
         if(eventType == EventType::KeyGenEnd) {
             std::cout<<"Key generated.\n"<<std::endl;
         }
-        if(eventType == EventType::BigCipherBuildBegin) {
-            std::cout<<"Building big xtea cipher stream buffer. Please wait..."<<std::endl;
-            pd = std::make_shared<boost::timer::progress_display>(amount);
-        }
-        if(eventType == EventType::BigCipherBuildEnd) {
-            std::cout<<"\nBuilt big xtea cipher stream buffer.\n"<<std::endl;
-        }
-        if(eventType == EventType::CipherBuildUpdate) {
-            ++(*pd);
-        }
     }
 
 }
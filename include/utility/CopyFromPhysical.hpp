@@ -73,7 +73,7 @@ namespace knoxcrypt
                 // create a stream to read resource from and a device to write to
                 std::ifstream in(fsPath.c_str(), std::ios_base::binary);
                 knoxcrypt::FileDevice device = theBfs.openFile(addPath, knoxcrypt::OpenDisposition::buildWriteOnlyDisposition());
-                boost::iostreams::copy(in, device);
+                boost::iostreams::copy(in, device, theBfs.getCopyBufferSize());
             }
         }
     }
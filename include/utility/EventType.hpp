@@ -34,9 +34,6 @@ namespace knoxcrypt
 {
     enum class EventType { KeyGenBegin,            // before key gen is started
                            KeyGenEnd,              // when key gen is finished
-                           BigCipherBuildBegin,    // before building big cipher
-                           BigCipherBuildEnd,      // when building finished
-                           CipherBuildUpdate,      // building progress notification
                            ImageBuildStart,        // start of image building process
                            ImageBuildEnd,          // end of image building process
                            ImageBuildUpdate,       // image building process
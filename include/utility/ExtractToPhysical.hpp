@@ -80,7 +80,7 @@ namespace knoxcrypt
                 knoxcrypt::FileDevice device = theBfs.openFile(srcPath, knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
                 device.seek(0, std::ios_base::beg);
                 std::ofstream out(dstPath.c_str(), std::ios_base::binary);
-                boost::iostreams::copy(device, out);
+                boost::iostreams::copy(device, out, theBfs.getCopyBufferSize());
             } else if(theBfs.folderExists(srcPath)) {
                 boost::filesystem::create_directory(dstPath);
                 FolderExtractionVisitor visitor(theBfs, srcPath, dstPath, callback);
@@ -93,7 +93,7 @@ namespace knoxcrypt
                 knoxcrypt::FileDevice device = m_theBfs.openFile(teaLoc.string(), knoxcrypt::OpenDisposition::buildReadOnlyDisposition());
                 device.seek(0, std::ios_base::beg);
                 std::ofstream out(fsLoc.string().c_str(), std::ios_base::binary);
-                boost::iostreams::copy(device, out);
+                boost::iostreams::copy(device, out, m_theBfs.getCopyBufferSize());
             }
 
             virtual void exitFolder(EntryInfo const &)
@@ -28,11 +28,15 @@
 
 #pragma once
 
+#include "knoxcrypt/BlockIOEngine.hpp"
 #include "knoxcrypt/ContainerImageStream.hpp"
 #include "knoxcrypt/CoreIO.hpp"
 #include "knoxcrypt/FileBlock.hpp"
 #include "knoxcrypt/FileBlockBuilder.hpp"
 #include "knoxcrypt/CompoundFolder.hpp"
+#include "knoxcrypt/DecryptedBlockCache.hpp"
+#include "knoxcrypt/MappedImage.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
 #include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
 #include "knoxcrypt/detail/DetailFileBlock.hpp"
 #include "utility/EventType.hpp"
@@ -41,6 +45,8 @@
 #include <boost/optional.hpp>
 #include <boost/signals2.hpp>
 
+#include <algorithm>
+#include <stdexcept>
 #include <string>
 #include <fstream>
 #include <vector>
@@ -105,13 +111,61 @@ namespace knoxcrypt
         {
 
             broadcastEvent(EventType::ImageBuildStart);
-            for (uint64_t i(0); i < io->blocks ; ++i) {
-                detail::writeBlock(io, out, i);
-                broadcastEvent(EventType::ImageBuildUpdate);
+            if (io->ioQueueDepth > 0) {
+                writeOutFileSpaceBytesInRuns(io, out);
+            } else if (detail::hasBlockMetaTable(io)) {
+                // out appends and the metadata is already in its table, so
+                // only the block data is written out
+                std::vector<char> const zeros(io->blockSize, 0);
+                for (uint64_t i(0); i < io->blocks ; ++i) {
+                    (void)out.write(&zeros.front(), zeros.size());
+                    broadcastEvent(EventType::ImageBuildUpdate);
+                }
+            } else {
+                for (uint64_t i(0); i < io->blocks ; ++i) {
+                    detail::writeBlock(io, out, i);
+                    broadcastEvent(EventType::ImageBuildUpdate);
+                }
             }
             broadcastEvent(EventType::ImageBuildEnd);
         }
 
+        /**
+         * @brief writes out the file blocks a run at a time through an I/O
+         * engine so that each run is encrypted by several threads at once
+         * @param io the core io (block size, block count and queue depth)
+         * @param out the image stream written to so far
+         */
+        void writeOutFileSpaceBytesInRuns(SharedCoreIO const &io, ContainerImageStream &out)
+        {
+            // the engine's own streams carry on from where out finished
+            out.flush();
+            BlockIOEngine engine(io, io->ioQueueDepth);
+
+            // every block is empty; before version 23 each is also led by
+            // its metadata, which has a next index of the block itself
+            uint64_t const runBlocks = std::max(uint64_t(1), uint64_t(4 * 1024 * 1024) / io->blockSize);
+            bool const withMeta = !detail::hasBlockMetaTable(io);
+            std::vector<char> run(runBlocks * io->blockSize, 0);
+            for (uint64_t first(0); first < io->blocks; first += runBlocks) {
+                uint64_t const blocks = std::min(runBlocks, io->blocks - first);
+                if (withMeta) {
+                    for (uint64_t b(0); b < blocks; ++b) {
+                        detail::convertUInt64ToInt8Array(first + b, (uint8_t*)&run[b * io->blockSize + 4]);
+                    }
+                }
+                uint64_t const offset = withMeta ? detail::getOffsetOfFileBlock(io, first)
+                                                 : detail::getOffsetOfFileBlockData(io, first);
+                BlockIOEngine::Batch const batch{{true, offset, &run.front(), blocks * io->blockSize}};
+                if (!engine.complete(engine.submit(batch))) {
+                    throw std::runtime_error("Failed to write out file blocks");
+                }
+                for (uint64_t b(0); b < blocks; ++b) {
+                    broadcastEvent(EventType::ImageBuildUpdate);
+                }
+            }
+        }
+
         void zeroOutBits(std::vector<uint8_t> &bitMapData)
         {
             uint8_t byte(0);
@@ -143,6 +197,52 @@ namespace knoxcrypt
             (void)out.write((char*)&bitMapData.front(), bytesRequired);
         }
 
+        /**
+         * @brief writes out the allocation superblock of a fresh image in
+         * which no block is in use yet
+         * @param blocks the number of blocks in the file system
+         * @param out the image stream
+         */
+        void createSuperblock(uint64_t const blocks, ContainerImageStream &out)
+        {
+            uint64_t const bitmapBytes = blocks / uint64_t(8);
+            std::vector<uint32_t> regionFree(detail::bitmapPageCount(blocks));
+            for (uint64_t region = 0; region < regionFree.size(); ++region) {
+                uint64_t const offset = region * detail::BITMAP_PAGE_BYTES;
+                regionFree[region] = uint32_t(std::min(detail::BITMAP_PAGE_BYTES, bitmapBytes - offset) * 8);
+            }
+            bool const clean = true;
+            auto const superblock(detail::buildSuperblock(blocks, clean, regionFree));
+            (void)out.write((char*)&superblock.front(), superblock.size());
+        }
+
+        /**
+         * @brief writes out the table holding the metadata of every block,
+         * padded so that block data begins on a block size boundary
+         * @param io the core io (block size and block count)
+         * @param out the image stream
+         */
+        void createBlockMetaTable(SharedCoreIO const &io, ContainerImageStream &out)
+        {
+            // every block starts out empty and with a next index of itself
+            uint64_t const batchBlocks = 4096;
+            std::vector<uint8_t> batch;
+            for (uint64_t block(0); block < io->blocks; ++block) {
+                uint8_t meta[detail::FILE_BLOCK_META] = {0};
+                detail::convertUInt64ToInt8Array(block, meta + 4);
+                batch.insert(batch.end(), meta, meta + detail::FILE_BLOCK_META);
+                if (batch.size() == batchBlocks * detail::FILE_BLOCK_META || block + 1 == io->blocks) {
+                    (void)out.write((char*)&batch.front(), batch.size());
+                    batch.clear();
+                }
+            }
+            uint64_t const tableEnd = detail::getOffsetOfFileBlock(io, io->blocks);
+            std::vector<uint8_t> padding(detail::getOffsetOfBlockDataArea(io) - tableEnd, 0);
+            if (!padding.empty()) {
+                (void)out.write((char*)&padding.front(), padding.size());
+            }
+        }
+
         /**
          * @brief build the file system image
          *
@@ -158,6 +258,9 @@ namespace knoxcrypt
          */
         void doBuildImage(SharedCoreIO const &io)
         {
+            DecryptedBlockCache::invalidate(io);
+            MappedImage::invalidate(io);
+
             //
             // write out initial IV and header.
             // Note, the header will store extra metainfo about other needed
@@ -229,12 +332,15 @@ namespace knoxcrypt
                 detail::convertInt32ToInt4Array(blockSize, blockSizeArray);
                 (void)ivout.write((char*)blockSizeArray, 4);
 
-                // Introduce 'versioning'; the value 20 indicates 'latest version'
+                // Introduce 'versioning'; the value 20 indicates a version
                 // with block size to be read/written from prior 4 bytes.
                 // Anything below 20 will indicate that an earlier version
                 // was used to create the filesystem container for which a
-                // block size of 4096 should be used.
-                int version = 20;
+                // block size of 4096 should be used. Version 21 adds the
+                // allocation superblock written after the file count,
+                // version 22 lays files out using extent maps and version
+                // 23 holds block metadata in a table of its own.
+                int version = io->version;
                 (void)ivout.write((char*)&version, 1);
                 (void)ivout.write((char*)&cipher, 1);
 
@@ -271,6 +377,16 @@ namespace knoxcrypt
             // write out file count
             out.write((char*)countBytes, 8);
 
+            // every block starts out free
+            if (io->version >= detail::VERSION_SUPERBLOCK) {
+                createSuperblock(io->blocks, out);
+            }
+
+            // block metadata is held apart from the blocks
+            if (detail::hasBlockMetaTable(io)) {
+                createBlockMetaTable(io, out);
+            }
+
             // write out the file space bytes
             if(!m_sparse) {
                 writeOutFileSpaceBytes(io, out);
@@ -285,6 +401,9 @@ namespace knoxcrypt
             // always be block 0
             // added block builder here since can only work after bitmap created
             // fixes issue https://github.com/benhj/knoxcrypt/issues/15
+            VolumeBitmap::invalidate(io);
+            DecryptedBlockCache::invalidate(io);
+            MappedImage::invalidate(io);
             io->blockBuilder = std::make_shared<knoxcrypt::FileBlockBuilder>(io);
             CompoundFolder rootDir(io, "root");
 
@@ -297,6 +416,9 @@ namespace knoxcrypt
                 CompoundFolder magicDir(magicIo, "root", setRoot);
             }
 
+            // make sure that the allocations made above have hit the image
+            VolumeBitmap::get(io)->sync();
+
             broadcastEvent(EventType::ImageBuildEnd);
         }
     };
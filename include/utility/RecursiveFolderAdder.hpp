@@ -74,7 +74,7 @@ namespace knoxcrypt
                     theBfs.addFile(tp.string());
                     knoxcrypt::FileDevice device = theBfs.openFile(tp.string(), knoxcrypt::OpenDisposition::buildWriteOnlyDisposition());
                     std::ifstream in(fs.string().c_str(), std::ios_base::binary);
-                    boost::iostreams::copy(in, device);
+                    boost::iostreams::copy(in, device, theBfs.getCopyBufferSize());
                 }
             }
         }
@@ -35,6 +35,7 @@
 
 #include "knoxcrypt/CoreIO.hpp"
 #include "knoxcrypt/FileBlockBuilder.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
 #include "knoxcrypt/CoreFS.hpp"
 #include "knoxcrypt/CompoundFolderEntryIterator.hpp"
 #include "knoxcrypt/KnoxCryptException.hpp"
@@ -47,6 +48,10 @@
 
 #include <fuse.h>
 #include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <functional>
 
@@ -70,6 +75,48 @@ namespace fuselayer
             return 0;
         }
 
+        /// how often blocks held back by a write-back cache are written out
+        std::chrono::seconds const WRITE_BACK_INTERVAL(5);
+
+        /// writes back cached blocks every WRITE_BACK_INTERVAL until stopped
+        class WriteBackTimer
+        {
+          public:
+            void start(knoxcrypt::CoreFS *fs)
+            {
+                m_thread = std::thread([this, fs]() {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    while (!m_condition.wait_for(lock, WRITE_BACK_INTERVAL, [this]() { return m_stopped; })) {
+                        lock.unlock();
+                        fs->sync();
+                        lock.lock();
+                    }
+                });
+            }
+
+            void stop()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stopped = true;
+                }
+                m_condition.notify_one();
+                if (m_thread.joinable()) {
+                    m_thread.join();
+                }
+            }
+
+          private:
+            std::thread m_thread;
+            std::mutex m_mutex;
+            std::condition_variable m_condition;
+            bool m_stopped = false;
+        };
+
+        /// set when the container is mounted with a write-back cache
+        bool writeBack = false;
+        WriteBackTimer writeBackTimer;
+
     }
 
     class FuseLayer
@@ -92,13 +139,13 @@ namespace fuselayer
                     if (info.type() == knoxcrypt::EntryType::FolderType) {
                         stbuf->st_mode = S_IFDIR | 0777;
                         stbuf->st_nlink = 3;
-                        stbuf->st_blksize = knoxcrypt_DATA->getBlockSize() - knoxcrypt::detail::FILE_BLOCK_META;
+                        stbuf->st_blksize = knoxcrypt_DATA->getBlockWriteSpace();
                         return 0;
                     } else if (info.type() == knoxcrypt::EntryType::FileType) {
                         stbuf->st_mode = S_IFREG | 0777;
                         stbuf->st_nlink = 1;
                         stbuf->st_size = info.size();
-                        stbuf->st_blksize = knoxcrypt_DATA->getBlockSize() - knoxcrypt::detail::FILE_BLOCK_META;
+                        stbuf->st_blksize = knoxcrypt_DATA->getBlockWriteSpace();
                         return 0;
                     } else {
                         return -ENOENT;
@@ -266,9 +313,24 @@ namespace fuselayer
         void
         *knoxcrypt_init(struct fuse_conn_info *)
         {
+            // started here rather than before fuse_main since
+            // fuse may fork in to the background
+            if (detail::writeBack) {
+                detail::writeBackTimer.start(knoxcrypt_DATA);
+            }
             return knoxcrypt_DATA;
         }
 
+        static
+        void
+        knoxcrypt_destroy(void *data)
+        {
+            if (detail::writeBack) {
+                detail::writeBackTimer.stop();
+            }
+            static_cast<knoxcrypt::CoreFS*>(data)->sync();
+        }
+
         // create file; comment for git test
         static
         int
@@ -385,6 +447,22 @@ namespace fuselayer
             return 0;
         }
 
+        static
+        int
+        knoxcrypt_release(const char *, struct fuse_file_info *)
+        {
+            knoxcrypt_DATA->sync();
+            return 0;
+        }
+
+        static
+        int
+        knoxcrypt_fsync(const char *, int, struct fuse_file_info *)
+        {
+            knoxcrypt_DATA->sync();
+            return 0;
+        }
+
         // to shut-up 'function not implemented warnings'
         // not presently required
         static
@@ -441,6 +519,9 @@ void initOperations(struct fuse_operations &ops, fuselayer::FuseLayer &fuseLayer
     ops.statfs    = fuseLayer.knoxcrypt_statfs;
     ops.setxattr  = fuseLayer.knoxcrypt_setxattr;
     ops.flush     = fuseLayer.knoxcrypt_flush;
+    ops.release   = fuseLayer.knoxcrypt_release;
+    ops.fsync     = fuseLayer.knoxcrypt_fsync;
+    ops.destroy   = fuseLayer.knoxcrypt_destroy;
     ops.chmod     = fuseLayer.knoxcrypt_chmod;
     ops.chown     = fuseLayer.knoxcrypt_chown;
     ops.utimens   = fuseLayer.knoxcrypt_utimens;
@@ -453,6 +534,13 @@ int main(int argc, char *argv[])
     // parse the program options
     bool debug = true;
     bool magic = false;
+    // the cache is opt-in: a write it can't hold back costs a flush of
+    // the image stream so that other streams never load a stale page
+    uint64_t cacheMB = 0;
+    uint64_t writeBackMB = 16;
+    bool mapImage = false;
+    unsigned int ioQueueDepth = 8;
+    bool dropHostCache = false;
     namespace po = boost::program_options;
     po::options_description desc("Allowed options");
     desc.add_options()
@@ -461,6 +549,11 @@ int main(int argc, char *argv[])
         ("mountPoint", po::value<std::string>(), "mountPoint path")
         ("debug", po::value<bool>(&debug)->default_value(true), "fuse debug")
         ("coffee", po::value<bool>(&magic)->default_value(false), "mount alternative sub-volume")
+        ("cacheMB", po::value<uint64_t>(&cacheMB)->default_value(0), "decrypted block cache size in MB (0 disables)")
+        ("writeBackMB", po::value<uint64_t>(&writeBackMB)->default_value(16), "MB of writes the cache may hold back when cacheMB is set (0 writes straight through)")
+        ("mapImage", po::value<bool>(&mapImage)->default_value(false), "access the image through a memory mapping")
+        ("ioQueueDepth", po::value<unsigned int>(&ioQueueDepth)->default_value(8), "image reads kept in flight when reading files (0 reads one block at a time)")
+        ("dropHostCache", po::value<bool>(&dropHostCache)->default_value(false), "advise the system to drop image data from its page cache once read or written back (best with cacheMB); a cache hint, not O_DIRECT")
         ;
 
     po::positional_options_description positionalOptions;
@@ -499,6 +592,11 @@ int main(int argc, char *argv[])
     // the knoxcrypt image
     knoxcrypt::SharedCoreIO io(std::make_shared<knoxcrypt::CoreIO>());
     io->useBlockCache = true;
+    io->decryptedCacheBytes = cacheMB * 1024 * 1024;
+    io->writeBackBytes = writeBackMB * 1024 * 1024;
+    io->ioQueueDepth = ioQueueDepth;
+    io->dropHostCache = dropHostCache;
+    fuselayer::detail::writeBack = cacheMB > 0 && writeBackMB > 0;
     io->path = vm["imageName"].as<std::string>().c_str();
     io->encProps.password = knoxcrypt::utility::getPassword("knoxcrypt password: ");
     io->rootBlock = magic ? atoi(knoxcrypt::utility::getPassword("magic number: ").c_str()) : 0;
@@ -508,10 +606,16 @@ int main(int argc, char *argv[])
     // and the cipher type from the tenth byte
     knoxcrypt::detail::readImageIVAndRounds(io);
 
+    // the bytes of an encrypted image are decrypted on their way out of
+    // the mapping and encrypted on their way in
+    if (mapImage) {
+        io->mapImage = true;
+        io->decryptedCacheBytes = 0;
+        fuselayer::detail::writeBack = false;
+    }
+
     // Obtain the number of blocks in the image by reading the image's block count
-    long const amount = knoxcrypt::detail::CIPHER_BUFFER_SIZE / 100000;
-    std::function<void(knoxcrypt::EventType)> f(std::bind(&knoxcrypt::cipherCallback, std::placeholders::_1, amount));
-    io->ccb = f;
+    io->ccb = knoxcrypt::CoreIO::Callback(&knoxcrypt::cipherCallback);
     knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::binary);
 
     // compare password hashes
@@ -529,7 +633,7 @@ int main(int argc, char *argv[])
 
     printf("Counting allocated blocks. Please wait...\n");
 
-    io->freeBlocks = io->blocks - knoxcrypt::detail::getNumberOfAllocatedBlocks(stream);
+    io->freeBlocks = io->blocks - knoxcrypt::VolumeBitmap::get(io)->getNumberOfAllocatedBlocks();
     io->blockBuilder = std::make_shared<knoxcrypt::FileBlockBuilder>(io);
 
     printf("Finished counting allocated blocks.\n");
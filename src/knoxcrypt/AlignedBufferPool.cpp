@@ -0,0 +1,128 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/AlignedBufferPool.hpp"
+
+#include <cstdlib>
+#include <map>
+#include <new>
+
+namespace knoxcrypt
+{
+
+    namespace
+    {
+        /// direct I/O needs buffers aligned to at least the logical sector
+        /// size; the page size covers every device in practice
+        std::size_t const ALIGNMENT = 4096;
+
+        /// the number of released buffers each pool holds on to
+        std::size_t const MAX_IDLE = 1024;
+    }
+
+    void
+    AlignedBufferPool::Returner::operator()(char * const buffer) const
+    {
+        pool->release(buffer);
+    }
+
+    AlignedBufferPool::AlignedBufferPool(std::size_t const bufferSize, std::size_t const maxIdle)
+        : m_bufferSize(bufferSize)
+        , m_maxIdle(maxIdle)
+        , m_idle()
+        , m_mutex()
+    {
+    }
+
+    AlignedBufferPool::~AlignedBufferPool()
+    {
+        for (auto buffer : m_idle) {
+            std::free(buffer);
+        }
+    }
+
+    SharedAlignedBufferPool
+    AlignedBufferPool::get(std::size_t const bufferSize)
+    {
+        static std::map<std::size_t, SharedAlignedBufferPool> thePools;
+        static std::mutex theMutex;
+        std::lock_guard<std::mutex> lock(theMutex);
+        auto &pool = thePools[bufferSize];
+        if (!pool) {
+            pool = std::make_shared<AlignedBufferPool>(bufferSize, MAX_IDLE);
+        }
+        return pool;
+    }
+
+    AlignedBufferPool::Buffer
+    AlignedBufferPool::acquire()
+    {
+        char *buffer = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_idle.empty()) {
+                buffer = m_idle.back();
+                m_idle.pop_back();
+            }
+        }
+        if (!buffer) {
+            void *memory = nullptr;
+            if (::posix_memalign(&memory, ALIGNMENT, m_bufferSize) != 0) {
+                throw std::bad_alloc();
+            }
+            buffer = static_cast<char*>(memory);
+        }
+        return Buffer(buffer, Returner{shared_from_this()});
+    }
+
+    std::size_t
+    AlignedBufferPool::bufferSize() const
+    {
+        return m_bufferSize;
+    }
+
+    std::size_t
+    AlignedBufferPool::idle() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_idle.size();
+    }
+
+    void
+    AlignedBufferPool::release(char * const buffer)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_idle.size() < m_maxIdle) {
+                m_idle.push_back(buffer);
+                return;
+            }
+        }
+        std::free(buffer);
+    }
+}
@@ -0,0 +1,210 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/BlockIOEngine.hpp"
+#include "knoxcrypt/ContainerImageStream.hpp"
+
+#include <algorithm>
+
+namespace knoxcrypt
+{
+
+    namespace
+    {
+        /// requests larger than this are split so that several workers
+        /// can service a single large request at once
+        uint64_t const SLICE_BYTES = 128 * 1024;
+    }
+
+    BlockIOEngine::BlockIOEngine(SharedCoreIO const &io, unsigned const queueDepth)
+        : m_io(std::make_shared<CoreIO>(*io))
+        , m_queue()
+        , m_workers()
+        , m_stopping(false)
+        , m_mutex()
+        , m_queued()
+        , m_finished()
+    {
+        m_io->ioQueueDepth = 0;
+        m_io->ioEngine.reset();
+        m_io->blockBuilder.reset();
+        m_io->firstTimeInit = false;
+        for (unsigned i = 0; i < std::max(queueDepth, 1u); ++i) {
+            m_workers.emplace_back(&BlockIOEngine::work, this);
+        }
+    }
+
+    BlockIOEngine::~BlockIOEngine()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_queued.notify_all();
+        for (auto &worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    SharedBlockIOEngine
+    BlockIOEngine::get(SharedCoreIO const &io)
+    {
+        if (io->ioQueueDepth == 0) {
+            return SharedBlockIOEngine();
+        }
+        if (!io->ioEngine) {
+            io->ioEngine = std::make_shared<BlockIOEngine>(io, io->ioQueueDepth);
+        }
+        return io->ioEngine;
+    }
+
+    BlockIOEngine::Ticket
+    BlockIOEngine::submit(Batch const &batch)
+    {
+        auto ticket(std::make_shared<Pending>());
+        ticket->outstanding = 0;
+        ticket->failed = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto const &request : batch) {
+                for (uint64_t done = 0; done < request.length; done += SLICE_BYTES) {
+                    Request slice(request);
+                    slice.offset += done;
+                    slice.buffer += done;
+                    slice.length = std::min(SLICE_BYTES, request.length - done);
+                    m_queue.push_back(Slice{slice, ticket});
+                    ++ticket->outstanding;
+                }
+            }
+        }
+        m_queued.notify_all();
+        return ticket;
+    }
+
+    bool
+    BlockIOEngine::complete(Ticket const &ticket)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_finished.wait(lock, [&ticket]() { return ticket->outstanding == 0; });
+        return !ticket->failed;
+    }
+
+    unsigned
+    BlockIOEngine::queueDepth() const
+    {
+        return m_workers.size();
+    }
+
+    void
+    BlockIOEngine::work()
+    {
+        // opened on first use so that an idle engine holds no descriptors
+        std::unique_ptr<ContainerImageStream> stream;
+
+        // writes of one ticket that this worker has made but not yet
+        // flushed; they are flushed together once it has no more slices of
+        // that ticket to take, and only then count towards its completion
+        Ticket held;
+        uint64_t heldSlices(0);
+        bool heldFailed(false);
+        while (true) {
+            Slice slice;
+            bool taken(false);
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (!held) {
+                    m_queued.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+                    if (m_queue.empty()) {
+                        return;
+                    }
+                }
+                if (!m_queue.empty() && (!held || m_queue.front().ticket == held)) {
+                    slice = m_queue.front();
+                    m_queue.pop_front();
+                    taken = true;
+
+                    // opening a stream updates the shared io so one at a time
+                    if (!stream) {
+                        stream.reset(new ContainerImageStream(m_io, std::ios::in | std::ios::out | std::ios::binary));
+                    }
+                }
+            }
+
+            if (!taken) {
+                stream->flush();
+                bool const ok = !heldFailed && !stream->bad();
+                if (!ok) {
+                    stream->clear();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (!ok) {
+                        held->failed = true;
+                    }
+                    held->outstanding -= heldSlices;
+                }
+                m_finished.notify_all();
+                held.reset();
+                heldSlices = 0;
+                heldFailed = false;
+                continue;
+            }
+
+            auto const &request = slice.request;
+            std::streamoff const end = request.offset + request.length;
+            bool ok;
+            if (request.write) {
+                (void)stream->seekp(request.offset);
+                (void)stream->write(request.buffer, request.length);
+                ok = !stream->bad() && stream->tellp() == end;
+            } else {
+                (void)stream->seekg(request.offset);
+                (void)stream->read(request.buffer, request.length);
+                ok = stream->tellg() == end;
+            }
+            if (!ok) {
+                stream->clear();
+            }
+
+            if (request.write) {
+                held = slice.ticket;
+                ++heldSlices;
+                heldFailed = heldFailed || !ok;
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!ok) {
+                    slice.ticket->failed = true;
+                }
+                --slice.ticket->outstanding;
+            }
+            m_finished.notify_all();
+        }
+    }
+}
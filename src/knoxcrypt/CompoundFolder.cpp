@@ -345,12 +345,14 @@ namespace knoxcrypt
     void
     CompoundFolder::writeNewMetaDataForEntry(std::string const &name,
                                              EntryType const &entryType,
-                                             uint64_t startBlock)
+                                             uint64_t startBlock,
+                                             uint64_t fileSize,
+                                             uint64_t blockCount)
     {
         // each leaf folder can have CONTENT_SIZE entries
         for(auto & f : boost::adaptors::reverse(m_contentFolders)) {
             if(f->getAliveEntryCount() < CONTENT_SIZE) {
-                f->writeNewMetaDataForEntry(name, entryType, startBlock);
+                f->writeNewMetaDataForEntry(name, entryType, startBlock, fileSize, blockCount);
                 return;
             }
         }
@@ -358,7 +360,7 @@ namespace knoxcrypt
         // wasn't added. Means that there wasn't room so create
         // another leaf folder
         doAddContentFolder();
-        m_contentFolders.back()->writeNewMetaDataForEntry(name, entryType, startBlock);
+        m_contentFolders.back()->writeNewMetaDataForEntry(name, entryType, startBlock, fileSize, blockCount);
         
     }
 }
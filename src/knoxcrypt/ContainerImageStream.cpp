@@ -36,38 +36,380 @@ uint8_t cryptostreampp::IByteTransformer::g_bigIV[32];
 
 namespace knoxcrypt
 {
+    namespace
+    {
+        /// the image opened for positional access through its cipher, to
+        /// go alongside the decrypted block cache; null if the image has
+        /// no ImageCipher or the stream appends or only writes
+        SharedPlainImage positionalImage(SharedCoreIO const &io, std::ios::openmode const mode)
+        {
+            if ((mode & std::ios::app) || !(mode & std::ios::in)) {
+                return SharedPlainImage();
+            }
+            auto cipher(ImageCipher::get(io));
+            if (!cipher) {
+                return SharedPlainImage();
+            }
+
+            // the cipher stream has already created or truncated the image
+            std::ios::openmode const existing = (mode & std::ios::out) ? (std::ios::in | std::ios::out) : std::ios::in;
+            auto image(std::make_shared<PlainImage>(io->path, existing, cipher));
+            return image->isOpen() ? image : SharedPlainImage();
+        }
+    }
+
     ContainerImageStream::ContainerImageStream(SharedCoreIO const &io, std::ios::openmode mode)
-        : m_cryptoStream(std::make_shared<cryptostreampp::CryptoStreamPP>(io->path, 
-                                                                          io->encProps,
-                                                                          mode,
-                                                                          io->firstTimeInit))
+        : m_mapped(canMap(mode) ? MappedImage::get(io) : SharedMappedImage())
+        , m_plain(m_mapped ? SharedPlainImage() : PlainImage::get(io, mode))
+        , m_rawOpen(m_mapped || (m_plain && m_plain->isOpen()))
+        , m_rawState(std::ios::goodbit)
+        , m_cryptoStream(isRaw() ? cryptostreampp::SharedCryptoStream()
+                                 : std::make_shared<cryptostreampp::CryptoStreamPP>(io->path,
+                                                                                    io->encProps,
+                                                                                    mode,
+                                                                                    io->firstTimeInit))
+        , m_cache(isRaw() ? SharedDecryptedBlockCache() : DecryptedBlockCache::get(io))
+        , m_positional(m_cache ? positionalImage(io, mode) : SharedPlainImage())
+        , m_mode(mode)
+        , m_pos()
+        , m_seekPending(false)
+        , m_hostCache(m_mapped ? SharedHostPageCache() : HostPageCache::get(io))
     {
+        if (isRaw()) {
+            m_pos = std::streamoff(0);
+        }
         io->firstTimeInit = false;
     }
 
+    void
+    ContainerImageStream::bypassHostCache(std::streamoff const offset, std::streamsize const n, bool const written)
+    {
+        if (!m_hostCache || offset < 0 || n <= 0) {
+            return;
+        }
+        if (!written) {
+            m_hostCache->dropRead(offset, n);
+            return;
+        }
+
+        // writing out is left to sync points unless a lot has built up
+        if (m_hostCache->noteWritten(offset, n)) {
+            if (m_cryptoStream) {
+                m_cryptoStream->flush();
+            }
+            m_hostCache->writeBack();
+        }
+    }
+
+    bool
+    ContainerImageStream::isRaw() const
+    {
+        return m_mapped || m_plain;
+    }
+
+    uint64_t
+    ContainerImageStream::rawRead(uint64_t const offset, char * const buf, uint64_t const n)
+    {
+        if (m_mapped) {
+            return m_mapped->read(offset, buf, n);
+        }
+        uint64_t const count = m_plain->read(offset, buf, n);
+        bypassHostCache(offset, count, false);
+        return count;
+    }
+
+    uint64_t
+    ContainerImageStream::rawWrite(uint64_t const offset, char const * const buf, uint64_t const n)
+    {
+        if (m_mapped) {
+            return m_mapped->write(offset, buf, n);
+        }
+        uint64_t const count = m_plain->write(offset, buf, n);
+        bypassHostCache(offset, count, true);
+        return count;
+    }
+
+    uint64_t
+    ContainerImageStream::rawSize() const
+    {
+        return m_mapped ? m_mapped->size() : m_plain->size();
+    }
+
+    bool
+    ContainerImageStream::canMap(std::ios::openmode const mode)
+    {
+        return (mode & std::ios::in) && !(mode & std::ios::trunc);
+    }
+
+    std::streamoff
+    ContainerImageStream::rawSeek(std::streamoff const off, std::ios_base::seekdir const way)
+    {
+        if (way == std::ios_base::cur) {
+            return *m_pos + off;
+        }
+        if (way == std::ios_base::end) {
+            return std::streamoff(rawSize()) + off;
+        }
+        return off;
+    }
+
+    void
+    ContainerImageStream::syncPosition()
+    {
+        if (m_seekPending && m_pos) {
+            (void)m_cryptoStream->seekg(*m_pos);
+            m_seekPending = false;
+        }
+    }
+
+    DecryptedBlockCache::PageLoader
+    ContainerImageStream::pageLoader()
+    {
+        return [this](uint64_t const offset, char * const page, uint64_t const count) {
+            if (m_positional) {
+                if (m_positional->read(offset, page, count) < count) {
+                    return false;
+                }
+                bypassHostCache(offset, count, false);
+                return true;
+            }
+            std::lock_guard<std::mutex> lock(m_ioMutex);
+            m_seekPending = bool(m_pos);
+            (void)m_cryptoStream->seekg(std::streamoff(offset));
+            (void)m_cryptoStream->read(page, count);
+            if (m_cryptoStream->tellg() != std::streamoff(offset + count)) {
+                m_cryptoStream->clear();
+                return false;
+            }
+            bypassHostCache(offset, count, false);
+            return true;
+        };
+    }
+
     ContainerImageStream&
     ContainerImageStream::read(char * const buf, std::streamsize const n)
     {
+        if (isRaw()) {
+            if (!m_rawOpen || m_rawState != std::ios::goodbit || *m_pos < 0) {
+                m_rawState |= std::ios::failbit;
+                return *this;
+            }
+            uint64_t const count = rawRead(*m_pos, buf, n);
+            *m_pos += count;
+            if (count < uint64_t(n)) {
+                m_rawState |= std::ios::failbit;
+            }
+            return *this;
+        }
+        if (m_cache) {
+            if (!m_pos) {
+                m_pos = std::streamoff(m_cryptoStream->tellg());
+            }
+            if ((m_mode & std::ios::in) && *m_pos >= 0) {
+                bool const cached = m_cache->read(*m_pos, buf, n, pageLoader());
+
+                // the underlying stream is left wherever the last
+                // page load (if any) put it
+                m_seekPending = true;
+                if (cached) {
+                    *m_pos += n;
+                    return *this;
+                }
+            }
+            syncPosition();
+            m_pos.reset();
+
+            // the image itself is about to be read
+            if (m_cache->hasDirtyPages()) {
+                m_cache->flush();
+            }
+        }
         (void)m_cryptoStream->read(buf, n);
+        if (m_hostCache) {
+            bypassHostCache(std::streamoff(m_cryptoStream->tellg()) - n, n, false);
+        }
         return *this;
     }
 
     ContainerImageStream&
     ContainerImageStream::write(char const * buf, std::streamsize const n)
     {
+        if (isRaw()) {
+            // as with a file stream, writing to a stream that is closed or
+            // has failed fails rather than making the stream bad
+            if (!m_rawOpen || m_rawState != std::ios::goodbit || *m_pos < 0) {
+                m_rawState |= std::ios::failbit;
+                return *this;
+            }
+            std::streamoff const pos = (m_mode & std::ios::app) ? std::streamoff(rawSize()) : *m_pos;
+            uint64_t const count = rawWrite(pos, buf, n);
+            m_pos = pos + std::streamoff(count);
+            if (count < uint64_t(n)) {
+                m_rawState |= std::ios::badbit;
+            }
+            return *this;
+        }
+        if (m_cache) {
+            if (m_mode & std::ios::app) {
+                syncPosition();
+                (void)m_cryptoStream->write(buf, n);
+                m_cryptoStream->flush();
+                std::streamoff const end = m_cryptoStream->tellp();
+                if (end >= 0) {
+                    m_cache->grow(end);
+                }
+                bypassHostCache(end - n, n, true);
+                m_pos.reset();
+                return *this;
+            }
+            std::streamoff const pos = m_pos ? *m_pos : std::streamoff(m_cryptoStream->tellp());
+            bool const canAbsorb = (m_mode & std::ios::in) && pos >= 0 && m_cryptoStream->is_open();
+            if (canAbsorb && m_cache->absorb(pos, buf, n, pageLoader())) {
+                m_pos = pos + n;
+                m_seekPending = true;
+                return *this;
+            }
+            syncPosition();
+            (void)m_cryptoStream->write(buf, n);
+
+            // another stream may load the page from the image at any time
+            // so the bytes can't sit in this stream's buffer
+            m_cryptoStream->flush();
+
+            // a failed write (e.g. to a closed stream) mustn't reach the cache
+            if (pos >= 0 && m_cryptoStream->tellp() == std::streamoff(pos + n)) {
+                bypassHostCache(pos, n, true);
+                m_cache->write(pos, buf, n);
+                m_pos = pos + n;
+            } else {
+                m_pos.reset();
+            }
+            return *this;
+        }
         (void)m_cryptoStream->write(buf, n);
+        if (m_hostCache) {
+            bypassHostCache(std::streamoff(m_cryptoStream->tellp()) - n, n, true);
+        }
+        return *this;
+    }
+
+    ContainerImageStream&
+    ContainerImageStream::readAt(std::streamoff const offset, char * const buf, std::streamsize const n)
+    {
+        if (isRaw()) {
+            if (!m_rawOpen || offset < 0 || rawRead(offset, buf, n) < uint64_t(n)) {
+                m_rawState |= std::ios::failbit;
+            }
+            return *this;
+        }
+        if (m_cache && (m_mode & std::ios::in)) {
+            if (m_cache->read(offset, buf, n, pageLoader())) {
+                return *this;
+            }
+            if (m_cache->hasDirtyPages()) {
+                m_cache->flush();
+            }
+
+            // a read running past the end goes through the cipher stream
+            // so that it fails as it always has
+            if (m_positional && m_positional->read(offset, buf, n) == uint64_t(n)) {
+                bypassHostCache(offset, n, false);
+                return *this;
+            }
+        }
+        std::lock_guard<std::mutex> lock(m_ioMutex);
+        m_pos.reset();
+        m_seekPending = false;
+        (void)m_cryptoStream->seekg(offset);
+        (void)m_cryptoStream->read(buf, n);
+        bypassHostCache(offset, n, false);
+        return *this;
+    }
+
+    ContainerImageStream&
+    ContainerImageStream::writeAt(std::streamoff const offset, char const * buf, std::streamsize const n)
+    {
+        if (isRaw()) {
+            std::streamoff const pos = (m_mode & std::ios::app) ? std::streamoff(rawSize()) : offset;
+            if (!m_rawOpen || pos < 0) {
+                m_rawState |= std::ios::failbit;
+            } else if (rawWrite(pos, buf, n) < uint64_t(n)) {
+                m_rawState |= std::ios::badbit;
+            }
+            return *this;
+        }
+        bool const canAbsorb = m_cache && (m_mode & std::ios::in) && !(m_mode & std::ios::app) &&
+                               m_cryptoStream->is_open();
+        if (canAbsorb && m_cache->absorb(offset, buf, n, pageLoader())) {
+            return *this;
+        }
+        if (m_positional && m_positional->write(offset, buf, n) == uint64_t(n)) {
+            bypassHostCache(offset, n, true);
+            m_cache->write(offset, buf, n);
+            return *this;
+        }
+
+        std::streamoff end;
+        {
+            std::lock_guard<std::mutex> lock(m_ioMutex);
+            m_pos.reset();
+            m_seekPending = false;
+            (void)m_cryptoStream->seekp(offset);
+            (void)m_cryptoStream->write(buf, n);
+            bypassHostCache(offset, n, true);
+            if (!m_cache) {
+                return *this;
+            }
+            m_cryptoStream->flush();
+            end = m_cryptoStream->tellp();
+        }
+
+        // outside of the stream lock since page loads take it while
+        // holding the cache's
+        if (m_mode & std::ios::app) {
+            if (end >= 0) {
+                m_cache->grow(end);
+            }
+        } else if (end == std::streamoff(offset + n)) {
+            m_cache->write(offset, buf, n);
+        }
         return *this;
     }
 
     ContainerImageStream&
     ContainerImageStream::seekg(std::streampos pos)
     {
+        if (isRaw()) {
+            if (!m_rawOpen) {
+                m_rawState |= std::ios::failbit;
+            } else if (m_rawState == std::ios::goodbit) {
+                m_pos = std::streamoff(pos);
+            }
+            return *this;
+        }
+        if (m_cache) {
+            // deferred until the underlying stream is next needed since
+            // a read served from the cache won't need it
+            m_pos = std::streamoff(pos);
+            m_seekPending = true;
+            return *this;
+        }
         (void)m_cryptoStream->seekg(pos);
         return *this;
     }
     ContainerImageStream&
     ContainerImageStream::seekg(std::streamoff off, std::ios_base::seekdir way)
     {
+        if (isRaw()) {
+            if (!m_rawOpen) {
+                m_rawState |= std::ios::failbit;
+            } else if (m_rawState == std::ios::goodbit) {
+                m_pos = rawSeek(off, way);
+            }
+            return *this;
+        }
+        syncPosition();
+        m_pos.reset();
         (void)m_cryptoStream->seekg(off, way);
         return *this;
     }
@@ -75,6 +417,14 @@ namespace knoxcrypt
     ContainerImageStream&
     ContainerImageStream::seekp(std::streampos pos)
     {
+        if (isRaw()) {
+            return seekg(pos);
+        }
+        if (m_cache) {
+            m_pos = std::streamoff(pos);
+            m_seekPending = true;
+            return *this;
+        }
         (void)m_cryptoStream->seekp(pos);
         return *this;
     }
@@ -82,6 +432,11 @@ namespace knoxcrypt
     ContainerImageStream&
     ContainerImageStream::seekp(std::streamoff off, std::ios_base::seekdir way)
     {
+        if (isRaw()) {
+            return seekg(off, way);
+        }
+        syncPosition();
+        m_pos.reset();
         (void)m_cryptoStream->seekp(off, way);
         return *this;
     }
@@ -89,29 +444,57 @@ namespace knoxcrypt
     std::streampos
     ContainerImageStream::tellg()
     {
+        if (isRaw() && m_rawState != std::ios::goodbit) {
+            return std::streamoff(-1);
+        }
+        if (m_pos) {
+            return *m_pos;
+        }
         return m_cryptoStream->tellg();
     }
     std::streampos
     ContainerImageStream::tellp()
     {
+        if (isRaw() && m_rawState != std::ios::goodbit) {
+            return std::streamoff(-1);
+        }
+        if (m_pos) {
+            return *m_pos;
+        }
         return m_cryptoStream->tellp();
     }
 
     void
     ContainerImageStream::close()
     {
+        if (isRaw()) {
+            m_rawOpen = false;
+            return;
+        }
+        m_pos.reset();
+        m_seekPending = false;
+        m_positional.reset();
         m_cryptoStream->close();
     }
 
     void
     ContainerImageStream::flush()
     {
+        // a mapped or plain stream has nothing of its own to flush; the
+        // mapping is written back on sync
+        if (isRaw()) {
+            return;
+        }
+        syncPosition();
         m_cryptoStream->flush();
     }
 
     bool
     ContainerImageStream::is_open() const
     {
+        if (isRaw()) {
+            return m_rawOpen;
+        }
         return m_cryptoStream->is_open();
     }
 
@@ -119,18 +502,44 @@ namespace knoxcrypt
     ContainerImageStream::open(SharedCoreIO const &io,
                              std::ios::openmode mode)
     {
+        m_mode = mode;
+        m_pos.reset();
+        m_seekPending = false;
+        if (isRaw()) {
+            m_rawState = std::ios::goodbit;
+            m_pos = std::streamoff(0);
+            if (m_mapped && canMap(mode)) {
+                m_rawOpen = true;
+                return;
+            }
+
+            // a mapped stream reopened for writing only or truncating
+            // goes on with plain I/O instead
+            m_mapped.reset();
+            m_plain = std::make_shared<PlainImage>(io->path, mode, ImageCipher::get(io));
+            m_rawOpen = m_plain->isOpen();
+            return;
+        }
         m_cryptoStream->open(io->path, mode);
+        m_positional = m_cache ? positionalImage(io, mode) : SharedPlainImage();
     }
 
     bool
     ContainerImageStream::bad() const
     {
+        if (isRaw()) {
+            return (m_rawState & std::ios::badbit) != 0;
+        }
         return m_cryptoStream->bad();
     }
 
     void
     ContainerImageStream::clear()
     {
+        if (isRaw()) {
+            m_rawState = std::ios::goodbit;
+            return;
+        }
         m_cryptoStream->clear();
     }
 }
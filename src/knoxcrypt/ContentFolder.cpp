@@ -37,6 +37,8 @@
 #include <iterator>
 #include <functional>
 #include <stdexcept>
+#include <tuple>
+#include <utility>
 
 namespace knoxcrypt
 {
@@ -45,12 +47,12 @@ namespace knoxcrypt
         /**
          * @brief put a metadata section out of use by unsetting the first bit
          * @param folderData the data that stores the folder metadata
+         * @param entryBytes the size of each entry's metadata
          * @param n the metadata chunk to put out of use
          */
-        void metaDataToOutOfUse(File folderData, int n)
+        void metaDataToOutOfUse(File folderData, uint64_t const entryBytes, int n)
         {
-            uint32_t bufferSize = 1 + detail::MAX_FILENAME_LENGTH + 8;
-            uint32_t seekTo = (8 + (n * bufferSize));
+            uint64_t seekTo = (8 + (n * entryBytes));
             if (folderData.seek(seekTo) != -1) {
                 uint8_t byte = 0x00;
                 //detail::setBitInByte(byte, 0, false /* unset */);
@@ -64,21 +66,20 @@ namespace knoxcrypt
         /**
          * @brief retrieves data from the entry metadata
          * @param folderData the metadata
+         * @param entryBytes the size of each entry's metadata
          * @param n index of the entry for which we want to retrieve the metadata of
          * @param bufSize the size of the read buffer
          * @param seekOff the seek offset
          * @return the read meta data
          */
         std::vector<uint8_t> doSeekAndReadOfEntryMetaData(File folderData,
+                                                          uint64_t const entryBytes,
                                                           int n,
                                                           uint32_t bufSize = 0,
                                                           uint64_t seekOff = 0)
         {
-            // note in the following the '1' represents first byte,
-            // the first bit of which indicates if entry is in use
-            // the '8' is number of bytes representing the first block index
-            // of the given file entry
-            uint32_t bufferSize = 1 + detail::MAX_FILENAME_LENGTH + 8;
+            // see detail::folderEntryBytes for what makes up the metadata
+            uint32_t bufferSize = uint32_t(entryBytes);
 
             // note in the following the '8' bytes represent the number of
             // entries in the folder
@@ -125,6 +126,59 @@ namespace knoxcrypt
             return detail::convertInt8ArrayToInt64(&theBuffer.front());
         }
 
+        /**
+         * @brief retrieves the size and block count recorded for a file
+         * entry; only version 24 onwards records them
+         * @param metaData the metadata that contains the size
+         * @return the file size and block count
+         */
+        std::pair<uint64_t, uint64_t> getStatsForEntry(std::vector<uint8_t> const &metaData)
+        {
+            std::vector<uint8_t> theBuffer(metaData.begin() + detail::MAX_FILENAME_LENGTH + 1 + 8, metaData.end());
+            return std::make_pair(detail::convertInt8ArrayToInt64(&theBuffer.front()),
+                                  detail::convertInt8ArrayToInt64(&theBuffer.front() + 8));
+        }
+
+        /**
+         * @brief records the size and block count of a file in its entry
+         * metadata, through a separate handle on the folder data so that
+         * the file can outlive the folder object it was opened from
+         * @param io the core knoxcrypt io
+         * @param folderName the name of the folder holding the entry
+         * @param folderBlock the start block of the folder's data
+         * @param entryIndex the index of the file's entry in the folder
+         * @param firstBlock the start block of the file
+         * @param fileSize the size of the file
+         * @param blockCount the number of blocks making up the file
+         */
+        void writeStatsToEntryMetaData(SharedCoreIO const &io,
+                                       std::string const &folderName,
+                                       uint64_t const folderBlock,
+                                       uint64_t const entryIndex,
+                                       uint64_t const firstBlock,
+                                       uint64_t const fileSize,
+                                       uint64_t const blockCount)
+        {
+            File folderData(io, folderName, folderBlock, OpenDisposition::buildOverwriteDisposition());
+            uint64_t const entryBytes = detail::folderEntryBytes(io->version);
+
+            // the file may have been removed, or moved, and its entry
+            // reused since it was opened
+            auto const metaData(doSeekAndReadOfEntryMetaData(folderData, entryBytes, entryIndex));
+            if (!entryMetaDataIsEnabled(metaData) || getBlockIndexForEntry(metaData) != firstBlock) {
+                return;
+            }
+
+            uint64_t const offset = 8 + (entryIndex * entryBytes) + 1 + detail::MAX_FILENAME_LENGTH + 8;
+            if (folderData.seek(offset) == -1) {
+                throw std::runtime_error("Problem updating entry file size");
+            }
+            uint8_t buf[detail::ENTRY_STATS_BYTES];
+            detail::convertUInt64ToInt8Array(fileSize, buf);
+            detail::convertUInt64ToInt8Array(blockCount, buf + 8);
+            (void)folderData.write((char*)buf, detail::ENTRY_STATS_BYTES);
+        }
+
         /**
          * @brief retrieves the type of a given entry
          * @param metaData the metadata that contains the block index
@@ -143,7 +197,7 @@ namespace knoxcrypt
          */
         std::string getEntryName(std::vector<uint8_t> metaData)
         {
-            std::string nameDat(metaData.begin() + 1, metaData.end() - 8);
+            std::string nameDat(metaData.begin() + 1, metaData.begin() + 1 + detail::MAX_FILENAME_LENGTH);
             std::string returnString;
             returnString.reserve(nameDat.length());
             int c = 0;
@@ -158,9 +212,9 @@ namespace knoxcrypt
          * @brief retrieves the name of an entry with given index
          * @return the name
          */
-        std::string getEntryName(File folderData, uint64_t const n)
+        std::string getEntryName(File folderData, uint64_t const entryBytes, uint64_t const n)
         {
-            auto metaData(doSeekAndReadOfEntryMetaData(std::move(folderData), n));
+            auto metaData(doSeekAndReadOfEntryMetaData(std::move(folderData), entryBytes, n));
             return getEntryName(std::move(metaData));
         }
 
@@ -173,14 +227,11 @@ namespace knoxcrypt
          * @return the number of folder entries
          */
         long getNumberOfEntries(File const & folderData,
-                                uint64_t const blocks,
-                                long const blockSize)
+                                SharedCoreIO const &io)
         {
             auto out(folderData.getStream());
-            uint64_t const offset = detail::getOffsetOfFileBlock(blockSize,
-                                                                 folderData.getStartVolumeBlockIndex(),
-                                                                 blocks);
-            (void)out->seekg(offset + detail::FILE_BLOCK_META);
+            uint64_t const offset = detail::getOffsetOfFileBlockData(io, folderData.getStartVolumeBlockIndex());
+            (void)out->seekg(offset);
             if(!out->bad()) { // bad when not initialized, i.e., when sparse image
                 uint8_t buf[8];
                 (void)out->read((char*)buf, 8);
@@ -204,7 +255,7 @@ namespace knoxcrypt
                        OpenDisposition::buildAppendDisposition())
         , m_startVolumeBlock(startVolumeBlock)
         , m_name(std::move(name))
-        , m_entryCount(getNumberOfEntries(m_folderData, m_io->blocks, m_io->blockSize))
+        , m_entryCount(getNumberOfEntries(m_folderData, m_io))
         , m_deadEntryCount(0)
         , m_entryInfoCacheMap()
         , m_checkForEarlyMetaData(true)
@@ -275,18 +326,37 @@ namespace knoxcrypt
         return doWrite((char*)buf, 8);
     }
 
+    std::streamsize
+    ContentFolder::doWriteStatsToEntryMetaData(uint64_t fileSize, uint64_t blockCount)
+    {
+        uint8_t buf[detail::ENTRY_STATS_BYTES];
+        detail::convertUInt64ToInt8Array(fileSize, buf);
+        detail::convertUInt64ToInt8Array(blockCount, buf + 8);
+        return doWrite((char*)buf, detail::ENTRY_STATS_BYTES);
+    }
+
+    uint64_t
+    ContentFolder::entryBytes() const
+    {
+        return detail::folderEntryBytes(m_io->version);
+    }
+
     void
     ContentFolder::writeNewMetaDataForEntry(std::string const &name,
                                             EntryType const &entryType,
-                                            uint64_t startBlock)
+                                            uint64_t startBlock,
+                                            uint64_t fileSize,
+                                            uint64_t blockCount)
     {
-        doWriteNewMetaDataForEntry(name, entryType, startBlock);
+        doWriteNewMetaDataForEntry(name, entryType, startBlock, fileSize, blockCount);
     }
 
     void
     ContentFolder::doWriteNewMetaDataForEntry(std::string const &name,
                                               EntryType const &entryType,
-                                              uint64_t startBlock)
+                                              uint64_t startBlock,
+                                              uint64_t fileSize,
+                                              uint64_t blockCount)
     {
         auto overWroteOld(doFindOffsetWhereMetaDataShouldBeWritten());
 
@@ -309,6 +379,11 @@ namespace knoxcrypt
         // write the first block index to the file entry metadata
         (void)doWriteFirstBlockIndexToEntryMetaData(startBlock);
 
+        // and, from version 24, the file's size and block count
+        if (m_io->version >= detail::VERSION_ENTRY_STATS) {
+            (void)doWriteStatsToEntryMetaData(fileSize, blockCount);
+        }
+
         // increment entry count, but only if brand new
         if (!overWroteOld) {
             ++m_entryCount;
@@ -333,9 +408,10 @@ namespace knoxcrypt
     {
         // Create a new file entry
         File entry(m_io, name);
+        uint64_t const startBlock = entry.getStartVolumeBlockIndex();
 
         // write the first block index to the file entry metadata
-        doWriteNewMetaDataForEntry(name, EntryType::FileType, entry.getStartVolumeBlockIndex());
+        doWriteNewMetaDataForEntry(name, EntryType::FileType, startBlock, entry.fileSize(), entry.blockCount());
     }
 
     void
@@ -344,7 +420,7 @@ namespace knoxcrypt
         // Create a new sub-folder entry
         auto entry(std::make_shared<ContentFolder>(m_io, name));
         // write the first block index to the file entry metadata
-        doWriteNewMetaDataForEntry(name, EntryType::FolderType, entry->m_folderData.getStartVolumeBlockIndex());
+        doWriteNewMetaDataForEntry(name, EntryType::FolderType, entry->m_folderData.getStartVolumeBlockIndex(), 0, 0);
     }
 
     void
@@ -355,7 +431,7 @@ namespace knoxcrypt
 
         // write the first block index to the file entry metadata
         doWriteNewMetaDataForEntry(name, EntryType::FolderType,
-          entry->getCompoundFolder()->m_folderData.getStartVolumeBlockIndex());
+          entry->getCompoundFolder()->m_folderData.getStartVolumeBlockIndex(), 0, 0);
     }
 
     boost::optional<File>
@@ -369,9 +445,22 @@ namespace knoxcrypt
         if (info) {
             if (info->type() == EntryType::FileType) {
                 File file(m_io, name, info->firstFileBlock(), openDisposition);
-                file.setOptionalSizeUpdateCallback(std::bind(&EntryInfo::updateSize,
-                                                             info,
-                                                             std::placeholders::_1));
+
+                // every flush reports the size so, from version 24, the
+                // entry metadata is only rewritten when it has changed
+                auto const io(m_io);
+                auto const folderName(m_name);
+                auto const folderBlock(m_startVolumeBlock);
+                file.setOptionalSizeUpdateCallback(
+                    [io, folderName, folderBlock, info](uint64_t const fileSize, uint64_t const blockCount) {
+                        bool const changed = fileSize != info->size() || blockCount != info->blockCount();
+                        info->updateSize(fileSize);
+                        info->updateBlockCount(blockCount);
+                        if (changed && io->version >= detail::VERSION_ENTRY_STATS) {
+                            writeStatsToEntryMetaData(io, folderName, folderBlock, info->folderIndex(),
+                                                      info->firstFileBlock(), fileSize, blockCount);
+                        }
+                    });
                 return file;
             }
         }
@@ -417,7 +506,7 @@ namespace knoxcrypt
         for (long entryIndex = 0; entryIndex < m_entryCount; ++entryIndex) {
 
             // read all metadata
-            auto metaData(doSeekAndReadOfEntryMetaData(m_folderData, entryIndex));
+            auto metaData(doSeekAndReadOfEntryMetaData(m_folderData, entryBytes(), entryIndex));
             if (!entryMetaDataIsEnabled(metaData)) {
                 ++m_deadEntryCount;
             }
@@ -427,7 +516,7 @@ namespace knoxcrypt
     ContentFolderEntryIterator
     ContentFolder::begin() const
     {
-        return ContentFolderEntryIterator(&m_folderData, m_entryCount,
+        return ContentFolderEntryIterator(&m_folderData, m_entryCount, entryBytes(),
             [this](std::vector<uint8_t> const &metaData,
                    uint64_t const entryIndex) {
                 return doGetEntryInfo(metaData, entryIndex);
@@ -446,7 +535,7 @@ namespace knoxcrypt
         for (long entryIndex = 0; entryIndex < m_entryCount; ++entryIndex) {
 
             // read all metadata
-            auto metaData(doSeekAndReadOfEntryMetaData(m_folderData, entryIndex));
+            auto metaData(doSeekAndReadOfEntryMetaData(m_folderData, entryBytes(), entryIndex));
             if (entryMetaDataIsEnabled(metaData)) {
                 (void)doGetEntryInfo(metaData, entryIndex);
             }
@@ -467,7 +556,7 @@ namespace knoxcrypt
         if(index == -1) {
             return false;
         }
-        metaDataToOutOfUse(std::move(temp), index);
+        metaDataToOutOfUse(std::move(temp), entryBytes(), index);
 
         // signify that a 'space' might be available for metadata earlier in list
         // than at end
@@ -496,8 +585,7 @@ namespace knoxcrypt
         }
 
         // find offset of meta
-        uint32_t bufferSize = 1 + detail::MAX_FILENAME_LENGTH + 8;
-        std::ios_base::streamoff offset = (8 + (index * bufferSize));
+        std::ios_base::streamoff offset = (8 + (index * entryBytes()));
 
         // normally here we'd write the first byte to the metadata
         // before writing filename, but since we don't do this, we
@@ -627,7 +715,7 @@ namespace knoxcrypt
         for (long entryIndex = 0; entryIndex < m_entryCount; ++entryIndex) {
 
             // read all metadata
-            auto metaData(doSeekAndReadOfEntryMetaData(m_folderData, entryIndex));
+            auto metaData(doSeekAndReadOfEntryMetaData(m_folderData, entryBytes(), entryIndex));
             if (entryMetaDataIsEnabled(metaData)) {
                 auto info(doGetEntryInfo(metaData, entryIndex));
                 if (info->filename() == name) {
@@ -642,7 +730,7 @@ namespace knoxcrypt
     EntryInfo
     ContentFolder::getEntryInfo(uint64_t const entryIndex) const
     {
-        auto metaData(doSeekAndReadOfEntryMetaData(m_folderData, entryIndex));
+        auto metaData(doSeekAndReadOfEntryMetaData(m_folderData, entryBytes(), entryIndex));
         return *doGetEntryInfo(metaData, entryIndex);
     }
 
@@ -673,12 +761,19 @@ namespace knoxcrypt
 
         auto const entryType(getTypeForEntry(metaData));
         uint64_t fileSize = 0;
+        uint64_t blockCount = 0;
         uint64_t startBlock;
         if (entryType == EntryType::FileType) {
-            // note disposition doesn't matter here, can be anything
             startBlock = getBlockIndexForEntry(metaData);
-            File fe(m_io, entryName, startBlock, OpenDisposition::buildAppendDisposition());
-            fileSize = fe.fileSize();
+            if (m_io->version >= detail::VERSION_ENTRY_STATS) {
+                // recorded in the entry so the file needn't be opened
+                std::tie(fileSize, blockCount) = getStatsForEntry(metaData);
+            } else {
+                // note disposition doesn't matter here, can be anything
+                File fe(m_io, entryName, startBlock, OpenDisposition::buildAppendDisposition());
+                fileSize = fe.fileSize();
+                blockCount = fe.blockCount();
+            }
         } else {
             startBlock = getBlockIndexForEntry(metaData);
         }
@@ -688,7 +783,8 @@ namespace knoxcrypt
                                               entryType,
                                               true, // writable
                                               startBlock,
-                                              entryIndex));
+                                              entryIndex,
+                                              blockCount));
 
         m_entryInfoCacheMap.emplace(entryName, info);
 
@@ -699,7 +795,7 @@ namespace knoxcrypt
     ContentFolder::doGetMetaDataIndexForEntry(std::string const &name) const
     {
         for (long entryIndex = 0; entryIndex < m_entryCount; ++entryIndex) {
-            if (name == getEntryName(m_folderData, entryIndex)) {
+            if (name == getEntryName(m_folderData, entryBytes(), entryIndex)) {
                 return entryIndex;
             }
         }
@@ -723,10 +819,9 @@ namespace knoxcrypt
         // to overwrite?
         if(m_checkForEarlyMetaData) { // optimization
             for (long entryIndex = 0; entryIndex < m_entryCount; ++entryIndex) {
-                auto metaData(doSeekAndReadOfEntryMetaData(m_folderData, entryIndex));
+                auto metaData(doSeekAndReadOfEntryMetaData(m_folderData, entryBytes(), entryIndex));
                 if (!entryMetaDataIsEnabled(metaData)) {
-                    uint32_t bufferSize = 1 + detail::MAX_FILENAME_LENGTH + 8;
-                    std::ios_base::streamoff offset = (8 + (entryIndex * bufferSize));
+                    std::ios_base::streamoff offset = (8 + (entryIndex * entryBytes()));
                     return OptionalOffset(offset);
                 }
             }
@@ -35,15 +35,14 @@ namespace knoxcrypt
 {
 
     std::vector<uint8_t> doSeekAndReadOfEntryMetaData(File folderData,
+                                                      uint64_t const entryBytes,
                                                       int n,
                                                       uint32_t bufSize = 0,
                                                       uint64_t seekOff = 0)
     {
-        // note in the following the '1' represents first byte,
-        // the first bit of which indicates if entry is in use
-        // the '8' is number of bytes representing the first block index
-        // of the given file entry
-        uint32_t bufferSize = 1 + detail::MAX_FILENAME_LENGTH + 8;
+        // entryBytes is the size of each entry's metadata as given by
+        // detail::folderEntryBytes for the image's version
+        uint32_t bufferSize = static_cast<uint32_t>(entryBytes);
 
         // note in the following the '8' bytes represent the number of
         // entries in the folder
@@ -64,11 +63,13 @@ namespace knoxcrypt
 
     ContentFolderEntryIterator::ContentFolderEntryIterator(File * folderData,
                                    long const entryCount,
+                                   uint64_t const entryBytes,
                                    std::function<std::shared_ptr<EntryInfo>
                                    (std::vector<uint8_t> const &metaData,
                                    uint64_t const entryIndex)> builder)
     : m_folderData(folderData)
     , m_entryCount(entryCount)
+    , m_entryBytes(entryBytes)
     , m_builder(std::move(builder))
     , m_currentPosition(0)
     , m_entry{nullptr}
@@ -79,6 +80,7 @@ namespace knoxcrypt
     ContentFolderEntryIterator::ContentFolderEntryIterator()
     : m_folderData(nullptr)
     , m_entryCount(static_cast<long>(0))
+    , m_entryBytes(0)
     , m_builder()
     , m_currentPosition(static_cast<long>(0))
     , m_entry{nullptr}
@@ -89,14 +91,14 @@ namespace knoxcrypt
     {
 
         if(m_currentPosition < m_entryCount) {
-            auto metadata = doSeekAndReadOfEntryMetaData(*m_folderData, m_currentPosition);
+            auto metadata = doSeekAndReadOfEntryMetaData(*m_folderData, m_entryBytes, m_currentPosition);
             while (!entryMetaDataIsEnabled(metadata)) {
                 ++m_currentPosition;
                 if(m_currentPosition == m_entryCount) {
                     m_entry = nullptr;
                     return;
                 }
-                metadata = doSeekAndReadOfEntryMetaData(*m_folderData, m_currentPosition);
+                metadata = doSeekAndReadOfEntryMetaData(*m_folderData, m_entryBytes, m_currentPosition);
             }
             m_entry = m_builder(metadata, m_currentPosition);
             ++m_currentPosition;
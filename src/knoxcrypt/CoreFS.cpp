@@ -29,7 +29,13 @@
 #include "knoxcrypt/EntryType.hpp"
 #include "knoxcrypt/CompoundFolderEntryIterator.hpp"
 #include "knoxcrypt/CoreFS.hpp"
+#include "knoxcrypt/DecryptedBlockCache.hpp"
+#include "knoxcrypt/HostPageCache.hpp"
 #include "knoxcrypt/KnoxCryptException.hpp"
+#include "knoxcrypt/MappedImage.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
+
+#include <algorithm>
 
 namespace knoxcrypt
 {
@@ -48,6 +54,16 @@ namespace knoxcrypt
         return m_io->blockSize;
     }
 
+    long CoreFS::getBlockWriteSpace() const
+    {
+        return detail::blockWriteSpace(m_io);
+    }
+
+    long CoreFS::getCopyBufferSize() const
+    {
+        return detail::blockWriteSpace(m_io) * 32 * std::max(m_io->ioQueueDepth, 1u);
+    }
+
     CompoundFolder
     CoreFS::getFolder(std::string const &path)
     {
@@ -212,7 +228,8 @@ namespace knoxcrypt
             parentSrc->updateMetaDataWithNewFilename(filename, dstFilename);
         } else {
             parentSrc->putMetaDataOutOfUse(filename);
-            parentDst->writeNewMetaDataForEntry(dstFilename, childInfo->type(), childInfo->firstFileBlock());
+            parentDst->writeNewMetaDataForEntry(dstFilename, childInfo->type(), childInfo->firstFileBlock(),
+                                                childInfo->size(), childInfo->blockCount());
         }
 
         // Need to remove parent entry from cache
@@ -380,6 +397,31 @@ namespace knoxcrypt
         buf->f_namemax = detail::MAX_FILENAME_LENGTH;
     }
 
+    void
+    CoreFS::sync()
+    {
+        StateLock lock(m_stateMutex);
+        if (m_cachedFileAndPath) {
+            m_cachedFileAndPath->second->flush();
+        }
+        VolumeBitmap::get(m_io)->sync();
+        auto cache(DecryptedBlockCache::get(m_io));
+        if (cache) {
+            cache->flush();
+        }
+        auto mapped(MappedImage::get(m_io));
+        if (mapped) {
+            mapped->sync();
+        }
+
+        // when dropping from the host's page cache, what was written is now
+        // written back and dropped
+        auto host(HostPageCache::get(m_io));
+        if (host) {
+            host->writeBack();
+        }
+    }
+
     void
     CoreFS::throwIfAlreadyExists(std::string const &path) const
     {
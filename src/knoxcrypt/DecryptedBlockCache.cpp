@@ -0,0 +1,426 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/DecryptedBlockCache.hpp"
+#include "knoxcrypt/ContainerImageStream.hpp"
+
+#include <boost/filesystem/operations.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+
+namespace knoxcrypt
+{
+
+    namespace
+    {
+        /// caches already created, keyed by image path, so that several
+        /// CoreIO objects referring to the one image share the same cache
+        using CacheRegistry = std::map<std::string, std::weak_ptr<DecryptedBlockCache>>;
+
+        CacheRegistry &registry()
+        {
+            static CacheRegistry theRegistry;
+            return theRegistry;
+        }
+
+        std::mutex &registryMutex()
+        {
+            static std::mutex theMutex;
+            return theMutex;
+        }
+    }
+
+    DecryptedBlockCache::DecryptedBlockCache(SharedCoreIO const &io)
+        : m_path(io->path)
+        , m_pageSize(io->blockSize)
+        , m_pool(AlignedBufferPool::get(io->blockSize))
+        , m_budget(io->decryptedCacheBytes)
+        , m_dirtyLimit(io->writeBackBytes)
+        , m_imageSize(0)
+        , m_pages()
+        , m_lookup()
+        , m_hits(0)
+        , m_misses(0)
+        , m_detached(false)
+        , m_dirtyPages(0)
+        , m_io(std::make_shared<CoreIO>(*io))
+        , m_stream()
+        , m_flushBuffer()
+        , m_mutex()
+    {
+        boost::system::error_code ec;
+        auto const size = boost::filesystem::file_size(io->path, ec);
+        if (!ec) {
+            m_imageSize = size;
+        }
+        m_io->decryptedCacheBytes = 0;
+        m_io->decryptedCache.reset();
+        m_io->blockBuilder.reset();
+        m_io->volumeBitmap.reset();
+        m_io->ioEngine.reset();
+        m_io->firstTimeInit = false;
+    }
+
+    DecryptedBlockCache::~DecryptedBlockCache()
+    {
+        try {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            doFlush();
+        } catch (...) {
+        }
+    }
+
+    SharedDecryptedBlockCache
+    DecryptedBlockCache::get(SharedCoreIO const &io)
+    {
+        if (io->decryptedCacheBytes == 0) {
+            return SharedDecryptedBlockCache();
+        }
+        if (io->decryptedCache) {
+            return io->decryptedCache;
+        }
+
+        std::lock_guard<std::mutex> lock(registryMutex());
+        auto &theRegistry = registry();
+        auto it(theRegistry.find(io->path));
+        if (it != theRegistry.end()) {
+            auto cache(it->second.lock());
+            if (cache && cache->m_pageSize == uint64_t(io->blockSize)) {
+                io->decryptedCache = cache;
+                return cache;
+            }
+        }
+
+        auto cache(std::make_shared<DecryptedBlockCache>(io));
+        theRegistry[io->path] = cache;
+        io->decryptedCache = cache;
+        return cache;
+    }
+
+    void
+    DecryptedBlockCache::invalidate(SharedCoreIO const &io)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        auto &theRegistry = registry();
+        auto it(theRegistry.find(io->path));
+        if (it != theRegistry.end()) {
+            // the image is being rebuilt so a cache still held on
+            // to elsewhere must not serve anything from before
+            auto cache(it->second.lock());
+            if (cache) {
+                std::lock_guard<std::mutex> cacheLock(cache->m_mutex);
+                cache->m_pages.clear();
+                cache->m_lookup.clear();
+                cache->m_dirtyPages = 0;
+                cache->m_detached = true;
+            }
+            theRegistry.erase(it);
+        }
+        io->decryptedCache.reset();
+    }
+
+    bool
+    DecryptedBlockCache::read(uint64_t const offset, char * const buf, uint64_t const n,
+                              PageLoader const &load)
+    {
+        if (n == 0) {
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_detached) {
+            return false;
+        }
+
+        // a page that runs past the end of the image can't be loaded whole
+        uint64_t const first = offset / m_pageSize;
+        uint64_t const last = (offset + n - 1) / m_pageSize;
+        if ((last + 1) * m_pageSize > m_imageSize) {
+            return false;
+        }
+
+        uint64_t copied = 0;
+        for (uint64_t index = first; index <= last; ++index) {
+            Page * const page = fetchPage(index, load);
+            if (!page) {
+                return false;
+            }
+
+            uint64_t const pageOffset = (index == first) ? offset % m_pageSize : 0;
+            uint64_t const count = std::min(m_pageSize - pageOffset, n - copied);
+            std::memcpy(buf + copied, &page->data[pageOffset], count);
+            copied += count;
+            evict();
+        }
+        return true;
+    }
+
+    bool
+    DecryptedBlockCache::absorb(uint64_t const offset, char const * const buf, uint64_t const n,
+                                PageLoader const &load)
+    {
+        if (n == 0) {
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_detached || m_dirtyLimit == 0) {
+            return false;
+        }
+
+        // pages are written back whole so must lie within the image
+        uint64_t const first = offset / m_pageSize;
+        uint64_t const last = (offset + n - 1) / m_pageSize;
+        if ((last + 1) * m_pageSize > m_imageSize) {
+            return false;
+        }
+
+        // load every page before changing any so that a failed
+        // load leaves nothing half written
+        std::vector<Page*> pages;
+        pages.reserve(last - first + 1);
+        for (uint64_t index = first; index <= last; ++index) {
+            Page * const page = fetchPage(index, load);
+            if (!page) {
+                return false;
+            }
+            pages.push_back(page);
+        }
+
+        for (auto page : pages) {
+            uint64_t const pageStart = page->index * m_pageSize;
+            uint64_t const from = std::max(offset, pageStart);
+            uint64_t const to = std::min(offset + n, pageStart + m_pageSize);
+            std::memcpy(&page->data[from - pageStart], buf + (from - offset), to - from);
+            if (page->dirtyBegin == page->dirtyEnd) {
+                page->dirtyBegin = from - pageStart;
+                page->dirtyEnd = to - pageStart;
+                ++m_dirtyPages;
+            } else {
+                page->dirtyBegin = std::min(page->dirtyBegin, from - pageStart);
+                page->dirtyEnd = std::max(page->dirtyEnd, to - pageStart);
+            }
+        }
+
+        if (m_dirtyPages * m_pageSize > m_dirtyLimit) {
+            doFlush();
+        }
+        evict();
+        return true;
+    }
+
+    void
+    DecryptedBlockCache::flush()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        doFlush();
+    }
+
+    bool
+    DecryptedBlockCache::hasDirtyPages() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_dirtyPages > 0;
+    }
+
+    DecryptedBlockCache::Page *
+    DecryptedBlockCache::fetchPage(uint64_t const index, PageLoader const &load)
+    {
+        auto it(m_lookup.find(index));
+        if (it != m_lookup.end()) {
+            ++m_hits;
+            m_pages.splice(m_pages.begin(), m_pages, it->second);
+            return &m_pages.front();
+        }
+
+        ++m_misses;
+        m_pages.push_front(Page{index, m_pool->acquire(), 0, 0});
+        if (!load(index * m_pageSize, m_pages.front().data.get(), m_pageSize)) {
+            m_pages.pop_front();
+            return nullptr;
+        }
+        m_lookup[index] = m_pages.begin();
+        return &m_pages.front();
+    }
+
+    void
+    DecryptedBlockCache::evict()
+    {
+        // dirty pages are passed over; they're bounded by the dirty limit
+        auto it(m_pages.end());
+        while (m_pages.size() * m_pageSize > m_budget && it != m_pages.begin()) {
+            --it;
+            if (it->dirtyBegin == it->dirtyEnd) {
+                m_lookup.erase(it->index);
+                it = m_pages.erase(it);
+            }
+        }
+    }
+
+    void
+    DecryptedBlockCache::doFlush()
+    {
+        if (m_dirtyPages == 0) {
+            return;
+        }
+
+        std::vector<Page*> dirty;
+        dirty.reserve(m_dirtyPages);
+        for (auto &page : m_pages) {
+            if (page.dirtyBegin != page.dirtyEnd) {
+                dirty.push_back(&page);
+            }
+        }
+        std::sort(dirty.begin(), dirty.end(), [](Page const *a, Page const *b) {
+            return a->index < b->index;
+        });
+
+        if (!m_stream) {
+            m_stream = std::make_shared<ContainerImageStream>(m_io, std::ios::in | std::ios::out | std::ios::binary);
+        }
+
+        std::size_t i = 0;
+        while (i < dirty.size()) {
+
+            // merge in the following pages for as long as the dirty
+            // ranges run on from one page in to the next
+            std::size_t j = i;
+            while (j + 1 < dirty.size() &&
+                   dirty[j]->dirtyEnd == m_pageSize &&
+                   dirty[j + 1]->index == dirty[j]->index + 1 &&
+                   dirty[j + 1]->dirtyBegin == 0) {
+                ++j;
+            }
+
+            uint64_t const offset = dirty[i]->index * m_pageSize + dirty[i]->dirtyBegin;
+            (void)m_stream->seekp(offset);
+            if (i == j) {
+                (void)m_stream->write(&dirty[i]->data[dirty[i]->dirtyBegin],
+                                      dirty[i]->dirtyEnd - dirty[i]->dirtyBegin);
+            } else {
+                m_flushBuffer.clear();
+                for (std::size_t k = i; k <= j; ++k) {
+                    m_flushBuffer.insert(m_flushBuffer.end(),
+                                         dirty[k]->data.get() + dirty[k]->dirtyBegin,
+                                         dirty[k]->data.get() + dirty[k]->dirtyEnd);
+                }
+                (void)m_stream->write(&m_flushBuffer.front(), m_flushBuffer.size());
+            }
+
+            for (std::size_t k = i; k <= j; ++k) {
+                dirty[k]->dirtyBegin = 0;
+                dirty[k]->dirtyEnd = 0;
+            }
+            i = j + 1;
+        }
+        m_stream->flush();
+        m_dirtyPages = 0;
+    }
+
+    void
+    DecryptedBlockCache::write(uint64_t const offset, char const * const buf, uint64_t const n)
+    {
+        if (n == 0) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_detached) {
+            return;
+        }
+        m_imageSize = std::max(m_imageSize, offset + n);
+
+        uint64_t const first = offset / m_pageSize;
+        uint64_t const last = (offset + n - 1) / m_pageSize;
+        for (uint64_t index = first; index <= last; ++index) {
+            auto it(m_lookup.find(index));
+            if (it == m_lookup.end()) {
+                continue;
+            }
+            uint64_t const pageStart = index * m_pageSize;
+            uint64_t const from = std::max(offset, pageStart);
+            uint64_t const to = std::min(offset + n, pageStart + m_pageSize);
+            Page &page = *it->second;
+            std::memcpy(&page.data[from - pageStart], buf + (from - offset), to - from);
+
+            // a dirty page is written back whole so the bytes must go with it
+            if (page.dirtyBegin != page.dirtyEnd) {
+                page.dirtyBegin = std::min(page.dirtyBegin, from - pageStart);
+                page.dirtyEnd = std::max(page.dirtyEnd, to - pageStart);
+            }
+        }
+    }
+
+    void
+    DecryptedBlockCache::grow(uint64_t const size)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_imageSize = std::max(m_imageSize, size);
+    }
+
+    void
+    DecryptedBlockCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        doFlush();
+        m_pages.clear();
+        m_lookup.clear();
+        m_imageSize = 0;
+    }
+
+    uint64_t
+    DecryptedBlockCache::hits() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_hits;
+    }
+
+    uint64_t
+    DecryptedBlockCache::misses() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_misses;
+    }
+
+    uint64_t
+    DecryptedBlockCache::bytes() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pages.size() * m_pageSize;
+    }
+
+    uint64_t
+    DecryptedBlockCache::dirtyBytes() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_dirtyPages * m_pageSize;
+    }
+}
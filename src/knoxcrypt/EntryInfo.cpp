@@ -35,13 +35,15 @@ namespace knoxcrypt
                          EntryType const &entryType,
                          bool const writable,
                          uint64_t const firstFileBlock,
-                         uint64_t const folderIndex)
+                         uint64_t const folderIndex,
+                         uint64_t const blockCount)
         : m_fileName(fileName)
         , m_fileSize(fileSize)
         , m_entryType(entryType)
         , m_writable(writable)
         , m_firstFileBlock(firstFileBlock)
         , m_folderIndex(folderIndex)
+        , m_blockCount(blockCount)
         , m_hasBucketIndex(false)
         , m_bucketIndex(0) // TODO, is this initialization wise?
     {
@@ -66,6 +68,18 @@ namespace knoxcrypt
         m_fileSize = newSize;
     }
 
+    uint64_t
+    EntryInfo::blockCount() const
+    {
+        return m_blockCount;
+    }
+
+    void
+    EntryInfo::updateBlockCount(uint64_t newBlockCount)
+    {
+        m_blockCount = newBlockCount;
+    }
+
     EntryType
     EntryInfo::type() const
     {
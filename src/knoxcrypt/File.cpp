@@ -26,26 +26,29 @@
   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include "knoxcrypt/BlockIOEngine.hpp"
 #include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/DecryptedBlockCache.hpp"
 #include "knoxcrypt/File.hpp"
 #include "knoxcrypt/FileBlockBuilder.hpp"
 #include "knoxcrypt/FileBlockIterator.hpp"
 #include "knoxcrypt/FileEntryException.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
 #include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
 #include "knoxcrypt/detail/DetailFileBlock.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 
 namespace knoxcrypt
 {
 
-    namespace {
-
-        uint32_t blockWriteSpace(long const blockSize)
-        {
-            return blockSize - detail::FILE_BLOCK_META;
-        }
-
+    namespace
+    {
+        /// bounds on how many blocks a sequential reader has fetched ahead of
+        /// it; the run doubles with each sequential read up to the maximum
+        uint64_t const MIN_READAHEAD_BLOCKS = 4;
+        uint64_t const MAX_READAHEAD_BLOCKS = 64;
     }
 
     // for writing a brand new entry where start block isn't known
@@ -57,13 +60,21 @@ namespace knoxcrypt
         , m_enforceStartBlock(enforceStartBlock)
         , m_fileSize(0)
         , m_workingBlock()
-        , m_buffer()
         , m_startVolumeBlock(0)
         , m_blockIndex(0)
         , m_openDisposition(OpenDisposition::buildAppendDisposition())
         , m_pos(0)
         , m_blockCount(0)
+        , m_volumeBlocks()
         , m_stream()
+        , m_reservedBlocks()
+        , m_extents()
+        , m_pendingExtents()
+        , m_extentBytes()
+        , m_mapBlocks()
+        , m_readEnd(-1)
+        , m_readaheadBlocks(0)
+        , m_readahead()
     {
     }
 
@@ -77,13 +88,21 @@ namespace knoxcrypt
         , m_enforceStartBlock(false)
         , m_fileSize(0)
         , m_workingBlock()
-        , m_buffer()
         , m_startVolumeBlock(startBlock)
         , m_blockIndex(0)
         , m_openDisposition(openDisposition)
         , m_pos(0)
         , m_blockCount(0)
+        , m_volumeBlocks()
         , m_stream()
+        , m_reservedBlocks()
+        , m_extents()
+        , m_pendingExtents()
+        , m_extentBytes()
+        , m_mapBlocks()
+        , m_readEnd(-1)
+        , m_readaheadBlocks(0)
+        , m_readahead()
     {
         // counts number of blocks and sets file size
         enumerateBlockStats();
@@ -121,6 +140,12 @@ namespace knoxcrypt
         return m_fileSize;
     }
 
+    uint64_t
+    File::blockCount() const
+    {
+        return m_blockCount;
+    }
+
     OpenDisposition
     File::getOpenDisposition() const
     {
@@ -153,8 +178,15 @@ namespace knoxcrypt
     }
 
     std::streamsize
-    File::readWorkingBlockBytes(uint32_t const thisMany)
+    File::readWorkingBlockBytes(char * const s, uint32_t const thisMany)
     {
+        // a seek to an exact block multiple leaves the working block at the
+        // end of its data; the read carries on in the next block
+        if (static_cast<uint64_t>(m_blockIndex + 1) < m_blockCount &&
+            m_workingBlock->tell() >= m_workingBlock->getDataBytesWritten()) {
+            ++m_blockIndex;
+            setWorkingBlock(getBlockWithIndex(m_blockIndex));
+        }
 
         // need to take into account the currently seeked-to position and
         // subtract that because we then only want to read
@@ -165,16 +197,11 @@ namespace knoxcrypt
         // try to read thisMany bytes
         uint32_t bytesToRead = std::min(size, thisMany);
 
-        std::vector<uint8_t>().swap(m_buffer);
-        m_buffer.resize(bytesToRead);
-        (void)m_workingBlock->read((char*)&m_buffer.front(), bytesToRead);
+        (void)m_workingBlock->read(s, bytesToRead);
 
         if (static_cast<uint64_t>(m_blockIndex + 1) < m_blockCount && bytesToRead == size) {
             ++m_blockIndex;
-            m_workingBlock = std::make_shared<FileBlock>(m_io,
-                                                           m_workingBlock->getNextIndex(),
-                                                           m_openDisposition,
-                                                           m_stream);
+            setWorkingBlock(getBlockWithIndex(m_blockIndex));
         }
 
         return bytesToRead;
@@ -182,26 +209,101 @@ namespace knoxcrypt
 
     void File::newWritableFileBlock() const
     {
-        auto block(m_io->blockBuilder->buildWritableFileBlock(m_io,
-                                                              knoxcrypt::OpenDisposition::buildAppendDisposition(),
-                                                              m_stream,
-                                                              m_enforceStartBlock));
+        auto block = [this]() {
+            auto const disposition(knoxcrypt::OpenDisposition::buildAppendDisposition());
+            if (m_enforceStartBlock || m_reservedBlocks.empty()) {
+                return m_io->blockBuilder->buildWritableFileBlock(m_io, disposition, m_stream,
+                                                                  m_enforceStartBlock);
+            }
+            auto &extent = m_reservedBlocks.front();
+            uint64_t const id = extent.start;
+            ++extent.start;
+            if (--extent.length == 0) {
+                m_reservedBlocks.pop_front();
+            }
+            return m_io->blockBuilder->buildWritableFileBlockWithIndex(m_io, id, disposition, m_stream);
+        }();
 
         if (m_enforceStartBlock) { m_enforceStartBlock = false; }
 
         block.registerBlockWithVolumeBitmap();
 
         if (m_workingBlock) {
-            m_workingBlock->setNextIndex(block.getIndex());
+            if (!hasExtentMap()) {
+                m_workingBlock->setNextIndex(block.getIndex());
+            }
+
+            // anything that followed the working block is no longer chained
+            m_volumeBlocks.resize(m_blockIndex + 1);
+        } else {
+            // released blocks keep their old metadata, but the first block's
+            // size and next index are read back even if nothing is written
+            if (hasExtentMap()) {
+                block.setSize(0);
+                block.setNextIndex(block.getIndex());
+            }
+            m_volumeBlocks.clear();
         }
+        m_volumeBlocks.push_back(block.getIndex());
 
         ++m_blockCount;
         m_blockIndex = m_blockCount - 1;
-        m_workingBlock = std::make_shared<FileBlock>(std::move(block));
+        setWorkingBlock(std::move(block));
+
+        if (hasExtentMap()) {
+            writeExtentMap();
+        }
+    }
+
+    void File::setWorkingBlock(FileBlock block) const
+    {
+        // the working block is never shared so can be overwritten in place
+        if (m_workingBlock) {
+            *m_workingBlock = std::move(block);
+        } else {
+            m_workingBlock = std::make_shared<FileBlock>(std::move(block));
+        }
+    }
+
+    void File::reserveBlocksForWrite(std::streamsize const n)
+    {
+        m_reservedBlocks.clear();
+
+        // new blocks are only ever added at the end of a file being appended to
+        if (m_enforceStartBlock || m_openDisposition.append() != AppendOrOverwrite::Append) {
+            return;
+        }
+
+        uint64_t const blockSpace = detail::blockWriteSpace(m_io);
+        uint64_t const spaceLeft = m_workingBlock ? blockSpace - m_workingBlock->tell() : 0;
+        if (uint64_t(n) <= spaceLeft) {
+            return;
+        }
+
+        // single block allocations are left to the block builder
+        uint64_t blocksRequired = (uint64_t(n) - spaceLeft + blockSpace - 1) / blockSpace;
+        if (blocksRequired < 2) {
+            return;
+        }
+
+        // a file growing past one block also needs a block for its extent map
+        if (hasExtentMap() && m_mapBlocks.empty()) {
+            ++blocksRequired;
+        }
+
+        // prefer the blocks that immediately follow the file's last block
+        uint64_t const near = m_workingBlock ? m_workingBlock->getIndex() + 1 : 0;
+        auto const extents(m_io->blockBuilder->reserveBlocks(m_io, blocksRequired, near));
+        m_reservedBlocks.assign(extents.begin(), extents.end());
     }
 
     void File::enumerateBlockStats()
     {
+        if (hasExtentMap()) {
+            readExtentMap();
+            return;
+        }
+
         // find very first block
         FileBlockIterator block(m_io,
                                 m_startVolumeBlock,
@@ -210,15 +312,175 @@ namespace knoxcrypt
         FileBlockIterator end;
         for (; block != end; ++block) {
             m_fileSize += block->getDataBytesWritten();
+            m_volumeBlocks.push_back(block->getIndex());
             ++m_blockCount;
         }
     }
 
+    bool File::hasExtentMap() const
+    {
+        return m_io->version >= detail::VERSION_EXTENT_MAP;
+    }
+
+    void File::readExtentMap()
+    {
+        auto const readOnly(OpenDisposition::buildReadOnlyDisposition());
+        FileBlock const first(m_io, m_startVolumeBlock, readOnly, m_stream);
+        m_stream = first.getStream();
+
+        // a file of a single block has no map and its next index is its own
+        uint64_t mapBlock = first.getNextIndex();
+        if (mapBlock == m_startVolumeBlock) {
+            m_volumeBlocks.push_back(m_startVolumeBlock);
+            m_blockCount = 1;
+            m_fileSize = first.getDataBytesWritten();
+            return;
+        }
+
+        // the map blocks are chained together via their next indices
+        while (true) {
+            FileBlock const block(m_io, mapBlock, readOnly, m_stream);
+            m_mapBlocks.push_back(mapBlock);
+            std::vector<uint8_t> bytes(block.getDataBytesWritten());
+            if (!bytes.empty()) {
+                (void)block.read((char*)&bytes.front(), bytes.size());
+            }
+            for (size_t offset = 0; offset + detail::EXTENT_BYTES <= bytes.size();
+                 offset += detail::EXTENT_BYTES) {
+                m_extents.push_back(detail::convertInt16ArrayToExtent(&bytes[offset]));
+            }
+            uint64_t const next = block.getNextIndex();
+            if (next == mapBlock) {
+                break;
+            }
+            if (m_mapBlocks.size() >= m_io->blocks) {
+                throw std::runtime_error("Extent map of file is corrupt");
+            }
+            mapBlock = next;
+        }
+
+        // a corrupt map mustn't refer to blocks beyond the end of the image
+        uint64_t blocks(0);
+        for (auto const &extent : m_extents) {
+            if (extent.length > m_io->blocks || extent.start > m_io->blocks - extent.length ||
+                extent.length > m_io->blocks - blocks) {
+                throw std::runtime_error("Extent map of file is corrupt");
+            }
+            blocks += extent.length;
+        }
+        if (blocks == 0) {
+            throw std::runtime_error("Extent map of file is empty");
+        }
+        m_volumeBlocks.reserve(blocks);
+        for (auto const &extent : m_extents) {
+            for (uint64_t i = 0; i < extent.length; ++i) {
+                m_volumeBlocks.push_back(extent.start + i);
+            }
+        }
+        m_blockCount = m_volumeBlocks.size();
+
+        // blocks are only ever added once the last one is full so only the
+        // size of the last block needs reading
+        FileBlock const last(m_io, m_volumeBlocks.back(), readOnly, m_stream);
+        m_fileSize = (m_blockCount - 1) * detail::blockWriteSpace(m_io)
+                   + last.getDataBytesWritten();
+    }
+
+    void File::writeExtentMap() const
+    {
+        detail::buildExtentsFromBlocks(m_volumeBlocks, m_pendingExtents);
+        BlockExtents const &extents = m_pendingExtents;
+        uint64_t const perBlock = detail::extentsPerMapBlock(m_io);
+        uint64_t const required = m_volumeBlocks.size() > 1
+                                ? (extents.size() + perBlock - 1) / perBlock : 0;
+        uint64_t const previous = m_mapBlocks.size();
+
+        // the extents before the first changed one are already on disk
+        uint64_t firstChanged = 0;
+        while (firstChanged < extents.size() && firstChanged < m_extents.size() &&
+               extents[firstChanged].start == m_extents[firstChanged].start &&
+               extents[firstChanged].length == m_extents[firstChanged].length) {
+            ++firstChanged;
+        }
+
+        // grow or shrink the chain of map blocks
+        if (required < previous) {
+            std::vector<uint64_t> const surplus(m_mapBlocks.begin() + required, m_mapBlocks.end());
+            m_mapBlocks.resize(required);
+            releaseBlocks(surplus);
+        }
+        while (m_mapBlocks.size() < required) {
+            m_mapBlocks.push_back(newExtentMapBlock());
+        }
+
+        // the first block refers to the map, or to itself if there isn't one
+        if ((previous == 0) != (required == 0)) {
+            getBlockWithIndex(0).setNextIndex(required ? m_mapBlocks.front() : m_volumeBlocks.front());
+        }
+
+        // when the chain changed, the last block kept needs its next index updated
+        uint64_t firstBlock = firstChanged / perBlock;
+        if (required != previous && required > 0) {
+            firstBlock = std::min(firstBlock, std::min(required, previous > 0 ? previous : 1) - 1);
+        }
+
+        auto const overwrite(OpenDisposition::buildOverwriteDisposition());
+        for (uint64_t b = firstBlock; b < required; ++b) {
+            // a newly allocated map block has nothing in it yet
+            uint64_t const first = b >= previous ? b * perBlock : std::max(firstChanged, b * perBlock);
+            uint64_t const end = std::min(uint64_t(extents.size()), (b + 1) * perBlock);
+            FileBlock block(m_io, m_mapBlocks[b], m_mapBlocks[b], overwrite, m_stream);
+            if (first < end) {
+                m_extentBytes.resize((end - first) * detail::EXTENT_BYTES);
+                for (uint64_t e = first; e < end; ++e) {
+                    detail::convertExtentToInt16Array(extents[e], &m_extentBytes[(e - first) * detail::EXTENT_BYTES]);
+                }
+                (void)block.seek((first - b * perBlock) * detail::EXTENT_BYTES);
+                (void)block.write((char*)&m_extentBytes.front(), m_extentBytes.size());
+            }
+            block.setSize((end - b * perBlock) * detail::EXTENT_BYTES);
+            if (required != previous) {
+                block.setNextIndex(b + 1 < required ? m_mapBlocks[b + 1] : m_mapBlocks[b]);
+            }
+        }
+
+        m_extents.swap(m_pendingExtents);
+    }
+
+    uint64_t File::newExtentMapBlock() const
+    {
+        auto const disposition(knoxcrypt::OpenDisposition::buildAppendDisposition());
+
+        // blocks reserved for the write in progress aren't yet marked in use so
+        // take from the end of the reservation rather than risk a clash
+        auto block = [&]() {
+            if (m_reservedBlocks.empty()) {
+                return m_io->blockBuilder->buildWritableFileBlock(m_io, disposition, m_stream);
+            }
+            auto &extent = m_reservedBlocks.back();
+            uint64_t const id = extent.start + extent.length - 1;
+            if (--extent.length == 0) {
+                m_reservedBlocks.pop_back();
+            }
+            return m_io->blockBuilder->buildWritableFileBlockWithIndex(m_io, id, disposition, m_stream);
+        }();
+        block.registerBlockWithVolumeBitmap();
+        return block.getIndex();
+    }
+
+    void File::releaseBlocks(std::vector<uint64_t> const &blocks) const
+    {
+        auto bitmap(VolumeBitmap::get(m_io));
+        for (auto const block : blocks) {
+            detail::updateVolumeBitmapWithOne(*bitmap, block, false);
+            ++m_io->freeBlocks;
+        }
+    }
+
     void
-    File::writeBufferedDataToWorkingBlock(uint32_t const bytes)
+    File::writeToWorkingBlock(char const * const s, uint32_t const bytes)
     {
-        m_workingBlock->write((char*)&m_buffer.front(), bytes);
-        std::vector<uint8_t>().swap(m_buffer);
+        m_workingBlock->write(s, bytes);
 
         // stream would have been initialized in block's write function
         if(!m_stream) {
@@ -233,7 +495,7 @@ namespace knoxcrypt
         // is always updates after reads/writes
         uint32_t const bytesWritten = m_workingBlock->tell();
 
-        if (bytesWritten < blockWriteSpace(m_io->blockSize)) {
+        if (bytesWritten < detail::blockWriteSpace(m_io)) {
             return true;
         }
         return false;
@@ -262,14 +524,13 @@ namespace knoxcrypt
                 m_openDisposition = OpenDisposition::buildAppendDisposition();
             }
 
-            // if in overwrite mode, maybe we want to overwrite current bytes
-            if (m_openDisposition.append() == AppendOrOverwrite::Overwrite) {
-                // if the reported stream position in the block is less that
-                // the block's total capacity, then we don't create a new block
-                // we simply overwrite
-                if (m_workingBlock->tell() < blockWriteSpace(m_io->blockSize)) {
-                    return;
-                }
+            // if in overwrite mode, the bytes being overwritten carry on in
+            // the file's next block rather than in a new one
+            if (m_openDisposition.append() == AppendOrOverwrite::Overwrite &&
+                static_cast<uint64_t>(m_blockIndex + 1) < m_blockCount) {
+                ++m_blockIndex;
+                setWorkingBlock(getBlockWithIndex(m_blockIndex));
+                return;
             }
             newWritableFileBlock();
 
@@ -288,7 +549,7 @@ namespace knoxcrypt
         // the stream position is subtracted since block may have already
         // had bytes written to it in which case the available size left
         // is approx. block size - stream position
-        return (blockWriteSpace(m_io->blockSize)) - streamPosition;
+        return (detail::blockWriteSpace(m_io)) - streamPosition;
     }
 
     std::streamsize
@@ -298,19 +559,38 @@ namespace knoxcrypt
             throw FileEntryException(FileEntryError::NotReadable);
         }
 
+        // a reader carrying on from where it left off has the blocks ahead
+        // of it fetched, in ever larger runs, while it reads
+        if (m_pos == m_readEnd) {
+            m_readaheadBlocks = std::min(std::max(m_readaheadBlocks * 2, MIN_READAHEAD_BLOCKS),
+                                         MAX_READAHEAD_BLOCKS);
+        } else {
+            dropReadahead();
+        }
+
         // read block data
         uint32_t read(0);
         uint64_t offset(0);
         while (read < n) {
 
-            // there are n-read bytes left to read so try and read that many!
-            uint32_t count = readWorkingBlockBytes(n - read);
-            read += count;
+            std::streamsize const ahead = readAheadBytes(s + offset, n - read);
+            if (ahead > 0) {
+                read += ahead;
+                offset += ahead;
+                continue;
+            }
 
-            // optimization; use this rather than for loop
-            // copies from m_buffer to s + offset
-            std::copy(&m_buffer[0], &m_buffer[count], s + offset);
+            // whole blocks are read in a batch when there's an I/O engine
+            std::streamsize const batched = readWholeBlocks(s + offset, n - read);
+            if (batched > 0) {
+                read += batched;
+                offset += batched;
+                continue;
+            }
 
+            // there are n-read bytes left to read so try and read that many!
+            uint32_t count = readWorkingBlockBytes(s + offset, n - read);
+            read += count;
             offset += count;
 
             // edge case bug fix
@@ -320,29 +600,186 @@ namespace knoxcrypt
         // update stream position
         m_pos += read;
 
+        m_readEnd = m_pos;
+        if (m_readaheadBlocks > 0) {
+            startReadahead();
+        }
+
         return read;
     }
 
-    uint32_t
-    File::bufferBytesForWorkingBlock(const char* s, std::streamsize n, uint32_t offset)
+    File::Readahead::~Readahead()
     {
+        if (ticket) {
+            (void)engine->complete(ticket);
+        }
+    }
 
-        auto const spaceAvailable = getBytesLeftInWorkingBlock();
+    std::streamsize
+    File::readAheadBytes(char * const s, std::streamsize const n)
+    {
+        if (!m_workingBlock) {
+            return 0;
+        }
+        uint64_t const block = m_blockIndex;
+        auto const it = std::find_if(m_readahead.begin(), m_readahead.end(),
+                                     [block](SharedReadahead const &run) {
+                                         return block >= run->firstBlock &&
+                                                block < run->firstBlock + run->blocks;
+                                     });
+        if (it == m_readahead.end()) {
+            return 0;
+        }
+        auto const run(*it);
+        if (!run->engine->complete(run->ticket)) {
+            // read through the working block instead
+            m_readahead.clear();
+            return 0;
+        }
+
+        uint64_t const space = detail::blockWriteSpace(m_io);
+        uint64_t const from = block * space + m_workingBlock->tell();
+        uint64_t const start = run->firstBlock * space;
+        uint64_t const end = std::min(start + run->data.size(), m_fileSize);
+        if (from >= end) {
+            return 0;
+        }
+        uint64_t const count = std::min(uint64_t(n), end - from);
+        auto const first = run->data.begin() + (from - start);
+        std::copy(first, first + count, s);
+
+        // leave the working block where a read through it would have
+        uint64_t const to = from + count;
+        uint64_t const index = std::min(to / space, m_blockCount - 1);
+        if (index != block) {
+            m_blockIndex = index;
+            setWorkingBlock(getBlockWithIndex(m_blockIndex));
+        }
+        m_workingBlock->seek(to - index * space);
+        return count;
+    }
+
+    void
+    File::startReadahead()
+    {
+        // only files with an extent map are guaranteed to have every
+        // block but the last one full
+        if (!hasExtentMap() || !m_workingBlock || m_volumeBlocks.size() != m_blockCount) {
+            return;
+        }
+        auto engine(BlockIOEngine::get(m_io));
+        if (!engine) {
+            return;
+        }
+
+        // runs wholly behind the reader are finished with
+        uint64_t const block = m_blockIndex;
+        while (!m_readahead.empty() &&
+               m_readahead.front()->firstBlock + m_readahead.front()->blocks <= block) {
+            m_readahead.pop_front();
+        }
+
+        // one run to read from and one being fetched behind it
+        uint64_t const space = detail::blockWriteSpace(m_io);
+        while (m_readahead.size() < 2) {
+            uint64_t const first = m_readahead.empty()
+                                 ? block + (m_workingBlock->tell() > 0 ? 1 : 0)
+                                 : m_readahead.back()->firstBlock + m_readahead.back()->blocks;
+            if (first >= m_blockCount) {
+                return;
+            }
+            auto run(std::make_shared<Readahead>());
+            run->firstBlock = first;
+            run->blocks = std::min(m_readaheadBlocks, m_blockCount - first);
+            run->data.resize(run->blocks * space);
+
+            BlockIOEngine::Batch batch;
+            for (uint64_t b = 0; b < run->blocks; ++b) {
+                uint64_t const blockStart = (first + b) * space;
+                uint64_t const length = m_fileSize > blockStart ? std::min(space, m_fileSize - blockStart) : 0;
+                if (length == 0) {
+                    break;
+                }
+                uint64_t const offset = detail::getOffsetOfFileBlockData(m_io, m_volumeBlocks[first + b]);
+                if (!batch.empty() && batch.back().offset + batch.back().length == offset) {
+                    batch.back().length += length;
+                } else {
+                    batch.push_back(BlockIOEngine::Request{false, offset, &run->data[b * space], length});
+                }
+            }
+            if (batch.empty()) {
+                return;
+            }
+            run->engine = engine;
+            run->ticket = engine->submit(batch);
+            m_readahead.push_back(run);
+        }
+    }
 
-        // if n is smaller than space available, just copy in to buffer
-        if (n < spaceAvailable) {
-            m_buffer.resize(n);
-            std::copy(&s[offset], &s[offset + n], &m_buffer[0]);
-            return n;
+    void
+    File::dropReadahead()
+    {
+        m_readaheadBlocks = 0;
+        m_readahead.clear();
+    }
+
+    std::streamsize
+    File::readWholeBlocks(char * const s, std::streamsize const n)
+    {
+        // only files with an extent map are guaranteed to have every
+        // block but the last one full
+        if (!hasExtentMap() || !m_workingBlock || m_workingBlock->tell() != 0 ||
+            m_volumeBlocks.size() != m_blockCount) {
+            return 0;
+        }
+        uint64_t const space = detail::blockWriteSpace(m_io);
+        uint64_t const blocks = std::min(uint64_t(n) / space, m_blockCount - 1 - m_blockIndex);
+        if (blocks < 2) {
+            return 0;
         }
 
-        // if space available > 0 copy in to the buffer spaceAvailable bytes
-        if (spaceAvailable > 0) {
-            m_buffer.resize(spaceAvailable);
-            std::copy(&s[offset], &s[offset + spaceAvailable], &m_buffer[0]);
-            return spaceAvailable;
+        auto engine(BlockIOEngine::get(m_io));
+        if (engine) {
+            // blocks whose data lies next to each other in the image are read
+            // with one request; the engine splits it across its workers
+            BlockIOEngine::Batch batch;
+            for (uint64_t b = 0; b < blocks; ++b) {
+                uint64_t const offset = detail::getOffsetOfFileBlockData(m_io, m_volumeBlocks[m_blockIndex + b]);
+                if (!batch.empty() && batch.back().offset + batch.back().length == offset) {
+                    batch.back().length += space;
+                } else {
+                    batch.push_back(BlockIOEngine::Request{false, offset, s + b * space, space});
+                }
+            }
+            if (!engine->complete(engine->submit(batch))) {
+                return 0;
+            }
+        } else if (m_stream) {
+            // otherwise each run of neighbouring blocks takes a single read
+            if (!m_stream->is_open()) {
+                m_stream->open(m_io, std::ios::in | std::ios::out | std::ios::binary);
+            }
+            for (uint64_t b = 0, run = 1; b < blocks; b += run, run = 1) {
+                uint64_t const first = m_volumeBlocks[m_blockIndex + b];
+                while (b + run < blocks && m_volumeBlocks[m_blockIndex + b + run] == first + run) {
+                    ++run;
+                }
+                detail::readFileBlockRun(m_io, *m_stream, first, run, s + b * space);
+            }
+        } else {
+            return 0;
         }
-        return 0;
+
+        m_blockIndex += blocks;
+        setWorkingBlock(getBlockWithIndex(m_blockIndex));
+        return blocks * space;
+    }
+
+    uint32_t
+    File::bytesForWorkingBlock(std::streamsize const n)
+    {
+        auto const spaceAvailable = getBytesLeftInWorkingBlock();
+        return uint32_t(std::min(n, std::streamsize(spaceAvailable)));
     }
 
     std::streamsize
@@ -353,19 +790,31 @@ namespace knoxcrypt
             throw FileEntryException(FileEntryError::NotWritable);
         }
 
+        // whatever was read ahead may be about to change
+        dropReadahead();
+
+        reserveBlocksForWrite(n);
+
         std::streamsize wrote(0);
         while (wrote < n) {
 
+            // whole blocks appended to the file are written in a batch when
+            // there's an I/O engine
+            std::streamsize const batched = writeWholeBlocks(s + wrote, n - wrote);
+            if (batched > 0) {
+                wrote += batched;
+                m_pos += batched;
+                m_fileSize += batched;
+                continue;
+            }
+
             // check if the working block needs to be updated with a new one
             checkAndUpdateWorkingBlockWithNew();
 
-            // buffers the data that will be written to the working block
-            // computed as a function of the data left to write and the
-            // working block's available space
-            auto actualWritten = bufferBytesForWorkingBlock(s, (n-wrote), wrote);
-
-            // does what it says
-            writeBufferedDataToWorkingBlock(actualWritten);
+            // as much of the data left to write as the working block's
+            // available space allows is written straight from s
+            auto actualWritten = bytesForWorkingBlock(n - wrote);
+            writeToWorkingBlock(s + wrote, actualWritten);
             wrote += actualWritten;
 
             // update stream position
@@ -375,20 +824,98 @@ namespace knoxcrypt
                 m_fileSize+=actualWritten;
             }
         }
+
+        // any blocks not used were never marked in use so can simply be forgotten
+        m_reservedBlocks.clear();
         return wrote;
     }
 
+    std::streamsize
+    File::writeWholeBlocks(const char * const s, std::streamsize const n)
+    {
+        // only a full last block, followed by blocks whose sizes will all be
+        // known up front, qualifies
+        if (!hasExtentMap() || !m_workingBlock || m_enforceStartBlock ||
+            m_openDisposition.append() != AppendOrOverwrite::Append ||
+            uint64_t(m_blockIndex + 1) != m_blockCount || workingBlockHasAvailableSpace()) {
+            return 0;
+        }
+        uint64_t const space = detail::blockWriteSpace(m_io);
+        uint64_t const blocks = uint64_t(n) / space;
+        if (blocks < 2) {
+            return 0;
+        }
+        auto engine(BlockIOEngine::get(m_io));
+        if (!engine) {
+            return 0;
+        }
+
+        // the blocks are allocated and sized here; their data is encrypted
+        // and written by the engine's workers, each taking a slice
+        BlockIOEngine::Batch batch;
+        for (uint64_t b = 0; b < blocks; ++b) {
+            newWritableFileBlock();
+            m_workingBlock->setSize(space);
+            (void)m_workingBlock->seek(space);
+            uint64_t const offset = detail::getOffsetOfFileBlockData(m_io, m_workingBlock->getIndex());
+            char * const data = const_cast<char*>(s) + b * space;
+            if (!batch.empty() && batch.back().offset + batch.back().length == offset) {
+                batch.back().length += space;
+            } else {
+                batch.push_back(BlockIOEngine::Request{true, offset, data, space});
+            }
+        }
+        if (!engine->complete(engine->submit(batch))) {
+            throw std::runtime_error("Failed to write file blocks");
+        }
+        return blocks * space;
+    }
+
     void
     File::truncate(std::ios_base::streamoff newSize)
     {
+        dropReadahead();
+
         // compute number of block required
-        auto const blockSize = blockWriteSpace(m_io->blockSize);
+        auto const blockSize = detail::blockWriteSpace(m_io);
+
+        // brings the cached size and block count in line with the new size,
+        // which is passed on to the parent's entry metadata
+        auto const truncated = [this, newSize]() {
+            m_fileSize = newSize;
+            m_blockCount = m_volumeBlocks.size();
+            if (m_optionalSizeCallback) {
+                (*m_optionalSizeCallback)(m_fileSize, m_blockCount);
+            }
+        };
+
+        // with an extent map, blocks past the end are released straight away
+        auto const keepBlocks = [this](uint64_t const blocks) {
+            if (blocks >= m_volumeBlocks.size()) {
+                return;
+            }
+            std::vector<uint64_t> const dropped(m_volumeBlocks.begin() + blocks, m_volumeBlocks.end());
+            m_volumeBlocks.resize(blocks);
+            releaseBlocks(dropped);
+            writeExtentMap();
+            VolumeBitmap::get(m_io)->sync();
+            if (static_cast<uint64_t>(m_blockIndex) >= blocks) {
+                m_blockIndex = blocks - 1;
+                setWorkingBlock(getBlockWithIndex(m_blockIndex));
+            }
+        };
 
         // edge case
         if (newSize < blockSize) {
             FileBlock zeroBlock = getBlockWithIndex(0);
             zeroBlock.setSize(newSize);
-            zeroBlock.setNextIndex(zeroBlock.getIndex());
+            if (hasExtentMap()) {
+                keepBlocks(1);
+            } else {
+                zeroBlock.setNextIndex(zeroBlock.getIndex());
+                m_volumeBlocks.resize(1);
+            }
+            truncated();
             return;
         }
 
@@ -409,19 +936,24 @@ namespace knoxcrypt
             block->setSize(leftOver);
         }
 
-        block->setNextIndex(block->getIndex());
-
-        m_blockCount = blocksRequired;
+        if (hasExtentMap()) {
+            keepBlocks(blocksRequired + 1);
+        } else {
+            block->setNextIndex(block->getIndex());
+            if (blocksRequired < m_volumeBlocks.size()) {
+                m_volumeBlocks.resize(blocksRequired + 1);
+            }
+        }
 
+        truncated();
     }
 
     using SeekPair = std::pair<int64_t, boost::iostreams::stream_offset>;
     SeekPair
-    getPositionFromBegin(boost::iostreams::stream_offset off, long const blockSize)
+    getPositionFromBegin(boost::iostreams::stream_offset off, long const blockSpace)
     {
         // find what file block the offset would relate to and set extra offset in file block
         // to that position
-        auto const blockSpace = blockWriteSpace(blockSize);
         boost::iostreams::stream_offset casted = off;
         boost::iostreams::stream_offset const leftOver = casted % blockSpace;
         int64_t block = 0;
@@ -436,7 +968,9 @@ namespace knoxcrypt
                 blockPosition = leftOver;
 
             } else {
-                blockPosition = 0;
+                // the end of the previous block, as for an offset of
+                // exactly one block below
+                blockPosition = blockSpace;
             }
 
             // get exact number of blocks after round-down
@@ -458,16 +992,15 @@ namespace knoxcrypt
     getPositionFromEnd(boost::iostreams::stream_offset off, 
                        int64_t endBlockIndex,
                        boost::iostreams::stream_offset bytesWrittenToEnd,
-                       long const blockSize)
+                       long const blockSpace)
     {
         // treat like begin and then 'inverse'
-        auto treatLikeBegin = getPositionFromBegin(std::abs(off), blockSize);
+        auto treatLikeBegin = getPositionFromBegin(std::abs(off), blockSpace);
 
         int64_t block = endBlockIndex - treatLikeBegin.first;
         auto blockPosition = bytesWrittenToEnd - treatLikeBegin.second;
 
         if (blockPosition < 0) {
-            uint16_t const blockSpace = blockWriteSpace(blockSize);
             blockPosition = blockSpace + blockPosition;
             --block;
         }
@@ -480,11 +1013,10 @@ namespace knoxcrypt
     getPositionFromCurrent(boost::iostreams::stream_offset off,
                            int64_t blockIndex,
                            boost::iostreams::stream_offset indexedBlockPosition,
-                           long const blockSize)
+                           long const blockSpace)
     {
         // find what file block the offset would relate to and set extra offset in file block
         // to that position
-        auto const blockSpace = blockWriteSpace(blockSize);
         auto addition = off + indexedBlockPosition;
         auto leftOver = std::abs(addition) % blockSpace;
         auto roundedDown = std::abs(addition) - leftOver;
@@ -520,7 +1052,7 @@ namespace knoxcrypt
             seekPair = getPositionFromEnd(off, 
                                           endBlock,
                                           getBlockWithIndex(endBlock).getDataBytesWritten(),
-                                          m_io->blockSize);
+                                          detail::blockWriteSpace(m_io));
 
         }
 
@@ -529,14 +1061,14 @@ namespace knoxcrypt
         // if seeking from the beginning
 
         if (way == std::ios_base::beg) {
-            seekPair = getPositionFromBegin(off, m_io->blockSize);
+            seekPair = getPositionFromBegin(off, detail::blockWriteSpace(m_io));
         }
         // seek relative to the current position
         if (way == std::ios_base::cur) {
             seekPair = getPositionFromCurrent(off, 
                                               m_blockIndex,
                                               m_workingBlock->tell(),
-                                              m_io->blockSize);
+                                              detail::blockWriteSpace(m_io));
         }
 
         // check bounds and error if too big
@@ -546,7 +1078,7 @@ namespace knoxcrypt
 
             // update block where we start reading/writing from
             m_blockIndex = seekPair.first;
-            m_workingBlock = std::make_shared<FileBlock>(getBlockWithIndex(m_blockIndex));
+            setWorkingBlock(getBlockWithIndex(m_blockIndex));
 
             // set the position to seek to for given block
             // this will be the point from which we read or write
@@ -580,9 +1112,21 @@ namespace knoxcrypt
     void
     File::flush()
     {
-        writeBufferedDataToWorkingBlock(m_buffer.size());
+        // nothing is held back by writes; an empty write still brings the
+        // working block's size and the shared stream up to date
+        writeToWorkingBlock("", 0);
+
         if (m_optionalSizeCallback) {
-            (*m_optionalSizeCallback)(m_fileSize);
+            (*m_optionalSizeCallback)(m_fileSize, m_blockCount);
+        }
+
+        // write back any volume bitmap changes made by allocations
+        VolumeBitmap::get(m_io)->sync();
+
+        // and any blocks held back by a write-back cache
+        auto cache(DecryptedBlockCache::get(m_io));
+        if (cache) {
+            cache->flush();
         }
     }
 
@@ -599,20 +1143,31 @@ namespace knoxcrypt
         m_blockCount = 0;
         m_workingBlock = nullptr;
         m_blockIndex = 0;
+        m_volumeBlocks.clear();
+        m_extents.clear();
+        m_mapBlocks.clear();
+        dropReadahead();
     }
 
     void
     File::unlink()
     {
-        // loop over all file blocks and update the volume bitmap indicating
-        // that block is no longer in use
-        FileBlockIterator it(m_io, m_startVolumeBlock, m_openDisposition, m_stream);
-        FileBlockIterator end;
+        if (hasExtentMap()) {
+            // every block is already known so there is no chain to walk
+            releaseBlocks(m_volumeBlocks);
+            releaseBlocks(m_mapBlocks);
+        } else {
+            // loop over all file blocks and update the volume bitmap indicating
+            // that block is no longer in use
+            FileBlockIterator it(m_io, m_startVolumeBlock, m_openDisposition, m_stream);
+            FileBlockIterator end;
 
-        for (; it != end; ++it) {
-            it->unlink();
-            ++m_io->freeBlocks;
+            for (; it != end; ++it) {
+                it->unlink();
+                ++m_io->freeBlocks;
+            }
         }
+        VolumeBitmap::get(m_io)->sync();
 
         doReset();
     }
@@ -626,35 +1181,16 @@ namespace knoxcrypt
     FileBlock
     File::getBlockWithIndex(uint64_t n) const
     {
-
-        {
-            FileBlockIterator it(m_io, m_startVolumeBlock, m_openDisposition, m_stream);
-            FileBlockIterator end;
-            uint64_t c(0);
-            for (; it != end; ++it) {
-                if (c==n) {
-                    return *it;
-                }
-                ++c;
-            }
+        if (m_volumeBlocks.empty()) {
+            throw std::runtime_error("Whoops! Something went wrong in File::getBlockWithIndex");
         }
-        // Edge case bug. Rarely, n goes past the number of blocks causing the following
-        // runtime error to be thrown. Until I figure out the exact point at which this
-        // occurs it appears to suffice to simply subract 1 from n (thus returning
-        // the final block.)
-        {
-            --n;
-            FileBlockIterator it(m_io, m_startVolumeBlock, m_openDisposition, m_stream);
-            FileBlockIterator end;
-            uint64_t c(0);
-            for (; it != end; ++it) {
-                if (c==n) {
-                    return *it;
-                }
-                ++c;
-            }
+
+        // Edge case bug. Rarely, n goes past the number of blocks. Until I
+        // figure out the exact point at which this occurs it appears to
+        // suffice to simply return the final block.
+        if (n >= m_volumeBlocks.size()) {
+            n = m_volumeBlocks.size() - 1;
         }
-        
-        throw std::runtime_error("Whoops! Something went wrong in File::getBlockWithIndex");
+        return FileBlock(m_io, m_volumeBlocks[n], m_openDisposition, m_stream, true);
     }
 }
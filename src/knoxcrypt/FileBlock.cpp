@@ -30,7 +30,9 @@
 #include "knoxcrypt/FileBlock.hpp"
 #include "knoxcrypt/FileBlockBuilder.hpp"
 #include "knoxcrypt/FileBlockException.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 
 namespace knoxcrypt
@@ -47,42 +49,52 @@ namespace knoxcrypt
         , m_initialBytesWritten(0)
         , m_next(index)
         , m_offset(0)
+        , m_dataOffset(detail::getOffsetOfFileBlockData(io, index))
         , m_seekPos(0)
         , m_positionBeforeWrite(0)
         , m_openDisposition(openDisposition)
         , m_stream(stream)
+        , m_contents()
     {
         // set m_offset
-        m_offset = detail::getOffsetOfFileBlock(m_io->blockSize, m_index, m_io->blocks);
+        m_offset = detail::getOffsetOfFileBlock(m_io, m_index);
     }
 
     FileBlock::FileBlock(SharedCoreIO const &io,
                          uint64_t const index,
                          OpenDisposition const &openDisposition,
-                         SharedImageStream const &stream)
+                         SharedImageStream const &stream,
+                         bool const wholeBlock)
         : m_io(io)
         , m_index(index)
         , m_bytesWritten(0)
         , m_next(0)
-        , m_offset(detail::getOffsetOfFileBlock(m_io->blockSize, index, m_io->blocks))
+        , m_offset(detail::getOffsetOfFileBlock(io, index))
+        , m_dataOffset(detail::getOffsetOfFileBlockData(io, index))
         , m_seekPos(0)
         , m_openDisposition(openDisposition)
         , m_stream(stream)
+        , m_contents()
     {
         // set m_offset
         initImageStream();
-        detail::checkAndSeekG(*m_stream, m_offset);
 
-        // read m_bytesWritten
-        uint8_t sizeDat[4];
-        (void)m_stream->read((char*)sizeDat, 4);
-        m_bytesWritten = detail::convertInt4ArrayToInt32(sizeDat);
+        // read m_bytesWritten and m_next, along with the data that follows
+        // them when the block can only be read from; a version 23 onwards
+        // header lives in the metadata table so is always read by itself
+        uint8_t header[12];
+        if (wholeBlock && !detail::hasBlockMetaTable(m_io) &&
+            m_openDisposition.readWrite() == ReadOrWriteOrBoth::ReadOnly) {
+            m_contents = std::make_shared<AlignedBufferPool::Buffer>(
+                AlignedBufferPool::get(m_io->blockSize)->acquire());
+            (void)m_stream->readAt(m_offset, m_contents->get(), m_io->blockSize);
+            std::copy(m_contents->get(), m_contents->get() + 12, (char*)header);
+        } else {
+            (void)m_stream->readAt(m_offset, (char*)header, 12);
+        }
+        m_bytesWritten = detail::convertInt4ArrayToInt32(header);
         m_initialBytesWritten = m_bytesWritten;
-
-        // read m_next
-        uint8_t nextDat[8];
-        (void)m_stream->read((char*)nextDat, 8);
-        m_next = detail::convertInt8ArrayToInt64(nextDat);
+        m_next = detail::convertInt8ArrayToInt64(header + 4);
 
         assert(!m_stream->bad());
     }
@@ -133,10 +145,14 @@ namespace knoxcrypt
                 throw FileBlockException(FileBlockError::NotReadable);
             }
 
-            // open the image stream for reading
-            initImageStream();
-            detail::checkAndSeekG(*m_stream, m_offset + detail::FILE_BLOCK_META + m_seekPos);
-            (void)m_stream->read((char*)buf, n);
+            if (m_contents && m_seekPos + n <= std::streamoff(detail::blockWriteSpace(m_io))) {
+                char const * const data = m_contents->get() + detail::FILE_BLOCK_META + m_seekPos;
+                std::copy(data, data + n, buf);
+            } else {
+                // open the image stream for reading
+                initImageStream();
+                (void)m_stream->readAt(m_dataOffset + m_seekPos, (char*)buf, n);
+            }
 
             // update the stream position
             m_seekPos += n;
@@ -155,12 +171,8 @@ namespace knoxcrypt
 
         // open the image stream for writing
         this->initImageStream();
-
-        if(!detail::checkAndSeekP(*m_stream, m_offset + detail::FILE_BLOCK_META + m_seekPos)) {
-            throw std::runtime_error("seek in write function broke");
-        }
         assert(!m_stream->bad());
-        (void)m_stream->write((char*)buf, n);
+        (void)m_stream->writeAt(m_dataOffset + m_seekPos, (char*)buf, n);
 
         // do updates to file block metadata only if in append mode
         // note update to next index taken care of in FileEntry
@@ -227,10 +239,8 @@ namespace knoxcrypt
     void
     FileBlock::registerBlockWithVolumeBitmap()
     {
-        this->initImageStream();
-        detail::updateVolumeBitmapWithOne(*m_stream, m_index, m_io->blocks);
+        detail::updateVolumeBitmapWithOne(*VolumeBitmap::get(m_io), m_index);
         m_io->freeBlocks--;
-        m_stream->flush();
     }
 
     void
@@ -255,10 +265,9 @@ namespace knoxcrypt
     FileBlock::doSetSize(ContainerImageStream &stream, std::ios_base::streamoff size) const
     {
         // update m_bytesWritten
-        (void)stream.seekp(m_offset);
         uint8_t sizeDat[4];
         detail::convertInt32ToInt4Array(size, sizeDat);
-        (void)stream.write((char*)sizeDat, 4);
+        (void)stream.writeAt(m_offset, (char*)sizeDat, 4);
     }
 
     void
@@ -274,17 +283,16 @@ namespace knoxcrypt
     FileBlock::doSetNextIndex(ContainerImageStream &stream, uint64_t nextIndex) const
     {
         // update m_next
-        (void)stream.seekp(m_offset + 4);
         uint8_t nextDat[8];
         detail::convertUInt64ToInt8Array(nextIndex, nextDat);
-        (void)stream.write((char*)nextDat, 8);
+        (void)stream.writeAt(m_offset + 4, (char*)nextDat, 8);
     }
 
     void
     FileBlock::unlink()
     {
         this->initImageStream();
-        detail::updateVolumeBitmapWithOne(*m_stream, m_index, m_io->blocks, false);
+        detail::updateVolumeBitmapWithOne(*VolumeBitmap::get(m_io), m_index, false);
         doSetNextIndex(*m_stream, m_index);
         doSetSize(*m_stream, 0);
         m_next = m_index;
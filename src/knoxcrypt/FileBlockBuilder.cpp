@@ -28,24 +28,20 @@
 
 #include "knoxcrypt/FileBlockBuilder.hpp"
 #include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
+#include "knoxcrypt/detail/DetailFileBlock.hpp"
 #include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
 
+#include <stdexcept>
+
 namespace knoxcrypt
 {
 
     namespace
     {
 
-        knoxcrypt::BlockDeque populateBlockDeque(SharedCoreIO const &io)
-        {
-            // obtain all available blocks and store in a map for quick lookup
-            knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::out | std::ios::binary);
-            auto allBlocks = detail::getNAvailableBlocks(stream,
-                                                         io->freeBlocks,
-                                                         io->blocks);
-            BlockDeque deque(allBlocks.begin(), allBlocks.end());
-            return deque;
-        }
+        /// the number of free extents gathered per refill of the block cache
+        std::size_t const EXTENTS_PER_REFILL = 1024;
 
         void checkAndInitStream(SharedCoreIO const & io, SharedImageStream &stream)
         {
@@ -66,8 +62,17 @@ namespace knoxcrypt
             (void)stream->seekp(0, std::ios::end);
             auto toReturn = stream->tellp();
             stream->seekp(0);
-            uint64_t const volumeBitMapBytes = io->blocks / uint64_t(8);
-            toReturn -= (detail::beginning() + 8 /* block count */ + volumeBitMapBytes + 8 /* count */);
+
+            // block data follows the block metadata table, when there is one
+            if (detail::hasBlockMetaTable(io)) {
+                uint64_t const dataArea = detail::getOffsetOfBlockDataArea(io);
+                if (uint64_t(toReturn) <= dataArea) {
+                    return 0;
+                }
+                return (uint64_t(toReturn) - dataArea) / io->blockSize;
+            }
+
+            toReturn -= detail::getOffsetOfFileBlocksArea(io);
             if(toReturn == 0) { // no block written yet
                 return 0;
             }
@@ -78,16 +83,62 @@ namespace knoxcrypt
 
 
     FileBlockBuilder::FileBlockBuilder()
-      : m_blocksWritten(0)
+      : m_freeExtents()
+      , m_scanCursor(0)
+      , m_blocksWritten(0)
     {
 
     }
 
     FileBlockBuilder::FileBlockBuilder(SharedCoreIO const &io)
-        : m_blockDeque(populateBlockDeque(io))
+        : m_freeExtents()
+        , m_scanCursor(0)
         , m_blocksWritten(0)
     {
+        refillExtentCache(io);
+    }
+
+    void
+    FileBlockBuilder::refillExtentCache(SharedCoreIO const &io)
+    {
+        auto bitmap(VolumeBitmap::get(io));
+        BlockExtents extents;
+        uint64_t const startedAt = m_scanCursor;
+        m_scanCursor = bitmap->getFreeExtents(m_scanCursor, EXTENTS_PER_REFILL, extents);
+
+        // blocks freed behind the cursor are picked up by wrapping around
+        if (extents.empty() && startedAt != 0) {
+            m_scanCursor = bitmap->getFreeExtents(0, EXTENTS_PER_REFILL, extents);
+        }
+        if (m_scanCursor >= io->blocks) {
+            m_scanCursor = 0;
+        }
+        m_freeExtents.insert(m_freeExtents.end(), extents.begin(), extents.end());
+    }
+
+    boost::optional<uint64_t>
+    FileBlockBuilder::takeCachedBlock(SharedCoreIO const &io)
+    {
+        auto bitmap(VolumeBitmap::get(io));
+        while (true) {
+            if (m_freeExtents.empty()) {
+                refillExtentCache(io);
+                if (m_freeExtents.empty()) {
+                    return boost::optional<uint64_t>();
+                }
+            }
+            auto &extent = m_freeExtents.front();
+            uint64_t const id = extent.start;
+            ++extent.start;
+            if (--extent.length == 0) {
+                m_freeExtents.pop_front();
+            }
 
+            // the cache might be stale if the block was since allocated elsewhere
+            if (!bitmap->isBlockInUse(id)) {
+                return id;
+            }
+        }
     }
 
     FileBlock
@@ -104,19 +155,23 @@ namespace knoxcrypt
             id = io->rootBlock;
         } else {
 
-            if(io->useBlockCache) {
-                id = m_blockDeque.front();
-                m_blockDeque.pop_front();
-                // attempt to refill cache with blocks
-                if(m_blockDeque.empty()) {
-                    populateBlockDeque(io).swap(m_blockDeque);
-                }
-            } else {
-                checkAndInitStream(io, stream);
-                id = *(detail::getNextAvailableBlock(*stream, io->blocks));
+            auto available(io->useBlockCache ? takeCachedBlock(io)
+                                             : VolumeBitmap::get(io)->getNextAvailableBlock());
+            if (!available) {
+                throw std::runtime_error("No free blocks available");
             }
+            id = *available;
         }
 
+        return buildWritableFileBlockWithIndex(io, id, openDisposition, stream);
+    }
+
+    FileBlock
+    FileBlockBuilder::buildWritableFileBlockWithIndex(SharedCoreIO const &io,
+                                                      uint64_t const id,
+                                                      OpenDisposition const &openDisposition,
+                                                      SharedImageStream &stream)
+    {
         // check if block data is actually written into iomage structure (might not have been
         // if image is sparse).
         if(m_blocksWritten == 0) {
@@ -126,13 +181,20 @@ namespace knoxcrypt
             checkAndInitStream(io, stream);
             detail::writeBlock(io, *stream, id);
             stream->flush();
-            stream->close();
             ++m_blocksWritten;
         }
 
         return FileBlock(io, id, id, openDisposition, stream);
     }
 
+    BlockExtents
+    FileBlockBuilder::reserveBlocks(SharedCoreIO const &io,
+                                    uint64_t const blocksRequired,
+                                    uint64_t const near)
+    {
+        return VolumeBitmap::get(io)->getFreeBlocksNear(near, blocksRequired);
+    }
+
     FileBlock
     FileBlockBuilder::buildFileBlock(SharedCoreIO const &io,
                                      uint64_t const index,
@@ -0,0 +1,130 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/HostPageCache.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace knoxcrypt
+{
+
+    HostPageCache::HostPageCache(int const fd)
+        : m_fd(fd)
+        , m_begin(0)
+        , m_end(0)
+        , m_pending(0)
+        , m_mutex()
+    {
+    }
+
+    HostPageCache::~HostPageCache()
+    {
+        writeBack();
+        (void)::close(m_fd);
+    }
+
+    SharedHostPageCache
+    HostPageCache::get(SharedCoreIO const &io)
+    {
+        if (!io->dropHostCache) {
+            return SharedHostPageCache();
+        }
+
+        static std::mutex theMutex;
+        std::lock_guard<std::mutex> lock(theMutex);
+        if (io->hostPageCache) {
+            return io->hostPageCache;
+        }
+
+        // an image that doesn't exist yet is tried again by the next stream
+        int const fd = ::open(io->path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return SharedHostPageCache();
+        }
+        io->hostPageCache = std::make_shared<HostPageCache>(fd);
+        return io->hostPageCache;
+    }
+
+    void
+    HostPageCache::dropRead(uint64_t const offset, uint64_t const n)
+    {
+#ifdef POSIX_FADV_DONTNEED
+        (void)::posix_fadvise(m_fd, offset, n, POSIX_FADV_DONTNEED);
+#endif
+    }
+
+    bool
+    HostPageCache::noteWritten(uint64_t const offset, uint64_t const n)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pending == 0) {
+            m_begin = offset;
+            m_end = offset + n;
+        } else {
+            m_begin = std::min(m_begin, offset);
+            m_end = std::max(m_end, offset + n);
+        }
+        m_pending += n;
+        return m_pending >= WRITEBACK_BYTES;
+    }
+
+    void
+    HostPageCache::writeBack()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pending == 0) {
+            return;
+        }
+
+        // pages that are still dirty can't be dropped
+#ifdef SYNC_FILE_RANGE_WRITE
+        (void)::sync_file_range(m_fd, m_begin, m_end - m_begin, SYNC_FILE_RANGE_WAIT_BEFORE |
+                                                                SYNC_FILE_RANGE_WRITE |
+                                                                SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+        (void)::fdatasync(m_fd);
+#endif
+#ifdef POSIX_FADV_DONTNEED
+        (void)::posix_fadvise(m_fd, m_begin, m_end - m_begin, POSIX_FADV_DONTNEED);
+#endif
+        m_begin = 0;
+        m_end = 0;
+        m_pending = 0;
+    }
+
+    uint64_t
+    HostPageCache::pendingBytes() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pending;
+    }
+
+}
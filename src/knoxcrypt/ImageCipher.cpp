@@ -0,0 +1,232 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/ImageCipher.hpp"
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+#include "cryptostreampp/CryptoStreamPP.hpp"
+
+#include "cryptopp/aes.h"
+#include "cryptopp/blowfish.h"
+#include "cryptopp/camellia.h"
+#include "cryptopp/cast.h"
+#include "cryptopp/des.h"
+#include "cryptopp/idea.h"
+#include "cryptopp/mars.h"
+#include "cryptopp/modes.h"
+#include "cryptopp/rc5.h"
+#include "cryptopp/rc6.h"
+#include "cryptopp/seed.h"
+#include "cryptopp/serpent.h"
+#include "cryptopp/shacal2.h"
+#include "cryptopp/skipjack.h"
+#include "cryptopp/tea.h"
+#include "cryptopp/twofish.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+
+namespace knoxcrypt
+{
+
+    namespace
+    {
+        /// the key and IV that cryptostreampp derived for the image, named
+        /// through a class of our own so that they can be read from here
+        struct DerivedKey : public cryptostreampp::IByteTransformer
+        {
+            using cryptostreampp::IByteTransformer::g_bigKey;
+            using cryptostreampp::IByteTransformer::g_bigIV;
+        };
+
+        /// a copy of the key and IV as they were when a cipher was made
+        struct KeyAndIV
+        {
+            uint8_t key[sizeof(DerivedKey::g_bigKey)];
+            uint8_t iv[sizeof(DerivedKey::g_bigIV)];
+        };
+
+        /// the bytes of each range compared when checking a cipher
+        uint64_t const PROBE_BYTES = 32;
+
+        template <typename Cipher>
+        class CounterModeCipher : public ImageCipher
+        {
+          public:
+            CounterModeCipher()
+                : m_keyAndIV()
+            {
+                std::memcpy(m_keyAndIV.key, DerivedKey::g_bigKey, sizeof(m_keyAndIV.key));
+                std::memcpy(m_keyAndIV.iv, DerivedKey::g_bigIV, sizeof(m_keyAndIV.iv));
+            }
+
+            void transform(uint64_t const offset, char const * const in,
+                           char * const out, uint64_t const n) const override
+            {
+                // a mode object holds its position in the keystream so each
+                // thread keeps its own rather than sharing one under a lock;
+                // it is only keyed again if the thread moves on to a
+                // cipher with another key
+                using Encryption = typename CryptoPP::CTR_Mode<Cipher>::Encryption;
+                thread_local std::unique_ptr<Encryption> theEncryption;
+                thread_local KeyAndIV theKeyAndIV;
+                if (!theEncryption || std::memcmp(&theKeyAndIV, &m_keyAndIV, sizeof(KeyAndIV)) != 0) {
+                    std::size_t const keyLength = std::min<std::size_t>(sizeof(m_keyAndIV.key),
+                                                                        Cipher::MAX_KEYLENGTH);
+                    theEncryption.reset(new Encryption);
+                    theEncryption->SetKeyWithIV(m_keyAndIV.key, keyLength, m_keyAndIV.iv);
+                    theKeyAndIV = m_keyAndIV;
+                }
+                theEncryption->Seek(offset);
+                theEncryption->ProcessData(reinterpret_cast<CryptoPP::byte*>(out),
+                                           reinterpret_cast<CryptoPP::byte const*>(in), n);
+            }
+
+          private:
+            KeyAndIV m_keyAndIV;
+        };
+
+        /// the one place an algorithm is mapped to its cipher
+        SharedImageCipher makeCipher(cryptostreampp::Algorithm const algorithm)
+        {
+            using cryptostreampp::Algorithm;
+            switch (algorithm) {
+              case Algorithm::AES:
+                return std::make_shared<CounterModeCipher<CryptoPP::AES>>();
+              case Algorithm::Twofish:
+                return std::make_shared<CounterModeCipher<CryptoPP::Twofish>>();
+              case Algorithm::Serpent:
+                return std::make_shared<CounterModeCipher<CryptoPP::Serpent>>();
+              case Algorithm::RC6:
+                return std::make_shared<CounterModeCipher<CryptoPP::RC6>>();
+              case Algorithm::MARS:
+                return std::make_shared<CounterModeCipher<CryptoPP::MARS>>();
+              case Algorithm::CAST256:
+                return std::make_shared<CounterModeCipher<CryptoPP::CAST256>>();
+              case Algorithm::Camellia:
+                return std::make_shared<CounterModeCipher<CryptoPP::Camellia>>();
+              case Algorithm::RC5:
+                return std::make_shared<CounterModeCipher<CryptoPP::RC5>>();
+              case Algorithm::SHACAL2:
+                return std::make_shared<CounterModeCipher<CryptoPP::SHACAL2>>();
+              case Algorithm::Blowfish:
+                return std::make_shared<CounterModeCipher<CryptoPP::Blowfish>>();
+              case Algorithm::SKIPJACK:
+                return std::make_shared<CounterModeCipher<CryptoPP::SKIPJACK>>();
+              case Algorithm::IDEA:
+                return std::make_shared<CounterModeCipher<CryptoPP::IDEA>>();
+              case Algorithm::SEED:
+                return std::make_shared<CounterModeCipher<CryptoPP::SEED>>();
+              case Algorithm::TEA:
+                return std::make_shared<CounterModeCipher<CryptoPP::TEA>>();
+              case Algorithm::XTEA:
+                return std::make_shared<CounterModeCipher<CryptoPP::XTEA>>();
+              case Algorithm::DES_EDE2:
+                return std::make_shared<CounterModeCipher<CryptoPP::DES_EDE2>>();
+              case Algorithm::DES_EDE3:
+                return std::make_shared<CounterModeCipher<CryptoPP::DES_EDE3>>();
+              default:
+                return SharedImageCipher();
+            }
+        }
+
+        /**
+         * @brief  checks that the cipher decrypts the image as the cipher
+         *         stream does. The password hash, which every image has, is
+         *         compared and so is the very end of the image, so that a
+         *         keystream that only goes wrong further in is caught too
+         * @param  stream the cipher stream, opened on the image
+         * @param  path the path of the image
+         * @param  size the size of the image
+         * @param  cipher the cipher to check
+         * @return true if both agree
+         */
+        bool matchesCipherStream(cryptostreampp::CryptoStreamPP &stream,
+                                 std::string const &path,
+                                 uint64_t const size,
+                                 ImageCipher const &cipher)
+        {
+            std::ifstream image(path.c_str(), std::ios::in | std::ios::binary);
+            uint64_t const probes[] = {detail::beginning() - detail::PASS_HASH_BYTES, size - PROBE_BYTES};
+            for (auto const offset : probes) {
+                char streamed[PROBE_BYTES];
+                char transformed[PROBE_BYTES];
+                (void)stream.seekg(offset);
+                (void)stream.read(streamed, PROBE_BYTES);
+                (void)image.seekg(offset);
+                (void)image.read(transformed, PROBE_BYTES);
+                if (!image || stream.tellg() != std::streamoff(offset + PROBE_BYTES)) {
+                    return false;
+                }
+                cipher.transform(offset, transformed, transformed, PROBE_BYTES);
+                if (std::memcmp(streamed, transformed, PROBE_BYTES) != 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    ImageCipher::~ImageCipher()
+    {
+    }
+
+    SharedImageCipher
+    ImageCipher::get(SharedCoreIO const &io)
+    {
+        if (io->firstTimeInit || io->encProps.cipher == cryptostreampp::Algorithm::NONE) {
+            return SharedImageCipher();
+        }
+
+        static std::mutex theMutex;
+        std::lock_guard<std::mutex> lock(theMutex);
+        if (io->imageCipher || !io->cipherPipeline) {
+            return io->imageCipher;
+        }
+
+        // an image that doesn't exist yet is tried again by the next stream
+        struct stat st;
+        if (::stat(io->path.c_str(), &st) != 0 || uint64_t(st.st_size) < detail::beginning()) {
+            return SharedImageCipher();
+        }
+
+        // opening the cipher stream sets up the key if nothing has yet
+        cryptostreampp::CryptoStreamPP stream(io->path, io->encProps, std::ios::in | std::ios::binary);
+        auto cipher(makeCipher(io->encProps.cipher));
+        if (!cipher || !matchesCipherStream(stream, io->path, uint64_t(st.st_size), *cipher)) {
+            io->cipherPipeline = false;
+            return SharedImageCipher();
+        }
+        io->imageCipher = cipher;
+        return cipher;
+    }
+
+}
@@ -0,0 +1,261 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/MappedImage.hpp"
+#include "knoxcrypt/ImageCipher.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+namespace knoxcrypt
+{
+
+    namespace
+    {
+        /// images already mapped, keyed by image path, so that several
+        /// CoreIO objects referring to the one image share the same mapping
+        using MappingRegistry = std::map<std::string, std::weak_ptr<MappedImage>>;
+
+        MappingRegistry &registry()
+        {
+            static MappingRegistry theRegistry;
+            return theRegistry;
+        }
+
+        std::mutex &registryMutex()
+        {
+            static std::mutex theMutex;
+            return theMutex;
+        }
+    }
+
+    MappedImage::MappedImage(std::string const &path, SharedImageCipher const &cipher)
+        : m_path(path)
+        , m_cipher(cipher)
+        , m_fd(::open(path.c_str(), O_RDWR))
+        , m_data(nullptr)
+        , m_size(0)
+        , m_detached(false)
+        , m_mutex()
+    {
+        if (m_fd < 0) {
+            throw std::runtime_error("Couldn't open image for mapping");
+        }
+        struct stat st;
+        if (::fstat(m_fd, &st) != 0) {
+            (void)::close(m_fd);
+            throw std::runtime_error("Couldn't determine size of image to map");
+        }
+        try {
+            map(st.st_size);
+        } catch (...) {
+            (void)::close(m_fd);
+            throw;
+        }
+    }
+
+    MappedImage::~MappedImage()
+    {
+        if (m_data) {
+            (void)::msync(m_data, m_size, MS_SYNC);
+        }
+        unmap();
+        (void)::close(m_fd);
+    }
+
+    SharedMappedImage
+    MappedImage::get(SharedCoreIO const &io)
+    {
+        if (!io->mapImage || io->firstTimeInit) {
+            return SharedMappedImage();
+        }
+        if (io->mappedImage) {
+            return io->mappedImage;
+        }
+
+        // an encrypted image can only be mapped when its bytes can be
+        // transformed at any offset
+        SharedImageCipher cipher;
+        if (io->encProps.cipher != cryptostreampp::Algorithm::NONE) {
+            cipher = ImageCipher::get(io);
+            if (!cipher) {
+                return SharedMappedImage();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(registryMutex());
+        auto &theRegistry = registry();
+        auto it(theRegistry.find(io->path));
+        if (it != theRegistry.end()) {
+            auto image(it->second.lock());
+            if (image) {
+                io->mappedImage = image;
+                return image;
+            }
+        }
+
+        auto image(std::make_shared<MappedImage>(io->path, cipher));
+        theRegistry[io->path] = image;
+        io->mappedImage = image;
+        return image;
+    }
+
+    void
+    MappedImage::invalidate(SharedCoreIO const &io)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        auto &theRegistry = registry();
+        auto it(theRegistry.find(io->path));
+        if (it != theRegistry.end()) {
+            // the image is about to be truncated and rewritten; touching
+            // a mapping beyond its new end would fault
+            auto image(it->second.lock());
+            if (image) {
+                std::unique_lock<std::shared_timed_mutex> imageLock(image->m_mutex);
+                image->unmap();
+                image->m_detached = true;
+            }
+            theRegistry.erase(it);
+        }
+        io->mappedImage.reset();
+    }
+
+    uint64_t
+    MappedImage::read(uint64_t const offset, char * const buf, uint64_t const n)
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+        if (m_detached || offset >= m_size) {
+            return 0;
+        }
+        uint64_t const count = std::min(n, m_size - offset);
+        copyOut(offset, buf, count);
+        return count;
+    }
+
+    uint64_t
+    MappedImage::write(uint64_t const offset, char const * const buf, uint64_t const n)
+    {
+        if (n == 0) {
+            return 0;
+        }
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+            if (m_detached) {
+                return 0;
+            }
+            if (offset + n <= m_size) {
+                copyIn(offset, buf, n);
+                return n;
+            }
+        }
+
+        std::unique_lock<std::shared_timed_mutex> lock(m_mutex);
+        if (m_detached) {
+            return 0;
+        }
+        if (offset + n > m_size) {
+            if (::ftruncate(m_fd, off_t(offset + n)) != 0) {
+                return 0;
+            }
+            map(offset + n);
+        }
+        copyIn(offset, buf, n);
+        return n;
+    }
+
+    void
+    MappedImage::sync()
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+        if (m_data && ::msync(m_data, m_size, MS_SYNC) != 0) {
+            throw std::runtime_error("Couldn't write back mapped image");
+        }
+    }
+
+    uint64_t
+    MappedImage::size() const
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+        return m_size;
+    }
+
+    void
+    MappedImage::copyOut(uint64_t const offset, char * const buf, uint64_t const n) const
+    {
+        if (m_cipher) {
+            m_cipher->transform(offset, m_data + offset, buf, n);
+        } else {
+            std::memcpy(buf, m_data + offset, n);
+        }
+    }
+
+    void
+    MappedImage::copyIn(uint64_t const offset, char const * const buf, uint64_t const n)
+    {
+        // encrypted straight in to the mapping so that plaintext never
+        // lands in the image's pages
+        if (m_cipher) {
+            m_cipher->transform(offset, buf, m_data + offset, n);
+        } else {
+            std::memcpy(m_data + offset, buf, n);
+        }
+    }
+
+    void
+    MappedImage::map(uint64_t const size)
+    {
+        unmap();
+        if (size == 0) {
+            return;
+        }
+        void * const data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (data == MAP_FAILED) {
+            throw std::runtime_error("Couldn't map image");
+        }
+        m_data = static_cast<char*>(data);
+        m_size = size;
+    }
+
+    void
+    MappedImage::unmap()
+    {
+        if (m_data) {
+            (void)::munmap(m_data, m_size);
+        }
+        m_data = nullptr;
+        m_size = 0;
+    }
+}
@@ -0,0 +1,182 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "knoxcrypt/PlainImage.hpp"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+namespace knoxcrypt
+{
+
+    namespace
+    {
+        /// the open flags equivalent to opening a file stream with mode
+        int openFlags(std::ios::openmode const mode)
+        {
+            bool const in = (mode & std::ios::in) != 0;
+            bool const out = (mode & (std::ios::out | std::ios::app)) != 0;
+            bool const trunc = (mode & std::ios::trunc) != 0;
+            if (!out) {
+                return O_RDONLY;
+            }
+            int flags = in ? O_RDWR : O_WRONLY;
+
+            // as for fopen: "r+" opens an existing file, "w" and "w+"
+            // create or truncate and "a" and "a+" create
+            if (trunc || !(in || (mode & std::ios::app))) {
+                flags |= O_CREAT | O_TRUNC;
+            } else if (mode & std::ios::app) {
+                flags |= O_CREAT;
+            }
+            return flags;
+        }
+
+        /// how much is encrypted at a time on its way out
+        uint64_t const CIPHER_CHUNK_BYTES = 64 * 1024;
+
+        /// reads until n bytes have been read, the end is reached or a read fails
+        uint64_t readFully(int const fd, uint64_t const offset, char * const buf, uint64_t const n)
+        {
+            uint64_t done = 0;
+            while (done < n) {
+                ssize_t const count = ::pread(fd, buf + done, n - done, off_t(offset + done));
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count <= 0) {
+                    break;
+                }
+                done += uint64_t(count);
+            }
+            return done;
+        }
+
+        /// writes until n bytes have been written or a write fails
+        uint64_t writeFully(int const fd, uint64_t const offset, char const * const buf, uint64_t const n)
+        {
+            uint64_t done = 0;
+            while (done < n) {
+                ssize_t const count = ::pwrite(fd, buf + done, n - done, off_t(offset + done));
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count <= 0) {
+                    break;
+                }
+                done += uint64_t(count);
+            }
+            return done;
+        }
+    }
+
+    PlainImage::PlainImage(std::string const &path, std::ios::openmode const mode,
+                           SharedImageCipher const &cipher)
+        : m_fd(::open(path.c_str(), openFlags(mode), 0644))
+        , m_cipher(cipher)
+    {
+    }
+
+    PlainImage::~PlainImage()
+    {
+        if (m_fd >= 0) {
+            (void)::close(m_fd);
+        }
+    }
+
+    SharedPlainImage
+    PlainImage::get(SharedCoreIO const &io, std::ios::openmode const mode)
+    {
+        if (io->encProps.cipher == cryptostreampp::Algorithm::NONE) {
+            return std::make_shared<PlainImage>(io->path, mode);
+        }
+
+        // decrypted data is cached by going through the cipher stream
+        if (io->decryptedCacheBytes > 0) {
+            return SharedPlainImage();
+        }
+        auto cipher(ImageCipher::get(io));
+        if (!cipher) {
+            return SharedPlainImage();
+        }
+        return std::make_shared<PlainImage>(io->path, mode, cipher);
+    }
+
+    bool
+    PlainImage::isOpen() const
+    {
+        return m_fd >= 0;
+    }
+
+    uint64_t
+    PlainImage::read(uint64_t const offset, char * const buf, uint64_t const n)
+    {
+        uint64_t const done = readFully(m_fd, offset, buf, n);
+        if (m_cipher && done > 0) {
+            m_cipher->transform(offset, buf, buf, done);
+        }
+        return done;
+    }
+
+    uint64_t
+    PlainImage::write(uint64_t const offset, char const * const buf, uint64_t const n)
+    {
+        if (!m_cipher) {
+            return writeFully(m_fd, offset, buf, n);
+        }
+
+        // the caller's bytes are left alone; each piece is encrypted in to
+        // a buffer of this thread's and written out from there
+        thread_local char theChunk[CIPHER_CHUNK_BYTES];
+        uint64_t done = 0;
+        while (done < n) {
+            uint64_t const count = std::min(CIPHER_CHUNK_BYTES, n - done);
+            m_cipher->transform(offset + done, buf + done, theChunk, count);
+            uint64_t const written = writeFully(m_fd, offset + done, theChunk, count);
+            done += written;
+            if (written < count) {
+                break;
+            }
+        }
+        return done;
+    }
+
+    uint64_t
+    PlainImage::size() const
+    {
+        struct stat st;
+        if (::fstat(m_fd, &st) != 0) {
+            return 0;
+        }
+        return uint64_t(st.st_size);
+    }
+}
@@ -0,0 +1,519 @@
+/*
+  Copyright (c) <2013-present>, <BenHJ>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+  3. Neither the name of the copyright holder nor the names of its contributors
+  may be used to endorse or promote products derived from this software without
+  specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+  ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "knoxcrypt/VolumeBitmap.hpp"
+#include "knoxcrypt/ContainerImageStream.hpp"
+#include "knoxcrypt/detail/DetailKnoxCrypt.hpp"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace knoxcrypt
+{
+
+    namespace
+    {
+        /// bitmaps already loaded, keyed by image path, so that several
+        /// CoreIO objects referring to the one image share the same bitmap
+        using BitmapRegistry = std::map<std::string, std::weak_ptr<VolumeBitmap>>;
+
+        BitmapRegistry &registry()
+        {
+            static BitmapRegistry theRegistry;
+            return theRegistry;
+        }
+
+        std::mutex &registryMutex()
+        {
+            static std::mutex theMutex;
+            return theMutex;
+        }
+
+        /// how far beyond near the search for a single run long enough for
+        /// an allocation carries on once shorter runs already cover it
+        uint64_t const NEAR_SEARCH_BLOCKS = 8 * detail::BITMAP_PAGE_BLOCKS;
+    }
+
+    VolumeBitmap::VolumeBitmap(SharedCoreIO const &io)
+        : m_blocks(io->blocks)
+        , m_version(io->version)
+        , m_bytes(io->blocks / uint64_t(8), 0)
+        , m_loadedPages(detail::bitmapPageCount(io->blocks), true)
+        , m_dirtyPages(detail::bitmapPageCount(io->blocks), false)
+        , m_hasDirtyPages(false)
+        , m_markedUnclean(false)
+        , m_regionFree(detail::bitmapPageCount(io->blocks), 0)
+        , m_freeBlocks(0)
+        , m_pagesWithFree((detail::bitmapPageCount(io->blocks) + 63) / 64, 0)
+        , m_pageGroupsWithFree((detail::bitmapPageCount(io->blocks) + 4095) / 4096, 0)
+        , m_stream(std::make_shared<ContainerImageStream>(io, std::ios::in | std::ios::out | std::ios::binary))
+    {
+        // image might not exist yet in which case the bitmap
+        // is left zeroed and won't be written back
+        if (!m_stream->is_open()) {
+            m_stream.reset();
+            loadAllAndCount();
+            return;
+        }
+
+        if (m_version < detail::VERSION_SUPERBLOCK) {
+            loadAllAndCount();
+            return;
+        }
+
+        if (readSuperblock()) {
+            rebuildPageIndex();
+            std::fill(m_bytes.begin(), m_bytes.end(), 0xFF);
+            std::fill(m_loadedPages.begin(), m_loadedPages.end(), false);
+        } else {
+            loadAllAndCount();
+            auto const superblock(detail::buildSuperblock(m_blocks, false, m_regionFree));
+            (void)m_stream->seekp(detail::superblockOffset(m_blocks));
+            (void)m_stream->write((char*)&superblock.front(), superblock.size());
+            m_stream->flush();
+            m_markedUnclean = true;
+        }
+
+        // the image is only marked as in use once a page is first modified
+        // (see markUnclean) so that read-only mounts leave it clean
+    }
+
+    VolumeBitmap::~VolumeBitmap()
+    {
+        try {
+            sync();
+            if (m_markedUnclean) {
+                writeSuperblockHeader(true);
+                m_stream->flush();
+            }
+        } catch (...) {
+            // never throw from destructor
+        }
+    }
+
+    bool
+    VolumeBitmap::readSuperblock()
+    {
+        uint8_t header[detail::SUPERBLOCK_HEADER_BYTES];
+        (void)m_stream->seekg(detail::superblockOffset(m_blocks));
+        (void)m_stream->read((char*)header, detail::SUPERBLOCK_HEADER_BYTES);
+        uint64_t const freeBlocks = detail::convertInt8ArrayToInt64(header + 1);
+        uint64_t const regions = detail::convertInt8ArrayToInt64(header + 9);
+        if (header[0] != 1 || regions != m_regionFree.size() || freeBlocks > m_blocks) {
+            return false;
+        }
+
+        std::vector<uint8_t> regionBytes(4 * regions);
+        if (!regionBytes.empty()) {
+            (void)m_stream->read((char*)&regionBytes.front(), regionBytes.size());
+        }
+        uint64_t total(0);
+        for (uint64_t region = 0; region < regions; ++region) {
+            m_regionFree[region] = detail::convertInt4ArrayToInt32(&regionBytes[4 * region]);
+            total += m_regionFree[region];
+        }
+
+        // a summary that doesn't add up can't be trusted
+        if (total != freeBlocks) {
+            return false;
+        }
+        m_freeBlocks = freeBlocks;
+        return true;
+    }
+
+    void
+    VolumeBitmap::writeSuperblockHeader(bool const clean)
+    {
+        uint8_t header[detail::SUPERBLOCK_HEADER_BYTES];
+        detail::buildSuperblockHeader(m_blocks, clean, m_freeBlocks, header);
+        (void)m_stream->seekp(detail::superblockOffset(m_blocks));
+        (void)m_stream->write((char*)header, detail::SUPERBLOCK_HEADER_BYTES);
+    }
+
+    void
+    VolumeBitmap::markUnclean()
+    {
+        if (m_markedUnclean || !m_stream || m_version < detail::VERSION_SUPERBLOCK) {
+            return;
+        }
+
+        // until unmounted cleanly, a later mount will need to rescan
+        writeSuperblockHeader(false);
+        m_stream->flush();
+        m_markedUnclean = true;
+    }
+
+    void
+    VolumeBitmap::loadAllAndCount()
+    {
+        if (m_stream && !m_bytes.empty()) {
+            (void)m_stream->seekg(detail::beginning() + 8);
+            (void)m_stream->read((char*)&m_bytes.front(), m_bytes.size());
+        }
+        m_freeBlocks = 0;
+        for (uint64_t page = 0; page < m_regionFree.size(); ++page) {
+            uint64_t const offset = page * detail::BITMAP_PAGE_BYTES;
+            uint64_t const bytes = std::min(detail::BITMAP_PAGE_BYTES, m_bytes.size() - offset);
+            m_regionFree[page] = uint32_t(bytes * 8 - detail::countAllocatedBlocksInBitmap(&m_bytes[offset], bytes));
+            m_freeBlocks += m_regionFree[page];
+        }
+        rebuildPageIndex();
+    }
+
+    void
+    VolumeBitmap::rebuildPageIndex()
+    {
+        std::fill(m_pagesWithFree.begin(), m_pagesWithFree.end(), 0);
+        std::fill(m_pageGroupsWithFree.begin(), m_pageGroupsWithFree.end(), 0);
+        for (uint64_t page = 0; page < m_regionFree.size(); ++page) {
+            if (m_regionFree[page] > 0) {
+                detail::updateSummaryBit(m_pagesWithFree, m_pageGroupsWithFree, page, true);
+            }
+        }
+    }
+
+    uint64_t
+    VolumeBitmap::findNextPageWithFree(uint64_t const from) const
+    {
+        return detail::findNextSetBitInSummary(m_pagesWithFree, m_pageGroupsWithFree,
+                                               from, m_regionFree.size());
+    }
+
+    void
+    VolumeBitmap::loadPage(uint64_t const page) const
+    {
+        if (m_loadedPages[page]) {
+            return;
+        }
+        m_loadedPages[page] = true;
+
+        // a page without free blocks is already correct as every bit is set
+        if (m_regionFree[page] == 0 || !m_stream) {
+            return;
+        }
+        uint64_t const offset = page * detail::BITMAP_PAGE_BYTES;
+        uint64_t const bytes = std::min(detail::BITMAP_PAGE_BYTES, m_bytes.size() - offset);
+        (void)m_stream->seekg(detail::beginning() + 8 + offset);
+        (void)m_stream->read((char*)&m_bytes[offset], bytes);
+    }
+
+    void
+    VolumeBitmap::detach()
+    {
+        m_stream.reset();
+    }
+
+    SharedVolumeBitmap
+    VolumeBitmap::get(SharedCoreIO const &io)
+    {
+        if (io->volumeBitmap) {
+            return io->volumeBitmap;
+        }
+
+        std::lock_guard<std::mutex> lock(registryMutex());
+        auto &theRegistry = registry();
+        auto it(theRegistry.find(io->path));
+        if (it != theRegistry.end()) {
+            auto bitmap(it->second.lock());
+            if (bitmap && bitmap->m_blocks == io->blocks) {
+                io->volumeBitmap = bitmap;
+                return bitmap;
+            }
+        }
+
+        auto bitmap(std::make_shared<VolumeBitmap>(io));
+
+        // only hold on to the bitmap if it could actually be loaded
+        if (bitmap->m_stream) {
+            theRegistry[io->path] = bitmap;
+            io->volumeBitmap = bitmap;
+        }
+        return bitmap;
+    }
+
+    void
+    VolumeBitmap::invalidate(SharedCoreIO const &io)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        auto &theRegistry = registry();
+        auto it(theRegistry.find(io->path));
+        if (it != theRegistry.end()) {
+            // the image is being rebuilt so a bitmap still held on
+            // to elsewhere must not write to it any more
+            auto bitmap(it->second.lock());
+            if (bitmap) {
+                bitmap->detach();
+            }
+            theRegistry.erase(it);
+        }
+        io->volumeBitmap.reset();
+    }
+
+    bool
+    VolumeBitmap::isBlockInUse(uint64_t const block) const
+    {
+        uint64_t const byte = block / 8;
+        if (byte >= m_bytes.size()) {
+            return true;
+        }
+        loadPage(byte / detail::BITMAP_PAGE_BYTES);
+        uint8_t dat = m_bytes[byte];
+        return detail::isBitSetInByte(dat, block % 8);
+    }
+
+    void
+    VolumeBitmap::setBlockInUse(uint64_t const block, bool const set)
+    {
+        uint64_t const byte = block / 8;
+        if (byte >= m_bytes.size()) {
+            return;
+        }
+        uint64_t const page = byte / detail::BITMAP_PAGE_BYTES;
+        loadPage(page);
+        if (detail::isBitSetInByte(m_bytes[byte], block % 8) == set) {
+            return;
+        }
+        detail::setBitInByte(m_bytes[byte], block % 8, set);
+        if (set) {
+            --m_regionFree[page];
+            --m_freeBlocks;
+            if (m_regionFree[page] == 0) {
+                detail::updateSummaryBit(m_pagesWithFree, m_pageGroupsWithFree, page, false);
+            }
+        } else {
+            ++m_regionFree[page];
+            ++m_freeBlocks;
+            if (m_regionFree[page] == 1) {
+                detail::updateSummaryBit(m_pagesWithFree, m_pageGroupsWithFree, page, true);
+            }
+        }
+        if (!m_hasDirtyPages) {
+            markUnclean();
+        }
+        m_dirtyPages[page] = true;
+        m_hasDirtyPages = true;
+    }
+
+    uint64_t
+    VolumeBitmap::getNumberOfAllocatedBlocks() const
+    {
+        return m_blocks - m_freeBlocks;
+    }
+
+    boost::optional<uint64_t>
+    VolumeBitmap::getNextAvailableBlock() const
+    {
+        // the page index says which page to look in
+        uint64_t const pages = m_regionFree.size();
+        for (uint64_t page = findNextPageWithFree(0); page < pages; page = findNextPageWithFree(page + 1)) {
+            loadPage(page);
+            uint64_t const offset = page * detail::BITMAP_PAGE_BYTES;
+            uint64_t const bytes = std::min(detail::BITMAP_PAGE_BYTES, m_bytes.size() - offset);
+            auto block(detail::findNextAvailableBlockInBitmap(&m_bytes[offset], bytes, bytes * 8));
+            if (block) {
+                return *block + offset * 8;
+            }
+        }
+        return boost::optional<uint64_t>();
+    }
+
+    std::vector<uint64_t>
+    VolumeBitmap::getNAvailableBlocks(uint64_t const blocksRequired) const
+    {
+        // the page index says which pages to look in so that full pages
+        // are neither read in nor scanned
+        std::vector<uint64_t> blocks(std::min(blocksRequired, m_freeBlocks));
+        uint64_t const pages = m_regionFree.size();
+        uint64_t found(0);
+        for (uint64_t page = findNextPageWithFree(0); page < pages && found < blocks.size();
+             page = findNextPageWithFree(page + 1)) {
+            loadPage(page);
+            uint64_t const offset = page * detail::BITMAP_PAGE_BYTES;
+            uint64_t const bytes = std::min(detail::BITMAP_PAGE_BYTES, m_bytes.size() - offset);
+            uint64_t const inPage = detail::findNAvailableBlocksInBitmap(&m_bytes[offset], bytes,
+                                                                         blocks.size() - found, &blocks[found]);
+            for (uint64_t i = found; i < found + inPage; ++i) {
+                blocks[i] += offset * 8;
+            }
+            found += inPage;
+        }
+        blocks.resize(found);
+        return blocks;
+    }
+
+    uint64_t
+    VolumeBitmap::getFreeExtents(uint64_t const from,
+                                 std::size_t const maxExtents,
+                                 BlockExtents &extents) const
+    {
+        // scan a page at a time so that only pages with free blocks are
+        // read in; runs that cross a page boundary are stitched back together
+        std::size_t const initial = extents.size();
+        uint64_t cursor = from;
+        while (cursor < m_blocks && extents.size() - initial < maxExtents) {
+            uint64_t page = cursor / detail::BITMAP_PAGE_BLOCKS;
+            if (m_regionFree[page] == 0) {
+                page = findNextPageWithFree(page);
+                if (page == m_regionFree.size()) {
+                    cursor = m_blocks;
+                    break;
+                }
+                cursor = page * detail::BITMAP_PAGE_BLOCKS;
+            }
+            uint64_t const pageEnd = std::min((page + 1) * detail::BITMAP_PAGE_BLOCKS, m_blocks);
+            loadPage(page);
+            BlockExtents found;
+            cursor = detail::findFreeExtentsInBitmap(&m_bytes.front(), pageEnd / 8, pageEnd, cursor,
+                                                     maxExtents - (extents.size() - initial), found);
+            for (auto const &extent : found) {
+                if (extents.size() > initial &&
+                    extents.back().start + extents.back().length == extent.start) {
+                    extents.back().length += extent.length;
+                } else {
+                    extents.push_back(extent);
+                }
+            }
+            if (cursor < pageEnd) {
+                break;
+            }
+        }
+        return std::min(cursor, m_blocks);
+    }
+
+    BlockExtents
+    VolumeBitmap::getFreeBlocksNear(uint64_t const near,
+                                    uint64_t const blocksRequired) const
+    {
+        BlockExtents extents;
+        if (m_bytes.empty() || blocksRequired == 0) {
+            return extents;
+        }
+
+        // free runs are visited a page at a time from the page holding near
+        // to the end and then from the start back round to near, passing
+        // over pages without free blocks so that only the pages visited are
+        // read in. The first run long enough for every block is taken as
+        // soon as it is seen. The shorter runs before it are kept and are
+        // pieced together instead once they cover the request and the search
+        // has gone NEAR_SEARCH_BLOCKS beyond near
+        uint64_t const from = std::min(near, m_blocks);
+        uint64_t const starts[] = {from, 0};
+        uint64_t const stops[] = {m_blocks, from};
+        uint8_t const * const bitmap = &m_bytes.front();
+        uint64_t found(0);
+
+        // keeps as much of a finished run as is still needed and says
+        // whether the search can stop there
+        auto endRun = [&](BlockExtent const &run, int const pass) {
+            if (run.length > 0 && found < blocksRequired) {
+                uint64_t const taken = std::min(run.length, blocksRequired - found);
+                extents.push_back(BlockExtent{run.start, taken});
+                found += taken;
+            }
+            uint64_t const end = run.start + run.length;
+            uint64_t const searched = pass == 0 ? end - from : m_blocks - from + end;
+            return found == blocksRequired && searched >= NEAR_SEARCH_BLOCKS;
+        };
+
+        for (int pass = 0; pass < 2; ++pass) {
+            uint64_t cursor = starts[pass];
+
+            // the run being built up, which can carry on across pages
+            BlockExtent run{cursor, 0};
+            while (cursor < stops[pass]) {
+                uint64_t const page = cursor / detail::BITMAP_PAGE_BLOCKS;
+                if (m_regionFree[page] == 0) {
+                    // the page index gives the next page with a free block
+                    // without looking at the full pages in between
+                    cursor = findNextPageWithFree(page) * detail::BITMAP_PAGE_BLOCKS;
+                    continue;
+                }
+                loadPage(page);
+                uint64_t const pageEnd = std::min((page + 1) * detail::BITMAP_PAGE_BLOCKS, stops[pass]);
+                uint64_t const bytes = (pageEnd + 7) / 8;
+                while (cursor < pageEnd) {
+                    uint64_t const start = detail::findNextBlockInBitmap(bitmap, bytes, pageEnd, cursor, false);
+                    if (start == pageEnd) {
+                        cursor = pageEnd;
+                        break;
+                    }
+                    cursor = detail::findNextBlockInBitmap(bitmap, bytes, pageEnd, start, true);
+                    if (run.start + run.length != start) {
+                        if (endRun(run, pass)) {
+                            return extents;
+                        }
+                        run = BlockExtent{start, 0};
+                    }
+                    run.length += cursor - start;
+                    if (run.length >= blocksRequired) {
+                        extents.assign(1, BlockExtent{run.start, blocksRequired});
+                        return extents;
+                    }
+                }
+            }
+            if (endRun(run, pass)) {
+                break;
+            }
+        }
+        return extents;
+    }
+
+    void
+    VolumeBitmap::sync()
+    {
+        if (!m_hasDirtyPages || !m_stream) {
+            return;
+        }
+        bool const withSummary = m_version >= detail::VERSION_SUPERBLOCK;
+        uint64_t const pages = m_dirtyPages.size();
+        for (uint64_t page = 0; page < pages; ++page) {
+            if (!m_dirtyPages[page]) {
+                continue;
+            }
+            uint64_t const offset = page * detail::BITMAP_PAGE_BYTES;
+            uint64_t const bytes = std::min(detail::BITMAP_PAGE_BYTES, m_bytes.size() - offset);
+            (void)m_stream->seekp(detail::beginning() + 8 + offset);
+            (void)m_stream->write((char*)&m_bytes[offset], bytes);
+            if (withSummary) {
+                uint8_t regionFree[4];
+                detail::convertInt32ToInt4Array(m_regionFree[page], regionFree);
+                (void)m_stream->seekp(detail::superblockOffset(m_blocks) + detail::SUPERBLOCK_HEADER_BYTES + 4 * page);
+                (void)m_stream->write((char*)regionFree, 4);
+            }
+            m_dirtyPages[page] = false;
+        }
+        if (withSummary) {
+            writeSuperblockHeader(false);
+        }
+        m_stream->flush();
+        m_hasDirtyPages = false;
+    }
+}
@@ -68,6 +68,7 @@ int main(int argc, char *argv[])
     bool sparse;
     std::string cipher;
     long blockSize;
+    unsigned int ioQueueDepth;
     po::options_description desc("Allowed options");
     desc.add_options()
         ("help", "produce help message")
@@ -76,7 +77,8 @@ int main(int argc, char *argv[])
         ("blockCount", po::value<uint64_t>(), "size of filesystem in blocks")
         ("coffee", po::value<bool>(&magicPartition)->default_value(false), "create alternative sub-volume")
         ("sparse", po::value<bool>(&sparse)->default_value(false), "create a sparse image")
-        ("cipher", po::value<std::string>(&cipher)->default_value("aes"), "the cipher type used");
+        ("cipher", po::value<std::string>(&cipher)->default_value("aes"), "the cipher type used")
+        ("ioQueueDepth", po::value<unsigned int>(&ioQueueDepth)->default_value(8), "block writes kept in flight when building the image (0 writes one block at a time)");
 
     po::positional_options_description positionalOptions;
     (void)positionalOptions.add("imageName", 1);
@@ -136,6 +138,7 @@ int main(int argc, char *argv[])
     io->freeBlocks = blocks;
     io->encProps.password.append(knoxcrypt::utility::getPassword("knoxcrypt password: "));
     io->rounds = 64; // obsolete (not currently used; used to be used by XTEA)
+    io->ioQueueDepth = ioQueueDepth;
 
     if(cipher == "aes") {
         io->encProps.cipher = cryptostreampp::Algorithm::AES;
@@ -173,9 +176,7 @@ int main(int argc, char *argv[])
     }
 
     // register progress call back for cipher
-    long const amount = knoxcrypt::detail::CIPHER_BUFFER_SIZE / 100000;
-    auto f(std::bind(&knoxcrypt::cipherCallback, std::placeholders::_1, amount));
-    io->ccb = f;
+    io->ccb = knoxcrypt::CoreIO::Callback(&knoxcrypt::cipherCallback);
 
     knoxcrypt::MakeKnoxCrypt imager(io, sparse, omp);
 
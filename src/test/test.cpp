@@ -26,7 +26,11 @@
   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include "test/AlignedBufferPoolTest.hpp"
+#include "test/BlockIOEngineTest.hpp"
+#include "test/ContainerImageStreamTest.hpp"
 #include "test/CoreFSTest.hpp"
+#include "test/DecryptedBlockCacheTest.hpp"
 #include "test/FileBlockTest.hpp"
 #include "test/FileBlockIteratorTest.hpp"
 #include "test/FileTest.hpp"
@@ -35,6 +39,7 @@
 #include "test/ContentFolderTest.hpp"
 #include "test/SimpleTest.hpp"
 #include "test/TestHelpers.hpp"
+#include "test/VolumeBitmapTest.hpp"
 
 #include <boost/timer/timer.hpp>
 
@@ -52,6 +57,11 @@ int main()
         FileBlockIteratorTest();
         FileTest();
         ContentFolderTest();
+        VolumeBitmapTest();
+        DecryptedBlockCacheTest();
+        ContainerImageStreamTest();
+        BlockIOEngineTest();
+        AlignedBufferPoolTest();
     }
 
     simpletest::showResults();
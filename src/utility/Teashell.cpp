@@ -37,6 +37,7 @@
 #include "knoxcrypt/EntryInfo.hpp"
 #include "knoxcrypt/CompoundFolderEntryIterator.hpp"
 #include "knoxcrypt/FileBlockBuilder.hpp"
+#include "knoxcrypt/VolumeBitmap.hpp"
 #include "knoxcrypt/CoreFS.hpp"
 #include "knoxcrypt/KnoxCryptException.hpp"
 #include "knoxcrypt/FileStreamPtr.hpp"
@@ -576,12 +577,22 @@ int main(int argc, char *argv[])
 {
     // parse the program options
     bool magic = false;
+    uint64_t cacheMB = 64;
+    uint64_t writeBackMB = 16;
+    bool mapImage = false;
+    unsigned int ioQueueDepth = 8;
+    bool dropHostCache = false;
     namespace po = boost::program_options;
     po::options_description desc("Allowed options");
     desc.add_options()
         ("help", "produce help message")
         ("imageName", po::value<std::string>(), "knoxcrypt image path")
         ("coffee", po::value<bool>(&magic)->default_value(false), "mount alternative sub-volume")
+        ("cacheMB", po::value<uint64_t>(&cacheMB)->default_value(64), "decrypted block cache size in MB (0 disables)")
+        ("writeBackMB", po::value<uint64_t>(&writeBackMB)->default_value(16), "MB of writes the cache may hold back (0 writes straight through)")
+        ("mapImage", po::value<bool>(&mapImage)->default_value(false), "access the image through a memory mapping")
+        ("ioQueueDepth", po::value<unsigned int>(&ioQueueDepth)->default_value(8), "image reads kept in flight when reading files (0 reads one block at a time)")
+        ("dropHostCache", po::value<bool>(&dropHostCache)->default_value(false), "advise the system to drop image data from its page cache once read or written back (best with cacheMB); a cache hint, not O_DIRECT")
         ;
 
     po::positional_options_description positionalOptions;
@@ -619,6 +630,10 @@ int main(int argc, char *argv[])
     // the knoxcrypt image
     auto io(std::make_shared<knoxcrypt::CoreIO>());
     io->useBlockCache = true;
+    io->decryptedCacheBytes = cacheMB * 1024 * 1024;
+    io->writeBackBytes = writeBackMB * 1024 * 1024;
+    io->ioQueueDepth = ioQueueDepth;
+    io->dropHostCache = dropHostCache;
     io->path = vm["imageName"].as<std::string>().c_str();
     io->encProps.password = knoxcrypt::utility::getPassword("knoxcrypt password: ");
     io->rootBlock = magic ? atoi(knoxcrypt::utility::getPassword("magic number: ").c_str()) : 0;
@@ -627,10 +642,15 @@ int main(int argc, char *argv[])
     // and the number of xtea rounds from the ninth byte
     knoxcrypt::detail::readImageIVAndRounds(io);
 
+    // the bytes of an encrypted image are decrypted on their way out of
+    // the mapping and encrypted on their way in
+    if (mapImage) {
+        io->mapImage = true;
+        io->decryptedCacheBytes = 0;
+    }
+
     // Obtain the number of blocks in the image by reading the image's block count
-    long const amount = knoxcrypt::detail::CIPHER_BUFFER_SIZE / 100000;
-    auto f(std::bind(&knoxcrypt::cipherCallback, std::placeholders::_1, amount));
-    io->ccb = f;
+    io->ccb = knoxcrypt::CoreIO::Callback(&knoxcrypt::cipherCallback);
     knoxcrypt::ContainerImageStream stream(io, std::ios::in | std::ios::binary);
 
     // compare password hashes
@@ -647,7 +667,7 @@ int main(int argc, char *argv[])
 
     printf("Counting allocated blocks. Please wait...\n");
 
-    io->freeBlocks = io->blocks - knoxcrypt::detail::getNumberOfAllocatedBlocks(stream);
+    io->freeBlocks = io->blocks - knoxcrypt::VolumeBitmap::get(io)->getNumberOfAllocatedBlocks();
     io->blockBuilder = std::make_shared<knoxcrypt::FileBlockBuilder>(io);
 
     printf("Finished counting allocated blocks.\n");